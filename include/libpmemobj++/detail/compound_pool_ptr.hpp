@@ -1,6 +1,8 @@
 #ifndef LIBPMEMOBJ_CPP_COMPOUND_POOL_PTR_HPP
 #define LIBPMEMOBJ_CPP_COMPOUND_POOL_PTR_HPP
 
+#include <cassert>
+
 namespace pmem
 {
 
@@ -138,12 +140,41 @@ public:
 		return static_cast<element_type *>(pmemobj_direct(oid));
 	}
 
+	/**
+	 * Get a direct pointer from the cached base address of the pool.
+	 *
+	 * Avoids the pool lookup in pmemobj_direct(), which is used as a
+	 * fallback when no base address is given and for checking in debug
+	 * builds.
+	 *
+	 * @return a direct pointer to the object.
+	 */
+	element_type *
+	get_address(uint64_t pool_uuid, char *pool_base) const noexcept
+	{
+		if (pool_base == nullptr)
+			return get_address(pool_uuid);
+
+		uint64_t ptr = (this->off & 0x0000FFFFFFFFFFFC);
+		element_type *addr = ptr == 0 ? nullptr :
+			reinterpret_cast<element_type *>(pool_base + ptr);
+		assert(addr == get_address(pool_uuid));
+
+		return addr;
+	}
+
 	element_type *
 	operator()(uint64_t pool_uuid) const noexcept
 	{
 		return get_address(pool_uuid);
 	}
 
+	element_type *
+	operator()(uint64_t pool_uuid, char *pool_base) const noexcept
+	{
+		return get_address(pool_uuid, pool_base);
+	}
+
 	/**
 	 * Swaps two compound_pool_ptr objects of the same type.
 	 */
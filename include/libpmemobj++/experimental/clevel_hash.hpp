@@ -7,6 +7,9 @@
 #include <libpmemobj++/experimental/v.hpp>
 #include <libpmemobj++/experimental/concurrent_hash_map.hpp>
 #include <libpmemobj++/experimental/hash.hpp>
+#include <libpmemobj++/experimental/kv_allocator.hpp>
+#include <libpmemobj++/experimental/resize_policy.hpp>
+#include <libpmemobj++/experimental/thread_slots.hpp>
 #include <libpmemobj++/make_persistent.hpp>
 #include <libpmemobj++/make_persistent_atomic.hpp>
 #include <libpmemobj++/mutex.hpp>
@@ -23,18 +26,22 @@
 #include <libpmemobj++/detail/persistent_pool_ptr.hpp>
 #include <libpmemobj++/detail/specialization.hpp>
 
+#include <algorithm>
 #include <atomic>
 #include <cassert>
+#include <chrono>
 #include <cmath>
 #include <cstddef>
 #include <cstdint>
 #include <cstdlib>
+#include <cstring>
 #include <functional>
 #include <initializer_list>
 #include <iostream>
 #include <iterator>
 #include <memory>
 #include <mutex>
+#include <random>
 #include <thread>
 #include <time.h>
 #include <type_traits>
@@ -52,6 +59,11 @@
 
 // #define CLEVEL_DEBUG 1
 
+// Define CLEVEL_META_FLUSH_ON_READ to persist meta on every read instead
+// of only when it is marked dirty, and CLEVEL_STATS to keep counters of
+// the retries, persists and events of operations (see stats() and
+// persist_count()).
+
 /**
  * The builtin performs an atomic compare and swap. That is, if the
  * current value of *ptr is oldval, then write newval into *ptr.
@@ -77,8 +89,21 @@ using namespace pmem::obj;
 using internal::shared_mutex_scoped_lock;
 #endif
 
+/** @cond INTERNAL */
+namespace internal
+{
+template <typename Hash>
+using memoize_hash = typename Hash::memoize_hash;
+
+template <typename Hash>
+using has_memoize_hash = detail::supports<Hash, memoize_hash>;
+} /* namespace internal */
+/** @endcond */
+
 template <typename Key, typename T, typename Hash = std::hash<Key>,
-	  typename KeyEqual = std::equal_to<Key>, size_t HashPower = 14>
+	  typename KeyEqual = std::equal_to<Key>, size_t HashPower = 14,
+	  typename KVAllocator = pmemobj_kv_allocator<std::pair<const Key, T>>,
+	  typename ResizePolicy = insert_failure_resize_policy>
 class clevel_hash {
 public:
 	using key_type = Key;
@@ -107,10 +132,63 @@ public:
 		VACANCY_IN_RIGHT = 4,
 	} f_code_t;
 
+	// Counters of stats(), kept only if CLEVEL_STATS is defined.
+	typedef enum StatCounter
+	{
+		// CAS failures on slots, by operation.
+		STAT_INSERT_CAS_FAILURES = 0,
+		STAT_UPDATE_CAS_FAILURES,
+		STAT_ERASE_CAS_FAILURES,
+		STAT_REHASH_CAS_FAILURES,
+		// Jumps to RETRY_INSERT and RETRY_FIND.
+		STAT_INSERT_RETRIES,
+		STAT_FIND_RETRIES,
+		// Rounds redone since meta changed under them.
+		STAT_CONTEXT_RETRIES,
+		STAT_DEL_DUPS,
+		STAT_PERSISTS,
+		STAT_EXPANSIONS,
+		STAT_REHASHED_ITEMS,
+		// Time rehashing workers spend in ranges, in nanoseconds.
+		STAT_REHASH_NS,
+		// Searches, and the levels they probed.
+		STAT_LOOKUPS,
+		STAT_LEVELS_PROBED,
+		STAT_NUM
+	} stat_counter_t;
+
 	struct level_bucket;
 	struct level_meta;
 
 
+	/**
+	 * KV entry which stores the hash value of the key after the pair, so
+	 * that rehashing reads the hash value instead of hashing the key.
+	 * Used when Hash declares a member type memoize_hash, which suits
+	 * hashers that are expensive to run (e.g. over long strings).
+	 */
+	struct hashed_KV_entry
+	{
+		template <typename... Args>
+		hashed_KV_entry(hv_type h, Args &&... args)
+			: value(std::forward<Args>(args)...), hv(h)
+		{
+		}
+
+		value_type value;
+		hv_type hv;
+	};
+
+	constexpr static bool memoized_hash =
+		internal::has_memoize_hash<Hash>::value;
+
+	/**
+	 * Type of the allocated KV entries, whose value_type is at offset 0
+	 * in both layouts. Slots point to the value_type.
+	 */
+	using KV_entry = typename std::conditional<memoized_hash,
+		hashed_KV_entry, value_type>::type;
+
 	using KV_entry_ptr_t = detail::compound_pool_ptr<value_type>;
 
 	using level_ptr_t = detail::compound_pool_ptr<level_bucket>;
@@ -126,11 +204,79 @@ public:
 #endif
 
 	constexpr static size_type assoc_num = 8;
-	constexpr static size_type resize_bulk = 1;
+	// Number of buckets a rehashing worker claims from the last level at
+	// a time.
+	constexpr static size_type resize_bulk = 16;
+	// Number of keys multi_search() processes in one round of
+	// prefetching.
+	constexpr static size_type search_batch = 64;
+	// Number of buckets whose KV entries a scan prefetches at a time.
+	constexpr static size_type scan_batch = 8;
+	// Number of counters that threads in epochs are spread over.
+	constexpr static size_type epoch_stripes = 64;
+	// Number of counters that item counts of threads are spread over.
+	constexpr static size_type item_stripes = 64;
+	// The thread slot table has thread_slot_base slots at first and
+	// doubles with each of up to thread_slot_segments segments.
+	constexpr static size_type thread_slot_base = 8;
+	constexpr static size_type thread_slot_segments = 16;
+	// Number of records in the limbo list of each thread.
+	constexpr static size_type limbo_size = 4096;
+	// Number of free records a thread waits for before an erase or
+	// update, which bounds the entries retired in one operation.
+	constexpr static size_type limbo_reserve = 16;
+	// Number of levels up to which operations other than rehashing
+	// expand the table. The levels above, up to MAX_LEVEL, are left to
+	// the rehashing threads for the items they move.
+	constexpr static size_type insert_max_levels = MAX_LEVEL - 2;
+	// Interval (us) between two rounds of the reclaimer.
+	constexpr static size_type reclaim_interval = 1000;
+	// Default load factor at which the next level is prepared.
+	constexpr static double default_expand_watermark = 0.75;
+	// Default load factor at which reserve() sizes the table.
+	constexpr static double default_reserve_load_factor = 0.5;
+	// Number of buckets per level sampled to estimate the load factor.
+	constexpr static size_type load_samples = 256;
+	// Value of prepared_level while an expansion owns next_level.
+	constexpr static uint64_t level_claimed = 1;
+	// Number of consecutive rounds (10 ms apart) the expand thread
+	// waits with a load factor the resize policy deems low before it
+	// shrinks the table.
+	constexpr static size_type shrink_rounds = 100;
+
+	// Marker bit of meta set by a writer until the new meta is persisted.
+#ifdef CLEVEL_META_FLUSH_ON_READ
+	constexpr static uint64_t meta_dirty = 0;
+#else
+	constexpr static uint64_t meta_dirty = 0x1;
+#endif
 
 	constexpr static size_type partial_ext_bits
 		= (sizeof(uint64_t) - sizeof(partial_t)) * 8;
 
+	// Whether update() writes the mapped value into the existing KV entry
+	// with a CAS, which needs a trivially copyable T that fits a naturally
+	// aligned word. Define CLEVEL_UPDATE_OUT_OF_PLACE to always replace
+	// the entry instead.
+#ifdef CLEVEL_UPDATE_OUT_OF_PLACE
+	constexpr static bool in_place_update = false;
+#else
+	constexpr static bool in_place_update =
+		LIBPMEMOBJ_CPP_IS_TRIVIALLY_COPYABLE(T) &&
+		sizeof(T) <= sizeof(uint64_t) &&
+		(sizeof(T) & (sizeof(T) - 1)) == 0 &&
+		alignof(T) == sizeof(T);
+#endif
+
+	/**
+	 * Unsigned word of the size of T, through which the mapped value of
+	 * a KV entry is updated in place.
+	 */
+	using mapped_word = typename std::conditional<sizeof(T) == 1, uint8_t,
+		typename std::conditional<sizeof(T) == 2, uint16_t,
+		typename std::conditional<sizeof(T) == 4, uint32_t,
+		uint64_t>::type>::type>::type;
+
 
 	difference_type
 	first_index(hv_type hv, size_type capacity) const
@@ -267,6 +413,447 @@ public:
 		}
 	};
 
+	struct level_info
+	{
+		bucket *buckets;
+		uint64_t capacity;
+		// capacity / 2 - 1, as capacities are powers of two.
+		uint64_t mask;
+	};
+
+	/**
+	 * Volatile directory of the levels of a meta, from the last (bottom)
+	 * level to the first (top) level. Operations index it instead of
+	 * walking the "up" pointers in PM. It is valid while both meta and
+	 * dir_version are unchanged, which tells apart metas reallocated at
+	 * the same offset. Operations read it inside an epoch, so that it is
+	 * freed two epochs after another directory replaces it.
+	 */
+	struct level_dir
+	{
+		uint64_t meta;
+		uint64_t version;
+		// Epoch in which the directory is replaced.
+		uint64_t retired;
+		size_type n_levels;
+		level_info levels[MAX_LEVEL];
+	};
+
+	difference_type
+	first_index(hv_type hv, const level_info &l) const
+	{
+		return static_cast<difference_type>(hv & l.mask);
+	}
+
+	difference_type
+	second_index(partial_t partial, difference_type idx,
+		const level_info &l) const
+	{
+		partial_t nonzero_tag = (partial >> 1 << 1) + 1;
+		// 0xc6a4a7935bd1e995 is the hash constant from 64-bit MurmurHash2
+		uint64_t hash_of_tag = (uint64_t)(nonzero_tag * 0xc6a4a7935bd1e995);
+		return static_cast<difference_type>(
+			((static_cast<uint64_t>(idx) ^ hash_of_tag) & l.mask) +
+			l.mask + 1);
+	}
+
+	/**
+	 * Persistent progress record of a rehashing worker. The range
+	 * [begin, end) of the last level is persisted before it is claimed
+	 * from expand_bucket, and begin is advanced after each bucket is
+	 * rehashed. Hence, every bucket below expand_bucket has either been
+	 * rehashed or lies in an unfinished range of some worker.
+	 */
+	struct rehash_worker
+	{
+		p<difference_type> begin;
+		p<difference_type> end;
+		persistent_ptr<level_meta> tmp_meta;
+		persistent_ptr<level_bucket> tmp_level;
+
+		// Avoid false sharing among workers.
+		char padding[64 - 2 * sizeof(difference_type)
+			- sizeof(persistent_ptr<level_meta>)
+			- sizeof(persistent_ptr<level_bucket>)];
+	};
+
+	/**
+	 * Counters of threads in epochs, indexed by the parity of the epoch.
+	 */
+	struct epoch_stripe
+	{
+		std::atomic<size_type> cnt[2];
+
+		// Avoid false sharing among stripes.
+		char padding[64 - 2 * sizeof(std::atomic<size_type>)];
+	};
+
+	/**
+	 * Number of items inserted minus erased by the threads of a stripe,
+	 * counted if the resize policy needs the load factor.
+	 */
+	struct item_stripe
+	{
+		std::atomic<difference_type> cnt;
+
+		// Avoid false sharing among stripes.
+		char padding[64 - sizeof(std::atomic<difference_type>)];
+	};
+
+#ifdef CLEVEL_STATS
+	/**
+	 * Stat counters of the threads of a stripe, which are spread like
+	 * the epoch stripes.
+	 */
+	struct stats_stripe
+	{
+		std::atomic<uint64_t> cnt[STAT_NUM];
+
+		// Avoid false sharing among stripes.
+		char padding[64 - sizeof(std::atomic<uint64_t>) * STAT_NUM % 64];
+	};
+
+	/**
+	 * Stat counters summed over the threads by stats(). Rates follow
+	 * from the difference of two snapshots over their time.
+	 */
+	struct stats_snapshot
+	{
+		uint64_t cnt[STAT_NUM];
+		std::chrono::steady_clock::time_point time;
+
+		uint64_t
+		operator[](stat_counter_t c) const
+		{
+			return cnt[c];
+		}
+
+		double
+		levels_per_lookup() const
+		{
+			return cnt[STAT_LOOKUPS] == 0 ? 0 :
+				static_cast<double>(cnt[STAT_LEVELS_PROBED]) /
+				cnt[STAT_LOOKUPS];
+		}
+
+		/**
+		 * Items rehashed per second a worker spends rehashing.
+		 */
+		double
+		rehash_rate() const
+		{
+			return cnt[STAT_REHASH_NS] == 0 ? 0 :
+				cnt[STAT_REHASHED_ITEMS] * 1e9 / cnt[STAT_REHASH_NS];
+		}
+	};
+#endif
+
+	/**
+	 * Keeps the calling thread in the current epoch, so that KV entries
+	 * read in its scope are not freed.
+	 */
+	struct epoch_guard
+	{
+		epoch_guard(const clevel_hash *m)
+			: map(m), epoch(m->enter_epoch())
+		{
+		}
+
+		~epoch_guard()
+		{
+			map->leave_epoch(epoch);
+		}
+
+		/**
+		 * Leave the epoch and enter the current one, so that a thread
+		 * waiting in the scope does not hold back reclamation. KV
+		 * entries read before must not be used afterwards.
+		 */
+		void
+		renew()
+		{
+			map->leave_epoch(epoch);
+			epoch = map->enter_epoch();
+		}
+
+		const clevel_hash *map;
+		uint64_t epoch;
+	};
+
+	/**
+	 * Keeps rehashing from moving items while the calling thread scans
+	 * the table.
+	 */
+	struct scan_guard
+	{
+		scan_guard(const clevel_hash *m) : map(m)
+		{
+			map->enter_scan();
+		}
+
+		~scan_guard()
+		{
+			map->leave_scan();
+		}
+
+		const clevel_hash *map;
+	};
+
+	struct limbo_record
+	{
+		persistent_ptr<KV_entry> entry;
+		// Epoch in which the entry is unlinked, valid once the record is
+		// committed.
+		uint64_t epoch;
+	};
+
+	/**
+	 * Persistent list of the KV entries retired by a thread. The thread
+	 * logs an entry at tail before the CAS unlinking it, and commits the
+	 * record by advancing tail after the CAS succeeds. The reclaimer
+	 * frees committed records from head once no thread can refer to
+	 * them. Records left by a crash are freed by runtime_initialize() if
+	 * their entries are unreachable.
+	 */
+	struct limbo_list
+	{
+		limbo_record records[limbo_size];
+		std::atomic<size_type> head;
+		std::atomic<size_type> tail;
+
+		limbo_list() : head(0), tail(0)
+		{
+		}
+	};
+
+	/**
+	 * Persistent state of a thread slot, used by the thread that leases
+	 * the slot: the scratch buffers of its operations, which are freed
+	 * at recovery unless their results were linked into the table, and
+	 * its limbo list.
+	 */
+	struct thread_slot
+	{
+		persistent_ptr<level_meta> tmp_meta;
+		persistent_ptr<level_bucket> tmp_level;
+		persistent_ptr<KV_entry> tmp_entry;
+		limbo_list limbo;
+	};
+
+	using slot_layout =
+		slot_segments<thread_slot_base, thread_slot_segments>;
+
+	/**
+	 * Read-only accessor to an item. The item is not reclaimed by
+	 * concurrent erase until the accessor is released, so it can be
+	 * read in place without copying. Erased items are not reclaimed
+	 * while any accessor is held, so accessors should be released
+	 * promptly. A thread holding an accessor should not erase or update.
+	 */
+	class const_accessor
+	{
+		friend class clevel_hash<Key, T, Hash, KeyEqual, HashPower, KVAllocator,
+			ResizePolicy>;
+
+	public:
+		/**
+		 * Type of value
+		 */
+		using value_type =
+			const typename clevel_hash::value_type;
+
+		const_accessor() : my_map(nullptr), my_value(nullptr), my_epoch(0)
+		{
+		}
+
+		const_accessor(const const_accessor &) = delete;
+		const_accessor &operator=(const const_accessor &) = delete;
+
+		/**
+		 * Destroy result after releasing the underlying reference.
+		 */
+		~const_accessor()
+		{
+			release();
+		}
+
+		/**
+		 * @returns true if accessor does not hold any element, false
+		 * otherwise.
+		 */
+		bool
+		empty() const
+		{
+			return my_value == nullptr;
+		}
+
+		/**
+		 * Release accessor.
+		 */
+		void
+		release()
+		{
+			if (my_map)
+			{
+				my_map->leave_epoch(my_epoch);
+				my_map = nullptr;
+			}
+			my_value = nullptr;
+		}
+
+		/**
+		 * @return reference to associated value in hash table.
+		 */
+		const_reference operator*() const
+		{
+			assert(my_value);
+
+			return *my_value;
+		}
+
+		/**
+		 * @returns pointer to associated value in hash table.
+		 */
+		const_pointer operator->() const
+		{
+			return &operator*();
+		}
+
+	private:
+		const clevel_hash *my_map;
+		const_pointer my_value;
+		uint64_t my_epoch;
+	};
+
+	/**
+	 * Weakly consistent iterator over the items of all levels. Every item
+	 * present from begin() until the iterator reaches the end is visited
+	 * exactly once, while items inserted or erased meanwhile may or may
+	 * not be. Rehashing does not move items while an iterator is live,
+	 * and visited items are not reclaimed, so iterators should be run to
+	 * the end or released promptly. Iterators can be moved, not copied.
+	 */
+	class const_iterator
+	{
+		friend class clevel_hash<Key, T, Hash, KeyEqual, HashPower, KVAllocator,
+			ResizePolicy>;
+
+	public:
+		using iterator_category = std::input_iterator_tag;
+		using value_type = const typename clevel_hash::value_type;
+		using difference_type = ptrdiff_t;
+		using pointer = const_pointer;
+		using reference = const_reference;
+
+		const_iterator()
+			: my_map(nullptr), my_dir(nullptr), my_level(0),
+			my_bucket(0), my_slot(0), my_value(nullptr), my_epoch(0)
+		{
+		}
+
+		const_iterator(const const_iterator &) = delete;
+		const_iterator &operator=(const const_iterator &) = delete;
+
+		const_iterator(const_iterator &&other)
+			: my_map(other.my_map), my_dir(other.my_dir),
+			my_level(other.my_level), my_bucket(other.my_bucket),
+			my_slot(other.my_slot), my_value(other.my_value),
+			my_epoch(other.my_epoch)
+		{
+			other.my_map = nullptr;
+			other.my_value = nullptr;
+		}
+
+		~const_iterator()
+		{
+			release();
+		}
+
+		/**
+		 * Stop iterating, which makes the iterator equal to end().
+		 */
+		void
+		release()
+		{
+			if (my_map)
+			{
+				my_map->leave_scan();
+				my_map->leave_epoch(my_epoch);
+				my_map = nullptr;
+			}
+			my_value = nullptr;
+		}
+
+		const_reference operator*() const
+		{
+			assert(my_value);
+
+			return *my_value;
+		}
+
+		const_pointer operator->() const
+		{
+			return &operator*();
+		}
+
+		const_iterator &
+		operator++()
+		{
+			advance();
+			return *this;
+		}
+
+		bool
+		operator==(const const_iterator &other) const
+		{
+			return my_value == other.my_value;
+		}
+
+		bool
+		operator!=(const const_iterator &other) const
+		{
+			return !(*this == other);
+		}
+
+	private:
+		/**
+		 * Move to the next occupied slot after my_slot - 1, bottom level
+		 * first, and release the iterator past the last one.
+		 */
+		void
+		advance()
+		{
+			for (; my_level < my_dir->n_levels; my_level++)
+			{
+				const level_info &l = my_dir->levels[my_level];
+				for (; my_bucket < l.capacity; my_bucket++)
+				{
+					bucket &b = l.buckets[my_bucket];
+					while (my_slot < assoc_num)
+					{
+						KV_entry_ptr_t tmp = b.slots[my_slot++].p;
+						my_value = tmp.get_address(my_map->my_pool_uuid,
+							my_map->pool_addr);
+						if (my_value != nullptr)
+							return;
+					}
+					my_slot = 0;
+				}
+				my_bucket = 0;
+			}
+
+			release();
+		}
+
+		const clevel_hash *my_map;
+		const level_dir *my_dir;
+		size_type my_level;
+		size_type my_bucket;
+		size_type my_slot;
+		const_pointer my_value;
+		uint64_t my_epoch;
+	};
+
 	static partial_t
 	get_partial(hv_type hv)
 	{
@@ -275,23 +862,114 @@ public:
 		return (partial_t)((uint64_t)hv >> shift_bits);
 	}
 
-	clevel_hash() : meta(make_persistent<level_meta>().raw().off),
-		thread_num(0)
+	/**
+	 * Match the tags of all slots in a bucket at once.
+	 *
+	 * Uses AVX-512 or AVX2 when available at compile time, otherwise
+	 * falls back to a scalar loop.
+	 *
+	 * @param[out] match bitmask of non-empty slots with the given tag.
+	 * @param[out] empty bitmask of empty slots.
+	 */
+	static void
+	match_bucket(const bucket &b, partial_t partial, uint32_t &match,
+		uint32_t &empty)
+	{
+		static_assert(sizeof(bucket) == 64,
+			"a bucket is expected to fit in a cache line");
+		constexpr uint64_t offset_mask = 0x0000FFFFFFFFFFFC;
+
+#if defined(__AVX512F__)
+		__m512i s = _mm512_loadu_si512(
+			reinterpret_cast<const void *>(b.slots));
+		__mmask8 m = _mm512_cmpeq_epi64_mask(
+			_mm512_srli_epi64(s, partial_ext_bits),
+			_mm512_set1_epi64(static_cast<long long>(partial)));
+		__mmask8 e = _mm512_testn_epi64_mask(s,
+			_mm512_set1_epi64(static_cast<long long>(offset_mask)));
+
+		empty = e;
+		match = m & ~empty;
+#elif defined(__AVX2__)
+		const __m256i *p = reinterpret_cast<const __m256i *>(b.slots);
+		__m256i tag = _mm256_set1_epi64x(static_cast<long long>(partial));
+		__m256i mask = _mm256_set1_epi64x(
+			static_cast<long long>(offset_mask));
+		__m256i zero = _mm256_setzero_si256();
+
+		// Four slots per half.
+		match = 0;
+		empty = 0;
+		for (int h = 0; h < 2; h++)
+		{
+			__m256i s = _mm256_loadu_si256(p + h);
+			__m256i m = _mm256_cmpeq_epi64(
+				_mm256_srli_epi64(s, partial_ext_bits), tag);
+			__m256i e = _mm256_cmpeq_epi64(
+				_mm256_and_si256(s, mask), zero);
+
+			match |= static_cast<uint32_t>(_mm256_movemask_pd(
+				_mm256_castsi256_pd(m))) << (4 * h);
+			empty |= static_cast<uint32_t>(_mm256_movemask_pd(
+				_mm256_castsi256_pd(e))) << (4 * h);
+		}
+		match &= ~empty;
+#else
+		match = 0;
+		empty = 0;
+		for (size_type j = 0; j < assoc_num; j++)
+		{
+			KV_entry_ptr_u tmp(b.slots[j].p.off);
+			if ((tmp.p.off & offset_mask) == 0)
+				empty |= 1U << j;
+			else if (tmp.x.partial == partial)
+				match |= 1U << j;
+		}
+#endif
+	}
+
+	/**
+	 * Get the index of the lowest set bit in a non-zero slot bitmask.
+	 */
+	static size_type
+	first_slot(uint32_t mask)
+	{
+		assert(mask != 0);
+		return static_cast<size_type>(__builtin_ctz(mask));
+	}
+
+	/**
+	 * Constructor.
+	 *
+	 * @param n_rehash_threads the number of background threads that
+	 * rehash the last level in parallel during resizing.
+	 * @param hash_power the initial table has levels of 2^hash_power
+	 * and 2^(hash_power - 1) buckets.
+	 */
+	clevel_hash(size_type n_rehash_threads = 1,
+		size_type hash_power = HashPower)
+		: meta(make_persistent<level_meta>().raw().off), thread_num(0)
 	{
 		std::cout << "clevel_hash constructor: HashPower = "
-			<< HashPower << std::endl;
+			<< hash_power << std::endl;
 
-		assert(HashPower > 0);
-		hashpower.get_rw() = HashPower;
+		assert(hash_power > 0);
+		hashpower.get_rw() = hash_power;
 
 		std::cout << "hashpower : " << hashpower << std::endl;
 
+		assert(n_rehash_threads > 0);
+		rehash_thread_num.get_rw() = n_rehash_threads;
+		rehash_workers =
+			make_persistent<rehash_worker[]>(rehash_thread_num);
+
 		// setup pool
 		PMEMoid oid = pmemobj_oid(this);
 		assert(!OID_IS_NULL(oid));
 		my_pool_uuid = oid.pool_uuid_lo;
+		pool_addr = get_pool_addr();
 
-		level_meta *m = static_cast<level_meta *>(meta(my_pool_uuid));
+		level_meta *m = static_cast<level_meta *>(meta(my_pool_uuid, pool_addr));
 
 		persistent_ptr<level_bucket> tmp = make_persistent<level_bucket>();
 		tmp->buckets = make_persistent<bucket[]>(pow(2, hashpower));
@@ -307,11 +985,27 @@ public:
 
 		m->is_resizing = false;
 
-		run_expand_thread.get_rw().store(true);
+		global_epoch.store(0);
+		stripes.reset(new epoch_stripe[epoch_stripes]());
+		level_directory.store(nullptr);
+		dir_version.store(0);
+		prepared_level.store(0);
+		expand_watermark.store(default_expand_watermark);
+		rehash_busy.store(0);
+		active_scans.store(0);
+		item_counts.reset(new item_stripe[item_stripes]());
+		slot_registry = std::make_shared<thread_slot_registry>();
+		slot_registry_id = slot_registry->id();
+#ifdef CLEVEL_STATS
+		stats_counts.reset(new stats_stripe[epoch_stripes]());
+#endif
+
 		expand_bucket = 0;
-		expand_thread = std::thread(&clevel_hash::resize, this);
+		expand_level = m->last_level.raw();
+		start_rehash_threads();
+		start_reclaim_thread();
 
-		KV_entry_ptr_t e = get_entry(meta(my_pool_uuid)->first_level, 0, 0);
+		KV_entry_ptr_t e = get_entry(meta(my_pool_uuid, pool_addr)->first_level, 0, 0);
 		if (e != nullptr)
 		{
 			// never fires.
@@ -319,82 +1013,371 @@ public:
 		}
 	}
 
-	static void
-	allocate_KV_copy_construct(pool_base &pop,
-		persistent_ptr<value_type> &KV_ptr,
+	template <typename... Args>
+	void
+	make_KV(pool_base &pop, size_type thread_id,
+		persistent_ptr<KV_entry> &KV_ptr, hv_type hv, std::true_type,
+		Args &&... args)
+	{
+		kv_allocator.allocate(pop, thread_id, KV_ptr, hv,
+			std::forward<Args>(args)...);
+	}
+
+	template <typename... Args>
+	void
+	make_KV(pool_base &pop, size_type thread_id,
+		persistent_ptr<KV_entry> &KV_ptr, hv_type, std::false_type,
+		Args &&... args)
+	{
+		kv_allocator.allocate(pop, thread_id, KV_ptr,
+			std::forward<Args>(args)...);
+	}
+
+	void
+	allocate_KV_copy_construct(pool_base &pop, size_type thread_id,
+		persistent_ptr<KV_entry> &KV_ptr, hv_type hv,
 		const void *param)
 	{
 		const value_type *v = static_cast<const value_type *>(param);
-		internal::make_persistent_object<value_type>(pop, KV_ptr, *v);
+		make_KV(pop, thread_id, KV_ptr, hv,
+			std::integral_constant<bool, memoized_hash>(), *v);
 	}
 
-	static void
-	allocate_KV_move_construct(pool_base &pop,
-		persistent_ptr<value_type> &KV_ptr,
+	void
+	allocate_KV_move_construct(pool_base &pop, size_type thread_id,
+		persistent_ptr<KV_entry> &KV_ptr, hv_type hv,
 		const void *param)
 	{
 		const value_type *v = static_cast<const value_type *>(param);
-		internal::make_persistent_object<value_type>(
-			pop, KV_ptr, std::move(*const_cast<value_type *>(v)));
+		make_KV(pop, thread_id, KV_ptr, hv,
+			std::integral_constant<bool, memoized_hash>(),
+			std::move(*const_cast<value_type *>(v)));
+	}
+
+	/**
+	 * Get the hash value of the key of an entry, which is read from the
+	 * entry if the hash is memoized.
+	 */
+	static hv_type
+	get_hash(const value_type *e, std::true_type)
+	{
+		return reinterpret_cast<const hashed_KV_entry *>(e)->hv;
+	}
+
+	static hv_type
+	get_hash(const value_type *e, std::false_type)
+	{
+		return hasher{}(e->first);
+	}
+
+	static hv_type
+	get_hash(const value_type *e)
+	{
+		return get_hash(e, std::integral_constant<bool, memoized_hash>());
 	}
 
 	ret
-	insert(const value_type &value, size_type thread_id, size_type id)
+	insert(const value_type &value)
 	{
 		return generic_insert(value.first, &value,
-			allocate_KV_copy_construct, thread_id, id);
+			&clevel_hash::allocate_KV_copy_construct);
 	}
 
 	ret
-	insert(value_type &&value, size_type thread_id, size_type id)
+	insert(value_type &&value)
 	{
 		return generic_insert(value.first, &value,
-			allocate_KV_move_construct, thread_id, id);
+			&clevel_hash::allocate_KV_move_construct);
 	}
 
 
 	ret
 	generic_insert(const key_type &key, const void *param,
-		void (*allocate_KV)(pool_base &, persistent_ptr<value_type> &,
-		const void *), size_type thread_id, size_type id);
+		void (clevel_hash::*allocate_KV)(pool_base &, size_type,
+		persistent_ptr<KV_entry> &, hv_type, const void *));
 
 	// mapped_type
 	ret
-	search(const key_type &key) const;
-
+	search(const key_type &key) const
+	{
+		epoch_guard guard(this);
+		const_pointer value;
+		return generic_search(key, value);
+	}
+
+	/**
+	 * Find item and hold it in the given accessor.
+	 * @return true if item is found, false otherwise.
+	 */
+	bool
+	find(const_accessor &result, const key_type &key) const;
+
+	ret
+	generic_search(const key_type &key, const_pointer &value) const;
+
+	/**
+	 * Search a batch of keys. Candidate buckets and then KV entries of
+	 * all keys are prefetched before the key comparisons to overlap
+	 * the cache misses across keys.
+	 *
+	 * @param[out] out the result of search() for each key.
+	 */
+	void
+	multi_search(const key_type *keys, size_type n, ret *out) const;
+
+
+	/**
+	 * Get an iterator to the first item (see const_iterator).
+	 */
+	const_iterator
+	begin() const
+	{
+		const_iterator it;
+		it.my_map = this;
+		it.my_epoch = enter_epoch();
+		enter_scan();
+		it.my_dir = get_level_dir();
+		it.advance();
+		return it;
+	}
+
+	const_iterator
+	end() const
+	{
+		return const_iterator();
+	}
+
+	/**
+	 * Call fn(const value_type &) on every item with nthreads threads,
+	 * each scanning a contiguous part of the buckets of every level.
+	 * The guarantees are those of const_iterator, and fn is called
+	 * concurrently.
+	 */
+	template <typename Fn>
+	void
+	parallel_scan(size_type nthreads, Fn fn) const;
+
+	ret
+	erase(const key_type &key);
+
+	ret
+	update(const value_type &value)
+	{
+		return update(value,
+			std::integral_constant<bool, in_place_update>());
+	}
+
+	ret
+	update(value_type &&value)
+	{
+		return update(std::move(value),
+			std::integral_constant<bool, in_place_update>());
+	}
 
 	ret
-	erase(const key_type &key, size_type thread_id);
+	update(const value_type &value, std::true_type)
+	{
+		return update_in_place(value.first, value.second);
+	}
 
 	ret
-	update(const value_type &value, size_type thread_id)
+	update(const value_type &value, std::false_type)
 	{
 		return generic_update(value.first, &value,
-			allocate_KV_copy_construct, thread_id);
+			&clevel_hash::allocate_KV_copy_construct);
 	}
 
 	ret
-	update(value_type &&value, size_type thread_id)
+	update(value_type &&value, std::false_type)
 	{
 		return generic_update(value.first, &value,
-			allocate_KV_move_construct, thread_id);
+			&clevel_hash::allocate_KV_move_construct);
+	}
+
+	/**
+	 * Update the mapped value of key inside its KV entry, without
+	 * allocating a new entry. Used by update() if in_place_update.
+	 */
+	ret
+	update_in_place(const key_type &key, const mapped_type &value);
+
+	/**
+	 * Replace the mapped value of a KV entry with desired if it equals
+	 * expected, which is set to the current value otherwise. The new
+	 * value is persisted.
+	 */
+	bool
+	cas_mapped(pool_base &pop, value_type *e, mapped_type &expected,
+		const mapped_type &desired)
+	{
+		static_assert(sizeof(mapped_type) == sizeof(mapped_word) &&
+			alignof(mapped_type) == sizeof(mapped_word),
+			"the mapped type does not fit a word");
+
+		mapped_word *w = reinterpret_cast<mapped_word *>(&e->second);
+		mapped_word old_w, new_w;
+		std::memcpy(&old_w, &expected, sizeof(mapped_word));
+		std::memcpy(&new_w, &desired, sizeof(mapped_word));
+
+		mapped_word cur = __sync_val_compare_and_swap(w, old_w, new_w);
+		if (cur != old_w)
+		{
+			std::memcpy(&expected, &cur, sizeof(mapped_word));
+			return false;
+		}
+
+		persist(pop, w, sizeof(mapped_word));
+		return true;
+	}
+
+	/**
+	 * Insert value, or assign its mapped value to the item of its key.
+	 * @returns ret with found set if the key was present.
+	 */
+	ret
+	insert_or_assign(const value_type &value)
+	{
+		return compute(value.first,
+			[&](const mapped_type *) { return value.second; });
+	}
+
+	/**
+	 * Set the mapped value of key to fn(old), where old points to the
+	 * current mapped value, or is nullptr if the key is absent, in which
+	 * case the item is inserted. Under contention fn may be called more
+	 * than once, and the result of its last call is stored.
+	 * @returns ret with found set if the key was present.
+	 */
+	template <typename Fn>
+	ret
+	compute(const key_type &key, Fn fn);
+
+	/**
+	 * Add delta to the mapped value of key, which is inserted with delta
+	 * if absent.
+	 * @returns the previous mapped value, or T() if the key was absent.
+	 */
+	mapped_type
+	fetch_add(const key_type &key, const mapped_type &delta)
+	{
+		static_assert(std::is_arithmetic<mapped_type>::value,
+			"fetch_add() needs an arithmetic mapped type");
+
+		mapped_type prev = mapped_type();
+		compute(key, [&](const mapped_type *old) {
+			prev = old ? *old : mapped_type();
+			return static_cast<mapped_type>(prev + delta);
+		});
+		return prev;
+	}
+
+	/**
+	 * Apply fn of compute() to the mapped value of e in place.
+	 * @returns false if the mapped type can not be updated in place.
+	 */
+	template <typename Fn>
+	bool
+	compute_in_place(pool_base &pop, value_type *e, Fn &fn, std::true_type)
+	{
+		mapped_type expected = e->second;
+		mapped_type desired = fn(&expected);
+		while (!cas_mapped(pop, e, expected, desired))
+		{
+			add_stat(STAT_UPDATE_CAS_FAILURES);
+			desired = fn(&expected);
+		}
+
+		return true;
+	}
+
+	template <typename Fn>
+	bool
+	compute_in_place(pool_base &, value_type *, Fn &, std::false_type)
+	{
+		return false;
 	}
 
 	ret
 	generic_update(const key_type &key, const void *param,
-		void (*allocate_KV)(pool_base &, persistent_ptr<value_type> &,
-		const void *), size_type thread_id);
+		void (clevel_hash::*allocate_KV)(pool_base &, size_type,
+		persistent_ptr<KV_entry> &, hv_type, const void *));
 
 	void
 	clear();
 
 	~clevel_hash()
 	{
-		run_expand_thread.get_rw().store(false);
-		expand_thread.join();
+		stop_rehash_threads();
 		clear();
 	}
 
+	/**
+	 * Initialize the volatile state of clevel_hash after the pool is
+	 * reopened. Scratch buffers leaked by a crash are reclaimed and an
+	 * interrupted rehashing is resumed from the persistent progress.
+	 * Should be called every time after process restart, before any
+	 * other operation. Not thread safe.
+	 */
+	void
+	runtime_initialize();
+
+	/**
+	 * Stop the background rehashing threads. Should be called before
+	 * closing the pool. Not thread safe.
+	 */
+	void
+	stop_rehash_threads()
+	{
+		stop_reclaim_thread();
+
+		run_expand_thread.get_rw().store(false);
+		if (expand_thread.joinable())
+			expand_thread.join();
+		for (auto &t : rehash_threads)
+			t.join();
+		rehash_threads.clear();
+	}
+
+	/**
+	 * Grow the table to hold n items at the given load factor, by
+	 * appending a pair of levels large enough at once. The levels below
+	 * are rehashed into them in the background, so a bulk load of n
+	 * items that starts with reserve() rehashes almost nothing. The
+	 * table does not shrink below the reserved capacity.
+	 */
+	void
+	reserve(size_type n, double load_factor = default_reserve_load_factor);
+
+	/**
+	 * Insert the items in [first, last) with nthreads threads, without
+	 * the CAS and duplicate check of insert().
+	 *
+	 * A pair of levels sized like reserve() is filled aside: items are
+	 * partitioned by candidate bucket, so that each thread writes its
+	 * own buckets without contention. The pair is then linked above the
+	 * first level at once. A crash before that discards the partial load
+	 * at recovery, with its entries, since each thread persists a slot
+	 * before it allocates the next entry.
+	 *
+	 * The keys must be unique and not in the table. Not thread safe
+	 * with respect to other inserts, updates and erases.
+	 * @returns the number of items inserted.
+	 */
+	template <typename RandomIt>
+	size_type
+	bulk_load(RandomIt first, RandomIt last, size_type nthreads);
+
+	/**
+	 * Set the load factor at which the expand thread allocates the next
+	 * level in the background, so that an expansion only links it in.
+	 * 0 disables the preparation. Reset to 0.75 by runtime_initialize().
+	 */
+	void
+	set_expand_watermark(double watermark)
+	{
+		expand_watermark.store(watermark);
+	}
+
 	// for debug
 	void foo()
 	{
@@ -409,26 +1392,88 @@ public:
 	uint64_t
 	capacity() const
 	{
+		// Levels drained by resizing are freed after two epochs.
+		epoch_guard guard(this);
 		return capacity(meta);
 	}
 
+	/**
+	 * Get the number of items counted for the resize policy, which is
+	 * approximate under concurrent updates and estimated by sampling
+	 * after a restart. Always 0 if the policy does not count items.
+	 */
+	size_type
+	item_count() const
+	{
+		difference_type sum = 0;
+		for (size_type i = 0; i < item_stripes; i++)
+			sum += item_counts[i].cnt.load(std::memory_order_relaxed);
+
+		return sum > 0 ? static_cast<size_type>(sum) : 0;
+	}
+
+#ifdef CLEVEL_STATS
+	/**
+	 * Sum up the stat counters of all threads. Writers are not stopped,
+	 * so the counters are read one by one while they still change.
+	 */
+	stats_snapshot
+	stats() const
+	{
+		stats_snapshot result;
+		for (size_type c = 0; c < STAT_NUM; c++)
+		{
+			result.cnt[c] = 0;
+			for (size_type i = 0; i < epoch_stripes; i++)
+				result.cnt[c] += stats_counts[i].cnt[c].load(
+					std::memory_order_relaxed);
+		}
+		result.time = std::chrono::steady_clock::now();
+
+		return result;
+	}
+
+	static const char *
+	stat_name(stat_counter_t c)
+	{
+		static const char *names[STAT_NUM] = {
+			"insert_cas_failures", "update_cas_failures",
+			"erase_cas_failures", "rehash_cas_failures",
+			"insert_retries", "find_retries", "context_retries",
+			"del_dups", "persists", "expansions", "rehashed_items",
+			"rehash_ns", "lookups", "levels_probed"};
+
+		return names[c];
+	}
+
+	/**
+	 * Get the number of persists issued by the map, excluding those of
+	 * the allocators.
+	 */
+	uint64_t
+	persist_count() const
+	{
+		return stats()[STAT_PERSISTS];
+	}
+#endif
+
 	/**
 	 * Get the total capacity (#buckets * assoc_num) of given context.
 	 */
 	uint64_t
 	capacity(level_meta_ptr_t m_copy) const
 	{
-		level_meta *m = static_cast<level_meta *>(m_copy(my_pool_uuid));
+		level_meta *m = static_cast<level_meta *>(m_copy(my_pool_uuid, pool_addr));
 
 		uint64_t total_slots = 0;
 		level_ptr_t li;
 		for (li = m->last_level; li != m->first_level;)
 		{
-			level_bucket *cl = li.get_address(my_pool_uuid);
+			level_bucket *cl = li.get_address(my_pool_uuid, pool_addr);
 			total_slots += cl->capacity * assoc_num;
 			li = cl->up;
 		}
-		total_slots += li.get_address(my_pool_uuid)->capacity * assoc_num;
+		total_slots += li.get_address(my_pool_uuid, pool_addr)->capacity * assoc_num;
 
 		return total_slots;
 	}
@@ -446,51 +1491,34 @@ public:
 		return pool_base(pop);
 	}
 
+	/**
+	 * Get the base address of the pool in this run.
+	 * @returns nullptr if CLEVEL_DIRECT_ADDR is defined, which makes
+	 * offsets resolved by pmemobj_direct().
+	 */
+	char *
+	get_pool_addr()
+	{
+#ifdef CLEVEL_DIRECT_ADDR
+		return nullptr;
+#else
+		return reinterpret_cast<char *>(this) - pmemobj_oid(this).off;
+#endif
+	}
+
+	/**
+	 * Allocate thread slots for num threads up front. Threads lease
+	 * slots on their first insert, update or erase, and the slot table
+	 * grows as needed, so this is optional.
+	 */
 	void
 	set_thread_num(size_type num)
 	{
-		if (thread_num > 0)
-		{
-			// Reclaim the memory in persistent buffers allocated in previous
-			// round of set_thread_num.
-			for (size_type i = 0; i < thread_num; i++)
-			{
-				difference_type di = static_cast<difference_type>(i);
-				if (tmp_level[di] != nullptr)
-					delete_persistent<level_meta>(tmp_meta[di]);
-				if (tmp_level[di] != nullptr)
-					delete_persistent<level_bucket>(tmp_level[di]);
-				if (tmp_entry[di] != nullptr)
-					delete_persistent<value_type>(tmp_entry[di]);
-			}
-			delete_persistent<persistent_ptr<level_meta>[]>(
-				tmp_meta, thread_num);
-			delete_persistent<persistent_ptr<level_bucket>[]>(
-				tmp_level, thread_num);
-			delete_persistent<persistent_ptr<value_type>[]>(
-				tmp_entry, thread_num);
-		}
-
-		thread_num = num;
-
-#ifdef CLEVEL_DEBUG
-		thread_logs.resize(thread_num);
-		for (uint64_t i = 0; i < thread_num; i++)
-		{
-			if (!thread_logs[i].is_open())
-			{
-				std::stringstream ss;
-				ss << "thread-" << i << ".log";
-				thread_logs[i].open(ss.str(), std::fstream::out);
-			}
-		}
-#endif
+		assert(num <= slot_layout::max_slots);
 
-		// Setup persistent buffers according to the thread_num.
-		tmp_meta = make_persistent<persistent_ptr<level_meta>[]>(thread_num);
-		tmp_level =
-			make_persistent<persistent_ptr<level_bucket>[]>(thread_num);
-		tmp_entry = make_persistent<persistent_ptr<value_type>[]>(thread_num);
+		size_type capacity;
+		while ((capacity = slot_registry->capacity()) < num)
+			grow_thread_slots(capacity);
 	}
 
 	// Only for debug use!
@@ -501,1107 +1529,3521 @@ public:
 	key_type
 	get_key(KV_entry_ptr_t &e);
 
-	void
-	del_dup(pool_base &pop, KV_entry_ptr_u *p1, KV_entry_ptr_u *p2,
-		KV_entry_ptr_t e1, KV_entry_ptr_t e2);
+	bool
+	del_dup(pool_base &pop, size_type thread_id, KV_entry_ptr_u *p1,
+		KV_entry_ptr_u *p2, KV_entry_ptr_t e1, KV_entry_ptr_t e2);
 
 	f_code_t
-	find(pool_base &pop, const key_type &key, partial_t partial,
+	find(pool_base &pop, const key_type &key, hv_type hv, partial_t partial,
 		size_type &n_levels, KV_entry_ptr_t &old_e, KV_entry_ptr_t **e,
 		uint64_t &level_num, difference_type &idx, bool fix_dup,
 		size_type thread_id, level_meta_ptr_t &m_copy);
 
 	f_code_t
-	find_empty_slot(pool_base &pop, const key_type &key, partial_t partial,
+	find_empty_slot(pool_base &pop, hv_type hv, partial_t partial,
 		size_type &n_levels, KV_entry_ptr_t **e,
 		uint64_t &level_num, level_meta_ptr_t &m_copy);
 
+	bool
+	expand(pool_base &pop, size_type thread_id, level_meta_ptr_t m_copy,
+		size_type new_capacity = 0);
+
+	bool
+	expand(pool_base &pop, size_type thread_id,
+		persistent_ptr<level_bucket> &t_level,
+		persistent_ptr<level_meta> &t_meta, level_meta_ptr_t m_copy,
+		size_type new_capacity = 0);
+
+	bool
+	promote_level(pool_base &pop, level_bucket *cl,
+		persistent_ptr<level_meta> &t_meta, level_meta_ptr_t m_copy);
+
 	void
-	expand(pool_base &pop, size_type thread_id, level_meta_ptr_t m_copy);
+	make_level(pool_base &pop, persistent_ptr<level_bucket> &level,
+		size_type capacity);
+
+	size_type
+	reserve_power(size_type n, double load_factor) const;
 
 	void
-	resize();
+	free_bulk_level(persistent_ptr<level_bucket> &level);
 
-	level_meta_ptr_t meta;
+	bool
+	link_prepared_level(pool_base &pop, level_bucket *cl,
+		size_type new_capacity);
 
-	p<size_type> hashpower;
-	p<size_type> thread_num;
-	p<difference_type> expand_bucket;
-	p<std::atomic<bool>> run_expand_thread;
-	persistent_ptr<persistent_ptr<level_meta>[]> tmp_meta;
-	persistent_ptr<persistent_ptr<level_bucket>[]> tmp_level;
-	persistent_ptr<persistent_ptr<value_type>[]> tmp_entry;
+	void
+	prepare_level(pool_base &pop, level_meta *m);
 
-	std::thread expand_thread;
+	void
+	free_next_level();
 
-	/** ID of persistent memory pool where hash map resides. */
-	p<uint64_t> my_pool_uuid;
+	double
+	estimate_load_factor() const;
 
-#ifdef CLEVEL_DEBUG
-	std::vector<std::fstream> thread_logs;
-#endif
-};
+	void
+	resize();
 
-template <typename Key, typename T, typename Hash, typename KeyEqual,
-	size_t HashPower>
-typename clevel_hash<Key, T, Hash, KeyEqual, HashPower>::ret
-clevel_hash<Key, T, Hash, KeyEqual, HashPower>::search(
-	const key_type &key) const
-{
-	hv_type hv = hasher{}(key);
-	partial_t partial = get_partial(hv);
+	void
+	retire_level(persistent_ptr<level_bucket> &level);
 
-	while(true)
-	{
-		level_meta_ptr_t m_copy(meta);
-		level_meta *m = static_cast<level_meta *>(m_copy(my_pool_uuid));
+	void
+	start_rehash_threads();
 
-		// Bottom-to-top search.
-		difference_type f_idx, s_idx;
-		size_type i = 0;
-		level_ptr_t li = nullptr, next_li = m->last_level;
-		do
-		{
-			li = next_li;
-			level_bucket *cl = li.get_address(my_pool_uuid);
-			f_idx = first_index(hv, cl->capacity);
-			s_idx = second_index(partial, f_idx, cl->capacity);
+	void
+	recover_rehash(pool_base &pop);
 
-			bucket &f_b = cl->buckets[f_idx];
-			for (size_type j = 0; j < assoc_num; j++)
-			{
-				if (f_b.slots[j].x.partial == partial
-					&& f_b.slots[j].p.get_offset() != 0)
-				{
-					if (key_equal{}(
-						f_b.slots[j].p.get_address(my_pool_uuid)->first, key))
-					{
-						return ret(i, f_idx, j);
-					}
-				}
-			}
+	void
+	reclaim_tmp_buffers();
 
-			bucket &s_b = cl->buckets[s_idx];
-			for (size_type j = 0; j < assoc_num; j++)
-			{
-				if (s_b.slots[j].x.partial == partial
-					&& s_b.slots[j].p.get_offset() != 0)
-				{
-					if (key_equal{}(
-						s_b.slots[j].p.get_address(my_pool_uuid)->first, key))
-					{
-						return ret(i, s_idx, j);
-					}
-				}
-			}
+	bool
+	is_reachable(const persistent_ptr<KV_entry> &kv);
 
-			next_li = cl->up;
-			i++;
-		}while(li != m->first_level);
+	bool
+	is_reachable(const persistent_ptr<level_bucket> &level);
 
-		// Context checking.
-		if (m_copy == meta)
-			return ret();
-	} // end while(true)
-}
+	uint64_t
+	enter_epoch() const;
 
-template <typename Key, typename T, typename Hash, typename KeyEqual,
-	size_t HashPower>
-void
-clevel_hash<Key, T, Hash, KeyEqual, HashPower>::del_dup(
-	pool_base &pop, KV_entry_ptr_u *p1, KV_entry_ptr_u *p2,
-	KV_entry_ptr_t e1, KV_entry_ptr_t e2)
-{
-	KV_entry_ptr_u tmp1_u, tmp2_u;
-	tmp1_u.p = e1;
-	tmp2_u.p = e2;
+	void
+	leave_epoch(uint64_t epoch) const;
 
-	if (e1 != p1->p || e2 != p2->p)
-		return;
+	bool
+	has_active(uint64_t epoch) const;
 
-	if (tmp1_u.x.partial == tmp2_u.x.partial)
-	{
-		// 1. Refer to the same location
-		if (e1.get_offset() == e2.get_offset())
-		{
-			if (CAS(&(p2->p.off), e2.raw(), 0))
-			{
-				pop.persist(&(p2->p.off), sizeof(uint64_t));
-			}
-		}
+	void
+	try_advance_epoch();
 
-		// 2. Refer to different locations with the same contents
-		else if (key_equal{}(e1.get_address(my_pool_uuid)->first,
-			e2.get_address(my_pool_uuid)->first))
-		{
-			if (CAS(&(p2->p.off), e2.raw(), 0))
-			{
-				pop.persist(&(p2->p.off), sizeof(uint64_t));
+	bool
+	log_retire(pool_base &pop, size_type thread_id, KV_entry_ptr_t e);
 
-				PMEMoid oid = e2.raw_ptr(my_pool_uuid);
-				pmemobj_free(&oid);
-			}
-		}
-	}
-}
+	void
+	commit_retire(size_type thread_id);
 
-template <typename Key, typename T, typename Hash, typename KeyEqual,
-	size_t HashPower>
-typename clevel_hash<Key, T, Hash, KeyEqual, HashPower>::f_code_t
-clevel_hash<Key, T, Hash, KeyEqual, HashPower>::find_empty_slot(
-	pool_base &pop, const key_type &key, partial_t partial,
-	size_type &n_levels, KV_entry_ptr_t **e,
-	uint64_t &level_num, level_meta_ptr_t &m_copy)
-{
-	hv_type hv = hasher{}(key);
-	while (true)
+	void
+	cancel_retire(pool_base &pop, size_type thread_id);
+
+	void
+	wait_for_limbo(size_type thread_id);
+
+	/**
+	 * Forget the scratch entry of a thread once it is linked into the
+	 * table, so that tmp_entry only names unpublished entries and
+	 * reclaim_tmp_buffers() never sees one the reclaimer has freed. The
+	 * caller is still in its epoch, so the entry cannot be freed before.
+	 */
+	void
+	release_tmp_entry(pool_base &pop, persistent_ptr<KV_entry> &tmp_entry)
 	{
-		level_meta *m = static_cast<level_meta *>(m_copy(my_pool_uuid));
-		*e = nullptr;
+		tmp_entry = nullptr;
+		persist(pop, tmp_entry);
+	}
 
-		level_ptr_t levels[MAX_LEVEL];
-		difference_type f_idx, s_idx;
-		uint64_t slot_idx;
+	void
+	reclaim();
 
-		f_code_t result;
+	void
+	free_retired(uint64_t epoch);
 
-		n_levels = 0;
-		level_ptr_t li = nullptr, next_li = m->last_level;
-		do
-		{
-			li = next_li;
-			levels[n_levels] = li;
-			n_levels++;
-			next_li = li.get_address(my_pool_uuid)->up;
-		} while(li != m->first_level);
+	void
+	recover_limbos();
 
-		level_bucket *cl;
-		result = ABSENT_AND_NO_VACANCY;
+	void
+	recover_KV_allocator();
 
-		for (size_type i = n_levels - 1; i < n_levels; i--)
-		{
-			cl = levels[i].get_address(my_pool_uuid);
-			f_idx = first_index(hv, cl->capacity);
-			s_idx = second_index(partial, f_idx, cl->capacity);
+	const level_dir *
+	get_level_dir() const;
 
-			// flag used to skip vacant slots after finding an empty
-			// slot in a bucket.
-			bool found_empty_in_b = false;
-			bucket &f_b = cl->buckets[f_idx];
-			for (size_type j = 0; j < assoc_num; j++)
-			{
-				if (!found_empty_in_b && f_b.slots[j].p.get_offset() == 0)
+	const level_dir *
+	get_level_dir(pool_base &pop, level_meta_ptr_t &m_copy);
+
+	const level_dir *
+	build_level_dir() const;
+
+	/**
+	 * Get the number of levels in the metadata.
+	 */
+	size_type
+	level_count() const
+	{
+		epoch_guard guard(this);
+		return get_level_dir()->n_levels;
+	}
+
+	/**
+	 * Invalidate the level directory before changing meta.
+	 */
+	void
+	bump_dir_version()
+	{
+		dir_version.fetch_add(1);
+	}
+
+	/**
+	 * Check whether meta is still m_copy, ignoring the dirty mark.
+	 */
+	bool
+	same_meta(const level_meta_ptr_t &m_copy) const
+	{
+		return (meta.raw() & ~meta_dirty) == m_copy.raw();
+	}
+
+	level_meta_ptr_t
+	load_meta(pool_base &pop);
+
+	void
+	persist_meta(pool_base &pop, uint64_t m);
+
+	bool
+	install_meta(pool_base &pop, const level_meta_ptr_t &m_copy,
+		uint64_t new_meta);
+
+	/**
+	 * Add n to a stat counter of the calling thread, which does nothing
+	 * unless CLEVEL_STATS is defined.
+	 */
+	void
+	add_stat(stat_counter_t c, uint64_t n = 1) const
+	{
+#ifdef CLEVEL_STATS
+		stats_counts[epoch_stripe_id()].cnt[c].fetch_add(n,
+			std::memory_order_relaxed);
+#else
+		(void)c;
+		(void)n;
+#endif
+	}
+
+	template <typename... Args>
+	void
+	persist(pool_base &pop, Args &&... args)
+	{
+		add_stat(STAT_PERSISTS);
+		pop.persist(std::forward<Args>(args)...);
+	}
+
+	/**
+	 * Add delta to the item count of the thread.
+	 */
+	void
+	add_items(size_type thread_id, difference_type delta)
+	{
+		if (!ResizePolicy::count_items)
+			return;
+
+		item_counts[thread_id % item_stripes].cnt.fetch_add(delta,
+			std::memory_order_relaxed);
+	}
+
+	/**
+	 * Get the thread slot leased by the calling thread, which leases one
+	 * on its first call.
+	 */
+	size_type
+	this_thread_slot()
+	{
+		size_type slot;
+		if (thread_slot_registry::cached_slot(slot_registry_id, slot))
+			return slot;
+
+		return thread_slot_registry::this_thread_slot(slot_registry,
+			[this](size_type capacity) {
+				grow_thread_slots(capacity);
+			});
+	}
+
+	thread_slot &
+	get_thread_slot(size_type thread_id)
+	{
+		size_type index;
+		size_type k = slot_layout::segment(thread_id, index);
+		return thread_slots[k][static_cast<difference_type>(index)];
+	}
+
+	void
+	grow_thread_slots(size_type capacity);
+
+#ifdef CLEVEL_DEBUG
+	/**
+	 * Open the logs of the thread slots up to num.
+	 */
+	void
+	open_thread_logs(size_type num)
+	{
+		size_type i = thread_logs.size();
+		thread_logs.grow(num);
+		for (; i < num; i++)
+		{
+			std::stringstream ss;
+			ss << "thread-" << i << ".log";
+			thread_logs[i].open(ss.str(), std::fstream::out);
+		}
+	}
+#endif
+
+	void
+	reset_item_counts(size_type items);
+
+	size_type
+	new_level_capacity(size_type capacity) const
+	{
+		return resize_policy.expand_capacity(capacity, item_count(),
+			assoc_num);
+	}
+
+	void
+	start_reclaim_thread()
+	{
+		run_reclaim_thread.store(true);
+		reclaim_thread = std::thread(&clevel_hash::reclaim, this);
+	}
+
+	void
+	stop_reclaim_thread()
+	{
+		run_reclaim_thread.store(false);
+		if (reclaim_thread.joinable())
+			reclaim_thread.join();
+	}
+
+	/**
+	 * Get the index of the epoch stripe for the calling thread.
+	 */
+	static size_type
+	epoch_stripe_id()
+	{
+		static std::atomic<size_type> next_stripe(0);
+		static thread_local size_type stripe =
+			next_stripe.fetch_add(1) % epoch_stripes;
+
+		return stripe;
+	}
+
+	/**
+	 * Start a scan, which waits for the rehashing workers to leave the
+	 * ranges they are in. Workers do not claim new ranges until the
+	 * scan ends, so items do not move meanwhile; expansions still
+	 * append levels, which only hold items inserted after the scan
+	 * started.
+	 */
+	void
+	enter_scan() const
+	{
+		active_scans.fetch_add(1);
+		while (rehash_busy.load() != 0)
+			std::this_thread::yield();
+	}
+
+	void
+	leave_scan() const
+	{
+		active_scans.fetch_sub(1);
+	}
+
+	/**
+	 * Call fn on the items in buckets [begin, end) of a level,
+	 * prefetching the KV entries of scan_batch buckets at a time.
+	 */
+	template <typename Fn>
+	void
+	scan_buckets(const level_info &l, size_type begin, size_type end,
+		Fn &fn) const
+	{
+		const_pointer values[scan_batch * assoc_num];
+		for (size_type base = begin; base < end; base += scan_batch)
+		{
+			// Not std::min, which would odr-use scan_batch.
+			size_type last = end - base < scan_batch ? end : base + scan_batch;
+
+			size_type n = 0;
+			for (size_type idx = base; idx < last; idx++)
+			{
+				if (idx + scan_batch < end)
+					__builtin_prefetch(&l.buckets[idx + scan_batch]);
+
+				bucket &b = l.buckets[idx];
+				for (size_type j = 0; j < assoc_num; j++)
+				{
+					KV_entry_ptr_t tmp = b.slots[j].p;
+					const_pointer v = tmp.get_address(my_pool_uuid, pool_addr);
+					if (v != nullptr)
+					{
+						__builtin_prefetch(v);
+						values[n++] = v;
+					}
+				}
+			}
+
+			for (size_type k = 0; k < n; k++)
+				fn(*values[k]);
+		}
+	}
+
+	void
+	rehash(size_type worker_id);
+
+	void
+	rehash_level(pool_base &pop, size_type worker_id);
+
+	void
+	rehash_bucket(pool_base &pop, size_type worker_id,
+		size_type thread_id, level_bucket *bl, difference_type idx);
+
+	bool
+	try_rehash_bucket(pool_base &pop, size_type worker_id,
+		size_type thread_id, level_bucket *bl, difference_type idx);
+
+	bool
+	keep_rehash_copy(pool_base &pop, size_type thread_id,
+		KV_entry_ptr_t &src, KV_entry_ptr_t &dst, KV_entry_ptr_t src_tmp);
+
+	void
+	wait_for_rehashed(difference_type idx);
+
+	level_meta_ptr_t meta;
+
+	p<size_type> hashpower;
+	p<size_type> thread_num;
+	p<size_type> rehash_thread_num;
+	p<difference_type> expand_bucket;
+	// Offset of the last level that expand_bucket and the progress
+	// records of rehash_workers refer to.
+	p<uint64_t> expand_level;
+	p<std::atomic<bool>> run_expand_thread;
+	// Segments of the thread slot table, whose first thread_num slots
+	// are allocated.
+	persistent_ptr<thread_slot[]> thread_slots[thread_slot_segments];
+	persistent_ptr<rehash_worker[]> rehash_workers;
+	// Level allocated ahead of the next expansion by the expand thread.
+	persistent_ptr<level_bucket> next_level;
+	// Levels filled by bulk_load() until they are linked.
+	persistent_ptr<level_bucket> bulk_bottom;
+	persistent_ptr<level_bucket> bulk_top;
+
+	/** Allocator of KV entries. */
+	typename KVAllocator::template rebind<KV_entry>::other kv_allocator;
+
+	ResizePolicy resize_policy;
+
+	std::thread expand_thread;
+	std::vector<std::thread> rehash_threads;
+
+	// Offset of next_level once it is ready for an expansion,
+	// level_claimed while an expansion links or frees it, and 0 otherwise.
+	std::atomic<uint64_t> prepared_level;
+	std::atomic<double> expand_watermark;
+
+	// Incremented by expand_thread whenever a last level is ready for
+	// rehashing. rehash_active counts the workers still in the round.
+	std::atomic<uint64_t> rehash_round;
+	std::atomic<size_type> rehash_active;
+
+	// Rehashing workers in a range of the last level, and live scans,
+	// which exclude each other (see enter_scan()).
+	std::atomic<size_type> rehash_busy;
+	mutable std::atomic<size_type> active_scans;
+
+	// Threads in an operation or holding an accessor count themselves in
+	// stripes[].cnt[global_epoch & 1]. The reclaimer advances
+	// global_epoch once the counters of the previous epoch drain.
+	mutable std::atomic<uint64_t> global_epoch;
+	std::unique_ptr<epoch_stripe[]> stripes;
+
+	// Item counts of threads, spread over item_stripes stripes.
+	std::unique_ptr<item_stripe[]> item_counts;
+
+	// Leases of the thread slots in this run, whose id is cached for
+	// the lookup of the slot of the calling thread. slot_mutex
+	// serializes the growth of the slot table.
+	std::shared_ptr<thread_slot_registry> slot_registry;
+	uint64_t slot_registry_id;
+	std::mutex slot_mutex;
+
+	std::thread reclaim_thread;
+	std::atomic<bool> run_reclaim_thread;
+
+	// The current level directory, and the replaced directories that
+	// operations may still use.
+	mutable std::atomic<const level_dir *> level_directory;
+	std::atomic<uint64_t> dir_version;
+	mutable std::mutex dir_mutex;
+	mutable std::vector<std::unique_ptr<level_dir>> level_dirs;
+
+	/** ID of persistent memory pool where hash map resides. */
+	p<uint64_t> my_pool_uuid;
+
+	/**
+	 * Base address of the pool in this run, used to translate offsets
+	 * without pmemobj_direct(). Set by constructor and
+	 * runtime_initialize().
+	 */
+	char *pool_addr;
+
+#ifdef CLEVEL_DEBUG
+	segmented_array<std::fstream, thread_slot_base, thread_slot_segments>
+		thread_logs;
+#endif
+
+#ifdef CLEVEL_STATS
+	// Stat counters of threads, spread over epoch_stripes stripes.
+	std::unique_ptr<stats_stripe[]> stats_counts;
+#endif
+};
+
+/**
+ * Get the level directory of the current meta, building it if needed.
+ */
+template <typename Key, typename T, typename Hash, typename KeyEqual,
+	size_t HashPower, typename KVAllocator, typename ResizePolicy>
+const typename clevel_hash<Key, T, Hash, KeyEqual, HashPower, KVAllocator, ResizePolicy>::level_dir *
+clevel_hash<Key, T, Hash, KeyEqual, HashPower, KVAllocator, ResizePolicy>::get_level_dir() const
+{
+	// meta is read before dir_version, which is bumped before meta
+	// changes.
+	uint64_t m = meta.raw() & ~meta_dirty;
+	std::atomic_thread_fence(std::memory_order_acquire);
+	uint64_t version = dir_version.load();
+
+	const level_dir *d = level_directory.load();
+	if (likely(d != nullptr && d->meta == m && d->version == version))
+		return d;
+
+	return build_level_dir();
+}
+
+/**
+ * Get the level directory for an operation that has read m_copy. If meta
+ * has changed since, m_copy is updated to the meta of the directory,
+ * which is persisted first if it is marked dirty.
+ */
+template <typename Key, typename T, typename Hash, typename KeyEqual,
+	size_t HashPower, typename KVAllocator, typename ResizePolicy>
+const typename clevel_hash<Key, T, Hash, KeyEqual, HashPower, KVAllocator, ResizePolicy>::level_dir *
+clevel_hash<Key, T, Hash, KeyEqual, HashPower, KVAllocator, ResizePolicy>::get_level_dir(
+	pool_base &pop, level_meta_ptr_t &m_copy)
+{
+	uint64_t m = meta.raw();
+	const level_dir *d = get_level_dir();
+	if (d->meta != m_copy.raw())
+	{
+		m_copy = level_meta_ptr_t(d->meta);
+		persist_meta(pop, m);
+	}
+
+	return d;
+}
+
+/**
+ * Read meta for an operation that modifies the table.
+ *
+ * A writer installs a new meta marked dirty and clears the mark once it
+ * has persisted it, so readers persist meta only if they see the mark,
+ * instead of on every read. The returned meta is durable.
+ */
+template <typename Key, typename T, typename Hash, typename KeyEqual,
+	size_t HashPower, typename KVAllocator, typename ResizePolicy>
+typename clevel_hash<Key, T, Hash, KeyEqual, HashPower, KVAllocator, ResizePolicy>::level_meta_ptr_t
+clevel_hash<Key, T, Hash, KeyEqual, HashPower, KVAllocator, ResizePolicy>::load_meta(
+	pool_base &pop)
+{
+	uint64_t m = meta.raw();
+	persist_meta(pop, m);
+
+	return level_meta_ptr_t(m & ~meta_dirty);
+}
+
+/**
+ * Persist meta if m, the value read from it, is marked dirty, and help
+ * the writer clear the mark.
+ */
+template <typename Key, typename T, typename Hash, typename KeyEqual,
+	size_t HashPower, typename KVAllocator, typename ResizePolicy>
+void
+clevel_hash<Key, T, Hash, KeyEqual, HashPower, KVAllocator, ResizePolicy>::persist_meta(
+	pool_base &pop, uint64_t m)
+{
+	if (meta_dirty == 0)
+	{
+		persist(pop, &(meta.off), sizeof(uint64_t));
+	}
+	else if (unlikely(m & meta_dirty))
+	{
+		persist(pop, &(meta.off), sizeof(uint64_t));
+		CAS(&(meta.off), m, m & ~meta_dirty);
+	}
+}
+
+/**
+ * Replace meta with new_meta if it is still m_copy, and persist it.
+ * @returns false if meta has changed.
+ */
+template <typename Key, typename T, typename Hash, typename KeyEqual,
+	size_t HashPower, typename KVAllocator, typename ResizePolicy>
+bool
+clevel_hash<Key, T, Hash, KeyEqual, HashPower, KVAllocator, ResizePolicy>::install_meta(
+	pool_base &pop, const level_meta_ptr_t &m_copy, uint64_t new_meta)
+{
+	assert((new_meta & meta_dirty) == 0);
+
+	bump_dir_version();
+
+	// m_copy is durable, so its mark may be overwritten without a
+	// persist.
+	uint64_t expected = m_copy.raw();
+	while (!CAS(&(meta.off), expected, new_meta | meta_dirty))
+	{
+		if (meta_dirty == 0 || meta.raw() != (m_copy.raw() | meta_dirty))
+			return false;
+		expected = m_copy.raw() | meta_dirty;
+	}
+
+	persist(pop, &(meta.off), sizeof(uint64_t));
+	if (meta_dirty != 0)
+		CAS(&(meta.off), new_meta | meta_dirty, new_meta);
+
+	return true;
+}
+
+template <typename Key, typename T, typename Hash, typename KeyEqual,
+	size_t HashPower, typename KVAllocator, typename ResizePolicy>
+const typename clevel_hash<Key, T, Hash, KeyEqual, HashPower, KVAllocator, ResizePolicy>::level_dir *
+clevel_hash<Key, T, Hash, KeyEqual, HashPower, KVAllocator, ResizePolicy>::build_level_dir() const
+{
+	std::lock_guard<std::mutex> lock(dir_mutex);
+
+	uint64_t m_raw = meta.raw() & ~meta_dirty;
+	std::atomic_thread_fence(std::memory_order_acquire);
+	uint64_t version = dir_version.load();
+
+	const level_dir *d = level_directory.load();
+	if (d != nullptr && d->meta == m_raw && d->version == version)
+		return d;
+
+	std::unique_ptr<level_dir> nd(new level_dir());
+	nd->meta = m_raw;
+	nd->version = version;
+	nd->n_levels = 0;
+
+	level_meta_ptr_t m_copy(m_raw);
+	level_meta *m = static_cast<level_meta *>(m_copy(my_pool_uuid, pool_addr));
+	level_ptr_t li = m->last_level;
+	while (true)
+	{
+		assert(nd->n_levels < MAX_LEVEL);
+		level_bucket *cl = li.get_address(my_pool_uuid, pool_addr);
+		assert((cl->capacity & (cl->capacity - 1)) == 0);
+
+		level_info &l = nd->levels[nd->n_levels++];
+		l.buckets = cl->buckets.get();
+		l.capacity = cl->capacity;
+		l.mask = cl->capacity / 2 - 1;
+
+		if (li == m->first_level)
+			break;
+		li = cl->up;
+	}
+
+	uint64_t epoch = global_epoch.load();
+	if (!level_dirs.empty())
+		level_dirs.back()->retired = epoch;
+	level_dirs.erase(std::remove_if(level_dirs.begin(), level_dirs.end(),
+		[epoch](const std::unique_ptr<level_dir> &o) {
+			return o->retired + 2 <= epoch;
+		}), level_dirs.end());
+
+	d = nd.get();
+	level_dirs.push_back(std::move(nd));
+	level_directory.store(d);
+
+	return d;
+}
+
+template <typename Key, typename T, typename Hash, typename KeyEqual,
+	size_t HashPower, typename KVAllocator, typename ResizePolicy>
+typename clevel_hash<Key, T, Hash, KeyEqual, HashPower, KVAllocator, ResizePolicy>::ret
+clevel_hash<Key, T, Hash, KeyEqual, HashPower, KVAllocator, ResizePolicy>::generic_search(
+	const key_type &key, const_pointer &value) const
+{
+	hv_type hv = hasher{}(key);
+	partial_t partial = get_partial(hv);
+
+	while(true)
+	{
+		const level_dir *d = get_level_dir();
+		level_meta_ptr_t m_copy(d->meta);
+
+		// Bottom-to-top search.
+		difference_type f_idx, s_idx;
+		uint32_t match, empty;
+		for (size_type i = 0; i < d->n_levels; i++)
+		{
+			const level_info &cl = d->levels[i];
+			f_idx = first_index(hv, cl);
+			s_idx = second_index(partial, f_idx, cl);
+
+			bucket &f_b = cl.buckets[f_idx];
+			match_bucket(f_b, partial, match, empty);
+			for (; match != 0; match &= match - 1)
+			{
+				size_type j = first_slot(match);
+				KV_entry_ptr_t tmp = f_b.slots[j].p;
+				value = tmp.get_address(my_pool_uuid, pool_addr);
+				if (value != nullptr && key_equal{}(value->first, key))
+				{
+					add_stat(STAT_LOOKUPS);
+					add_stat(STAT_LEVELS_PROBED, i + 1);
+					return ret(i, f_idx, j);
+				}
+			}
+
+			bucket &s_b = cl.buckets[s_idx];
+			match_bucket(s_b, partial, match, empty);
+			for (; match != 0; match &= match - 1)
+			{
+				size_type j = first_slot(match);
+				KV_entry_ptr_t tmp = s_b.slots[j].p;
+				value = tmp.get_address(my_pool_uuid, pool_addr);
+				if (value != nullptr && key_equal{}(value->first, key))
+				{
+					add_stat(STAT_LOOKUPS);
+					add_stat(STAT_LEVELS_PROBED, i + 1);
+					return ret(i, s_idx, j);
+				}
+			}
+		}
+
+		// Context checking.
+		if (same_meta(m_copy))
+		{
+			add_stat(STAT_LOOKUPS);
+			add_stat(STAT_LEVELS_PROBED, d->n_levels);
+			value = nullptr;
+			return ret();
+		}
+		add_stat(STAT_CONTEXT_RETRIES);
+	} // end while(true)
+}
+
+template <typename Key, typename T, typename Hash, typename KeyEqual,
+	size_t HashPower, typename KVAllocator, typename ResizePolicy>
+bool
+clevel_hash<Key, T, Hash, KeyEqual, HashPower, KVAllocator, ResizePolicy>::find(
+	const_accessor &result, const key_type &key) const
+{
+	result.release();
+
+	result.my_map = this;
+	result.my_epoch = enter_epoch();
+
+	const_pointer value;
+	if (!generic_search(key, value).found)
+	{
+		result.release();
+		return false;
+	}
+
+	result.my_value = value;
+	return true;
+}
+
+template <typename Key, typename T, typename Hash, typename KeyEqual,
+	size_t HashPower, typename KVAllocator, typename ResizePolicy>
+uint64_t
+clevel_hash<Key, T, Hash, KeyEqual, HashPower, KVAllocator, ResizePolicy>::enter_epoch() const
+{
+	epoch_stripe &st = stripes[epoch_stripe_id()];
+	while (true)
+	{
+		uint64_t epoch = global_epoch.load();
+		st.cnt[epoch & 1].fetch_add(1);
+
+		// The reclaimer may have missed our counter.
+		if (global_epoch.load() == epoch)
+			return epoch;
+
+		st.cnt[epoch & 1].fetch_sub(1);
+	}
+}
+
+template <typename Key, typename T, typename Hash, typename KeyEqual,
+	size_t HashPower, typename KVAllocator, typename ResizePolicy>
+void
+clevel_hash<Key, T, Hash, KeyEqual, HashPower, KVAllocator, ResizePolicy>::leave_epoch(uint64_t epoch) const
+{
+	stripes[epoch_stripe_id()].cnt[epoch & 1].fetch_sub(1);
+}
+
+/**
+ * Check if any thread entered in the given epoch is still in it.
+ */
+template <typename Key, typename T, typename Hash, typename KeyEqual,
+	size_t HashPower, typename KVAllocator, typename ResizePolicy>
+bool
+clevel_hash<Key, T, Hash, KeyEqual, HashPower, KVAllocator, ResizePolicy>::has_active(uint64_t epoch) const
+{
+	for (size_type i = 0; i < epoch_stripes; i++)
+	{
+		if (stripes[i].cnt[epoch & 1].load() != 0)
+			return true;
+	}
+
+	return false;
+}
+
+/**
+ * Advance the global epoch once no thread is left in the previous epoch.
+ * A KV entry unlinked in epoch e can be freed in epoch e + 2, since the
+ * threads that may refer to it entered in epoch e or earlier.
+ */
+template <typename Key, typename T, typename Hash, typename KeyEqual,
+	size_t HashPower, typename KVAllocator, typename ResizePolicy>
+void
+clevel_hash<Key, T, Hash, KeyEqual, HashPower, KVAllocator, ResizePolicy>::try_advance_epoch()
+{
+	uint64_t epoch = global_epoch.load();
+
+	// The previous epoch has the same parity as the next one.
+	if (!has_active(epoch + 1))
+		global_epoch.compare_exchange_strong(epoch, epoch + 1);
+}
+
+/**
+ * Log a KV entry to be unlinked at the tail of the limbo list of a
+ * thread. Must be followed by commit_retire() or cancel_retire().
+ * @returns false if the limbo list is full, in which case the entry is
+ * not retired.
+ */
+template <typename Key, typename T, typename Hash, typename KeyEqual,
+	size_t HashPower, typename KVAllocator, typename ResizePolicy>
+bool
+clevel_hash<Key, T, Hash, KeyEqual, HashPower, KVAllocator, ResizePolicy>::log_retire(pool_base &pop, size_type thread_id,
+	KV_entry_ptr_t e)
+{
+	limbo_list &l = get_thread_slot(thread_id).limbo;
+	size_type tail = l.tail.load();
+	if (tail - l.head.load() >= limbo_size)
+		return false;
+
+	limbo_record &r = l.records[tail % limbo_size];
+	r.entry = persistent_ptr<KV_entry>(e.raw_ptr(my_pool_uuid));
+	persist(pop, r.entry);
+
+	return true;
+}
+
+template <typename Key, typename T, typename Hash, typename KeyEqual,
+	size_t HashPower, typename KVAllocator, typename ResizePolicy>
+void
+clevel_hash<Key, T, Hash, KeyEqual, HashPower, KVAllocator, ResizePolicy>::commit_retire(size_type thread_id)
+{
+	limbo_list &l = get_thread_slot(thread_id).limbo;
+	size_type tail = l.tail.load();
+
+	// The epoch is read after the entry is unlinked.
+	l.records[tail % limbo_size].epoch = global_epoch.load();
+	l.tail.store(tail + 1);
+}
+
+template <typename Key, typename T, typename Hash, typename KeyEqual,
+	size_t HashPower, typename KVAllocator, typename ResizePolicy>
+void
+clevel_hash<Key, T, Hash, KeyEqual, HashPower, KVAllocator, ResizePolicy>::cancel_retire(pool_base &pop, size_type thread_id)
+{
+	limbo_list &l = get_thread_slot(thread_id).limbo;
+	limbo_record &r = l.records[l.tail.load() % limbo_size];
+
+	r.entry = nullptr;
+	persist(pop, r.entry);
+}
+
+/**
+ * Wait until the limbo list of a thread has room for an operation. Must
+ * not be called in an epoch, which would block the reclaimer.
+ */
+template <typename Key, typename T, typename Hash, typename KeyEqual,
+	size_t HashPower, typename KVAllocator, typename ResizePolicy>
+void
+clevel_hash<Key, T, Hash, KeyEqual, HashPower, KVAllocator, ResizePolicy>::wait_for_limbo(size_type thread_id)
+{
+	limbo_list &l = get_thread_slot(thread_id).limbo;
+	while (l.tail.load() - l.head.load() > limbo_size - limbo_reserve)
+		std::this_thread::yield();
+}
+
+/**
+ * Background reclaimer, which advances the global epoch and frees the
+ * KV entries retired at least two epochs ago in batches.
+ */
+template <typename Key, typename T, typename Hash, typename KeyEqual,
+	size_t HashPower, typename KVAllocator, typename ResizePolicy>
+void
+clevel_hash<Key, T, Hash, KeyEqual, HashPower, KVAllocator, ResizePolicy>::reclaim()
+{
+	while (run_reclaim_thread.load())
+	{
+		try_advance_epoch();
+		free_retired(global_epoch.load());
+
+		usleep(reclaim_interval);
+	}
+}
+
+/**
+ * Free the KV entries retired at least two epochs before the given one.
+ */
+template <typename Key, typename T, typename Hash, typename KeyEqual,
+	size_t HashPower, typename KVAllocator, typename ResizePolicy>
+void
+clevel_hash<Key, T, Hash, KeyEqual, HashPower, KVAllocator, ResizePolicy>::free_retired(
+	uint64_t epoch)
+{
+	size_type num = slot_registry->capacity();
+	for (size_type i = 0; i < num; i++)
+	{
+		limbo_list &l = get_thread_slot(i).limbo;
+		size_type head = l.head.load(), tail = l.tail.load();
+		for (; head != tail; head++)
+		{
+			limbo_record &r = l.records[head % limbo_size];
+			if (r.epoch + 2 > epoch)
+				break;
+
+			// Free the entry and clear the record atomically.
+			kv_allocator.deallocate(i, r.entry);
+		}
+		l.head.store(head);
+	}
+}
+
+/**
+ * Free the unreachable KV entries recorded in limbo lists and clear the
+ * lists. Must be called in a transaction without concurrent operations.
+ */
+template <typename Key, typename T, typename Hash, typename KeyEqual,
+	size_t HashPower, typename KVAllocator, typename ResizePolicy>
+void
+clevel_hash<Key, T, Hash, KeyEqual, HashPower, KVAllocator, ResizePolicy>::recover_limbos()
+{
+	for (size_type i = 0; i < thread_num; i++)
+	{
+		limbo_list &l = get_thread_slot(i).limbo;
+		for (auto &r : l.records)
+		{
+			if (r.entry == nullptr)
+				continue;
+
+			// Entries of allocators recovering by scan are freed
+			// unless they are reachable.
+			if (!KVAllocator::recover_by_scan && !is_reachable(r.entry))
+				delete_persistent<KV_entry>(r.entry);
+			r.entry = nullptr;
+		}
+		l.head.store(0);
+		l.tail.store(0);
+	}
+}
+
+/**
+ * Report the KV entries reachable from the table to an allocator that
+ * rebuilds its allocation state by scanning. Not thread safe.
+ */
+template <typename Key, typename T, typename Hash, typename KeyEqual,
+	size_t HashPower, typename KVAllocator, typename ResizePolicy>
+void
+clevel_hash<Key, T, Hash, KeyEqual, HashPower, KVAllocator, ResizePolicy>::recover_KV_allocator()
+{
+	if (!KVAllocator::recover_by_scan)
+		return;
+
+	kv_allocator.recover_begin();
+
+	level_meta *m = static_cast<level_meta *>(meta(my_pool_uuid, pool_addr));
+	level_ptr_t li = m->last_level;
+	while (true)
+	{
+		level_bucket *cl = li.get_address(my_pool_uuid, pool_addr);
+		bucket *buckets = cl->buckets.get();
+		for (uint64_t i = 0; i < cl->capacity; i++)
+		{
+			for (size_type j = 0; j < assoc_num; j++)
+			{
+				value_type *e = buckets[i].slots[j].p.get_address(
+					my_pool_uuid, pool_addr);
+				if (e != nullptr)
+					kv_allocator.recover_mark(e);
+			}
+		}
+
+		if (li == m->first_level)
+			break;
+		li = cl->up;
+	}
+
+	kv_allocator.recover_end();
+}
+
+template <typename Key, typename T, typename Hash, typename KeyEqual,
+	size_t HashPower, typename KVAllocator, typename ResizePolicy>
+void
+clevel_hash<Key, T, Hash, KeyEqual, HashPower, KVAllocator, ResizePolicy>::multi_search(
+	const key_type *keys, size_type n, ret *out) const
+{
+	hv_type hv[search_batch];
+	partial_t partial[search_batch];
+
+	epoch_guard guard(this);
+
+	for (size_type base = 0; base < n; base += search_batch)
+	{
+		// Not std::min, which would odr-use search_batch.
+		size_type batch = n - base < search_batch ? n - base : search_batch;
+		const key_type *b_keys = keys + base;
+		ret *b_out = out + base;
+
+		const level_dir *d = get_level_dir();
+		level_meta_ptr_t m_copy(d->meta);
+		size_type n_levels = d->n_levels;
+
+		// 1. Prefetch both candidate buckets in every level.
+		for (size_type k = 0; k < batch; k++)
+		{
+			hv[k] = hasher{}(b_keys[k]);
+			partial[k] = get_partial(hv[k]);
+
+			for (size_type i = 0; i < n_levels; i++)
+			{
+				const level_info &cl = d->levels[i];
+				difference_type f_idx = first_index(hv[k], cl);
+				difference_type s_idx =
+					second_index(partial[k], f_idx, cl);
+				__builtin_prefetch(&cl.buckets[f_idx]);
+				__builtin_prefetch(&cl.buckets[s_idx]);
+			}
+		}
+
+		// 2. Prefetch KV entries of the slots with matched tags.
+		for (size_type k = 0; k < batch; k++)
+		{
+			for (size_type i = 0; i < n_levels; i++)
+			{
+				const level_info &cl = d->levels[i];
+				difference_type f_idx = first_index(hv[k], cl);
+				difference_type idx[2] = {f_idx,
+					second_index(partial[k], f_idx, cl)};
+
+				for (difference_type b_idx : idx)
+				{
+					bucket &b = cl.buckets[b_idx];
+					uint32_t match, empty;
+					match_bucket(b, partial[k], match, empty);
+					for (; match != 0; match &= match - 1)
+					{
+						KV_entry_ptr_t tmp = b.slots[first_slot(match)].p;
+						__builtin_prefetch(
+							tmp.get_address(my_pool_uuid, pool_addr));
+					}
+				}
+			}
+		}
+
+		// 3. Compare keys with the same bottom-to-top order as search().
+		size_type probed = 0;
+		for (size_type k = 0; k < batch; k++)
+		{
+			b_out[k] = ret();
+			size_type i = 0;
+			for (; i < n_levels && !b_out[k].found; i++)
+			{
+				const level_info &cl = d->levels[i];
+				difference_type f_idx = first_index(hv[k], cl);
+				difference_type idx[2] = {f_idx,
+					second_index(partial[k], f_idx, cl)};
+
+				for (difference_type b_idx : idx)
+				{
+					bucket &b = cl.buckets[b_idx];
+					uint32_t match, empty;
+					match_bucket(b, partial[k], match, empty);
+					for (; match != 0; match &= match - 1)
+					{
+						size_type j = first_slot(match);
+						KV_entry_ptr_t tmp = b.slots[j].p;
+						if (tmp.get_offset() != 0 && key_equal{}(
+							tmp.get_address(my_pool_uuid, pool_addr)->first,
+							b_keys[k]))
+						{
+							b_out[k] = ret(i, b_idx, j);
+							break;
+						}
+					}
+
+					if (b_out[k].found)
+						break;
+				}
+			}
+			probed += i;
+		}
+		add_stat(STAT_LOOKUPS, batch);
+		add_stat(STAT_LEVELS_PROBED, probed);
+
+		// Context checking. Absent keys may have been moved by a
+		// concurrent rehashing, so search them again.
+		if (!same_meta(m_copy))
+		{
+			add_stat(STAT_CONTEXT_RETRIES);
+			for (size_type k = 0; k < batch; k++)
+			{
+				if (!b_out[k].found)
+					b_out[k] = search(b_keys[k]);
+			}
+		}
+	}
+}
+
+template <typename Key, typename T, typename Hash, typename KeyEqual,
+	size_t HashPower, typename KVAllocator, typename ResizePolicy>
+template <typename Fn>
+void
+clevel_hash<Key, T, Hash, KeyEqual, HashPower, KVAllocator, ResizePolicy>::parallel_scan(
+	size_type nthreads, Fn fn) const
+{
+	assert(nthreads > 0);
+
+	// The epoch of this thread keeps the levels and items alive for the
+	// workers.
+	epoch_guard guard(this);
+	scan_guard scan(this);
+	const level_dir *d = get_level_dir();
+
+	auto work = [&](size_type p) {
+		for (size_type i = 0; i < d->n_levels; i++)
+		{
+			const level_info &l = d->levels[i];
+			scan_buckets(l, l.capacity * p / nthreads,
+				l.capacity * (p + 1) / nthreads, fn);
+		}
+	};
+
+	std::vector<std::thread> workers;
+	workers.reserve(nthreads - 1);
+	for (size_type p = 1; p < nthreads; p++)
+		workers.emplace_back(work, p);
+	work(0);
+	for (auto &w : workers)
+		w.join();
+}
+
+/**
+ * Delete the lower duplicate p2 of the item at p1, retiring it if it is
+ * another entry than the one at p1.
+ * @returns false if the limbo list has no room to retire it, in which
+ * case it is left in place.
+ */
+template <typename Key, typename T, typename Hash, typename KeyEqual,
+	size_t HashPower, typename KVAllocator, typename ResizePolicy>
+bool
+clevel_hash<Key, T, Hash, KeyEqual, HashPower, KVAllocator, ResizePolicy>::del_dup(
+	pool_base &pop, size_type thread_id, KV_entry_ptr_u *p1,
+	KV_entry_ptr_u *p2, KV_entry_ptr_t e1, KV_entry_ptr_t e2)
+{
+	add_stat(STAT_DEL_DUPS);
+
+	KV_entry_ptr_u tmp1_u, tmp2_u;
+	tmp1_u.p = e1;
+	tmp2_u.p = e2;
+
+	if (e1 != p1->p || e2 != p2->p)
+		return true;
+
+	if (tmp1_u.x.partial == tmp2_u.x.partial)
+	{
+		// 1. Refer to the same location
+		if (e1.get_offset() == e2.get_offset())
+		{
+			if (CAS(&(p2->p.off), e2.raw(), 0))
+			{
+				persist(pop, &(p2->p.off), sizeof(uint64_t));
+			}
+		}
+
+		// 2. Refer to different locations with the same contents
+		else if (key_equal{}(e1.get_address(my_pool_uuid, pool_addr)->first,
+			e2.get_address(my_pool_uuid, pool_addr)->first))
+		{
+			// An entry unlinked without a record would never be
+			// freed.
+			if (!log_retire(pop, thread_id, e2))
+				return false;
+
+			if (CAS(&(p2->p.off), e2.raw(), 0))
+			{
+				persist(pop, &(p2->p.off), sizeof(uint64_t));
+				commit_retire(thread_id);
+			}
+			else
+			{
+				cancel_retire(pop, thread_id);
+			}
+		}
+	}
+
+	return true;
+}
+
+template <typename Key, typename T, typename Hash, typename KeyEqual,
+	size_t HashPower, typename KVAllocator, typename ResizePolicy>
+typename clevel_hash<Key, T, Hash, KeyEqual, HashPower, KVAllocator, ResizePolicy>::f_code_t
+clevel_hash<Key, T, Hash, KeyEqual, HashPower, KVAllocator, ResizePolicy>::find_empty_slot(
+	pool_base &pop, hv_type hv, partial_t partial,
+	size_type &n_levels, KV_entry_ptr_t **e,
+	uint64_t &level_num, level_meta_ptr_t &m_copy)
+{
+	while (true)
+	{
+		const level_dir *d = get_level_dir(pop, m_copy);
+		*e = nullptr;
+
+		difference_type f_idx, s_idx;
+		uint64_t slot_idx;
+		uint32_t match, empty;
+
+		f_code_t result;
+
+		n_levels = d->n_levels;
+		result = ABSENT_AND_NO_VACANCY;
+
+		for (size_type i = n_levels - 1; i < n_levels; i--)
+		{
+			const level_info &cl = d->levels[i];
+			f_idx = first_index(hv, cl);
+			s_idx = second_index(partial, f_idx, cl);
+
+			// Only the first empty slot in a bucket is considered.
+			bucket &f_b = cl.buckets[f_idx];
+			match_bucket(f_b, partial, match, empty);
+			if (empty != 0)
+			{
+				size_type j = first_slot(empty);
+
+				result = VACANCY_IN_LEFT;
+				*e = &(f_b.slots[j].p);
+				level_num = i;
+				slot_idx = j;
+			}
+
+			bucket &s_b = cl.buckets[s_idx];
+			match_bucket(s_b, partial, match, empty);
+			if (empty != 0)
+			{
+				size_type j = first_slot(empty);
+
+				// We prefer the less loaded bucket
+				if (!(result == VACANCY_IN_LEFT && level_num == i &&
+					slot_idx <= j))
+				{
+					result = VACANCY_IN_RIGHT;
+					*e = &(s_b.slots[j].p);
+					level_num = i;
+					slot_idx = j;
+				}
+			}
+
+			if (result != ABSENT_AND_NO_VACANCY)
+				break;
+		}
+
+		// Context checking.
+		if (same_meta(m_copy))
+		{
+			return result;
+		}
+		else
+		{
+			add_stat(STAT_CONTEXT_RETRIES);
+			m_copy = load_meta(pop);
+		}
+	}
+}
+
+template <typename Key, typename T, typename Hash, typename KeyEqual,
+	size_t HashPower, typename KVAllocator, typename ResizePolicy>
+typename clevel_hash<Key, T, Hash, KeyEqual, HashPower, KVAllocator, ResizePolicy>::f_code_t
+clevel_hash<Key, T, Hash, KeyEqual, HashPower, KVAllocator, ResizePolicy>::find(
+	pool_base &pop, const key_type &key, hv_type hv, partial_t partial,
+	size_type &n_levels, KV_entry_ptr_t &old_e, KV_entry_ptr_t **e,
+	uint64_t &level_num, difference_type &idx, bool fix_dup,
+	size_type thread_id, level_meta_ptr_t &m_copy)
+{
+	while (true)
+	{
+RETRY_FIND:
+		const level_dir *d = get_level_dir(pop, m_copy);
+		*e = nullptr;
+
+		difference_type f_idx, s_idx;
+		KV_entry_ptr_t f_e, s_e;
+		uint64_t slot_idx = 0;
+		uint32_t match, empty;
+
+		f_code_t result;
+		KV_entry_ptr_t prev_e;
+		size_type prev_i;
+
+		n_levels = d->n_levels;
+		result = ABSENT_AND_NO_VACANCY;
+
+		// Bottom-to-top search.
+		for (size_type i = 0; i < n_levels; i++)
+		{
+			const level_info &cl = d->levels[i];
+			f_idx = first_index(hv, cl);
+			s_idx = second_index(partial, f_idx, cl);
+
+			bucket &f_b = cl.buckets[f_idx];
+			match_bucket(f_b, partial, match, empty);
+
+			// Since empty slots in top levels are preferred, update vacancy
+			// info as long as identical keys are not found. Only the first
+			// slot still empty in a bucket is considered.
+			for (; empty != 0 && result != FOUND_IN_LEFT &&
+				result != FOUND_IN_RIGHT; empty &= empty - 1)
+			{
+				size_type j = first_slot(empty);
+				f_e = f_b.slots[j].p;
+				if (f_e.get_offset() != 0)
+					continue;
+
+				result = VACANCY_IN_LEFT;
+				old_e = f_e;
+				*e = &(f_b.slots[j].p);
+				level_num = i;
+				idx = f_idx;
+				slot_idx = j;
+				break;
+			}
+
+			for (; match != 0; match &= match - 1)
+			{
+				size_type j = first_slot(match);
+				f_e = f_b.slots[j].p;
+				if (f_e.get_offset() == 0 || !key_equal{}(
+					f_e.get_address(my_pool_uuid, pool_addr)->first, key))
+					continue;
+
+				if (!fix_dup)
+				{
+					result = FOUND_IN_LEFT;
+					level_num = i;
+					idx = f_idx;
+					slot_idx = j;
+
+					return result;
+				}
+
+				if (result == FOUND_IN_LEFT || result == FOUND_IN_RIGHT)
+				{
+					// Refer to the same location
+					if (f_e.get_offset() == prev_e.get_offset())
+					{
+						// Duplication due to the re-insertion in normal
+						// executions or os scheduling during a rehashing
+						// operation. In this case, delete the pointer in
+						// bottom level.
+						if (prev_i < i)
+						{
+							del_dup(pop, thread_id, &f_b.slots[j], &(d->levels[level_num]
+								.buckets[idx].slots[slot_idx]), f_e, prev_e);
+						}
+						else
+						{
+							// Never fires!
+							assert(false);
+						}
+					}
+					// Refer to different locations
+					else
+					{
+						// Duplication due to the re-insertion after a crash
+						// or concurrent insertions of same key. To fix the
+						// duplication, simply delete the previous item,
+						// unless the limbo list has no room to retire it.
+						if (!del_dup(pop, thread_id, &f_b.slots[j], &(d->levels[level_num]
+							.buckets[idx].slots[slot_idx]), f_e, prev_e))
+							goto FIND_CONTEXT;
+					}
+					add_stat(STAT_FIND_RETRIES);
+					goto RETRY_FIND;
+				}
+				else
+				{
+					result = FOUND_IN_LEFT;
+					old_e = f_e;
+					*e = &(f_b.slots[j].p);
+					level_num = i;
+					idx = f_idx;
+					slot_idx = j;
+
+					prev_e = f_e;
+					prev_i = i;
+				} // end if result in FOUND_IN_LEFT or FOUND_IN_RIGHT
+			} // end for j, f_idx, f_b
+
+			bucket &s_b = cl.buckets[s_idx];
+			match_bucket(s_b, partial, match, empty);
+
+			for (; empty != 0 && result != FOUND_IN_LEFT &&
+				result != FOUND_IN_RIGHT; empty &= empty - 1)
+			{
+				size_type j = first_slot(empty);
+				s_e = s_b.slots[j].p;
+				if (s_e.get_offset() != 0)
+					continue;
+
+				// We prefer the less loaded bucket
+				if (!(result == VACANCY_IN_LEFT && level_num == i &&
+					slot_idx <= j))
+				{
+					result = VACANCY_IN_RIGHT;
+					old_e = s_e;
+					*e = &(s_b.slots[j].p);
+					level_num = i;
+					idx = s_idx;
+					slot_idx = j;
+				}
+				break;
+			}
+
+			for (; match != 0; match &= match - 1)
+			{
+				size_type j = first_slot(match);
+				s_e = s_b.slots[j].p;
+				if (s_e.get_offset() == 0 || !key_equal{}(
+					s_e.get_address(my_pool_uuid, pool_addr)->first, key))
+					continue;
+
+				if (!fix_dup)
+				{
+					result = FOUND_IN_RIGHT;
+					level_num = i;
+					idx = s_idx;
+					slot_idx = j;
+
+					return result;
+				}
+
+				if (result == FOUND_IN_LEFT || result == FOUND_IN_RIGHT)
+				{
+					// Refer to the same location
+					if (s_e.get_offset() == prev_e.get_offset())
+					{
+						// Duplication due to the re-insertion in normal
+						// executions or os scheduling during a rehashing
+						// operation. In this case, delete the pointer in
+						// bottom level.
+						if (prev_i < i)
+						{
+							del_dup(pop, thread_id, &s_b.slots[j], &(d->levels[level_num]
+								.buckets[idx].slots[slot_idx]), s_e, prev_e);
+						}
+						else
+						{
+							// Never fires!
+							assert(false);
+						}
+					}
+					// Refer to different locations
+					else
+					{
+						// Duplication due to the re-insertion after a crash
+						// or concurrent insertions of same key. To fix the
+						// duplication, simply delete the previous item,
+						// unless the limbo list has no room to retire it.
+						if (!del_dup(pop, thread_id, &s_b.slots[j], &(d->levels[level_num]
+							.buckets[idx].slots[slot_idx]), s_e, prev_e))
+							goto FIND_CONTEXT;
+					}
+					add_stat(STAT_FIND_RETRIES);
+					goto RETRY_FIND;
+				}
+				else
+				{
+					result = FOUND_IN_RIGHT;
+					old_e = s_e;
+					*e = &(s_b.slots[j].p);
+					level_num = i;
+					idx = s_idx;
+					slot_idx = j;
+
+					prev_e = s_e;
+					prev_i = i;
+				} // end if result in FOUND_IN_LEFT or FOUND_IN_RIGHT
+			} // end for j, s_idx, s_b
+
+		} // end for i, n_levels; end for first round
+
+FIND_CONTEXT:
+		// Context checking.
+		if (same_meta(m_copy))
+		{
+			return result;
+		}
+		else
+		{
+			add_stat(STAT_CONTEXT_RETRIES);
+			m_copy = load_meta(pop);
+		}
+	} // end while
+}
+
+template <typename Key, typename T, typename Hash, typename KeyEqual,
+	size_t HashPower, typename KVAllocator, typename ResizePolicy>
+typename clevel_hash<Key, T, Hash, KeyEqual, HashPower, KVAllocator, ResizePolicy>::ret
+clevel_hash<Key, T, Hash, KeyEqual, HashPower, KVAllocator, ResizePolicy>::generic_insert(
+	const key_type &key, const void *param,
+	void (clevel_hash::*allocate_KV)(pool_base &, size_type,
+		persistent_ptr<KV_entry> &, hv_type, const void *))
+{
+	pool_base pop = get_pool_base();
+	size_type thread_id = this_thread_slot();
+	persistent_ptr<KV_entry> &tmp_entry = get_thread_slot(thread_id).tmp_entry;
+
+	hv_type hv = hasher{}(key);
+	partial_t partial = get_partial(hv);
+
+	(this->*allocate_KV)(pop, thread_id, tmp_entry, hv, param);
+	KV_entry_ptr_u created(tmp_entry.raw().off);
+	created.x.partial = partial;
+
+	epoch_guard guard(this);
+
+	bool expanded_flag = false;
+	uint64_t initial_capacity = 0;
+	bool check_duplicate = true;
+
+#ifdef CLEVEL_DEBUG
+	uint64_t retry_insert_cnt = 0;
+	thread_logs[thread_id] << "Thread-" << thread_id << " starts inserting "
+		<< key << std::endl;
+#endif
+
+#ifdef DEBUG_RESIZING
+	initial_capacity = capacity();
+#endif
+
+	while (true)
+	{
+RETRY_INSERT:
+#ifdef CLEVEL_DEBUG
+        retry_insert_cnt ++;
+        if (retry_insert_cnt > 10)
+        {
+            thread_logs[thread_id] << "Thread-" << thread_id
+				<< " [loop] retry_insert_cnt = " << retry_insert_cnt
+				<< ", key = " << key << std::endl;
+        }
+        else if (retry_insert_cnt > 1)
+        {
+            thread_logs[thread_id] << "Thread-" << thread_id
+				<< " retry_insert_cnt = " << retry_insert_cnt
+				<< ", key = " << key << std::endl;
+        }
+#endif
+		level_meta_ptr_t m_copy = load_meta(pop);
+
+		size_type n_levels;
+		uint64_t level_num = 0;
+		difference_type idx;
+		KV_entry_ptr_t *e, old_e;
+		f_code_t result;
+		if (check_duplicate)
+		{
+			result = find(pop, key, hv, partial, n_levels,
+				old_e, &e, level_num, idx, /*fix_dup=*/false, thread_id, m_copy);
+		}
+		else
+		{
+			result = find_empty_slot(pop, hv, partial, n_levels,
+				&e, level_num, m_copy);
+		}
+
+
+		level_meta *m = static_cast<level_meta *>(m_copy(my_pool_uuid, pool_addr));
+
+		if (result == FOUND_IN_LEFT || result == FOUND_IN_RIGHT)
+		{
+			kv_allocator.deallocate(thread_id, tmp_entry);
+			return ret(level_num, 0, 0);
+		}
+		else if ((result == VACANCY_IN_LEFT || result == VACANCY_IN_RIGHT) &&
+			(level_num > 0 || !m->is_resizing))
+		{
+			if (CAS(&(e->off), old_e.raw(), created.p.raw()))
+			{
+				if (!m->is_resizing && meta(my_pool_uuid, pool_addr)->is_resizing &&
+					level_num == 0)
+				{
+					// Resizing may occur during the insert. Hence, redo the
+					// insertion to avoid missing the new item. The possible
+					// duplication will be fixed in future updates and deletes.
+					check_duplicate = false;
+					add_stat(STAT_INSERT_RETRIES);
+					goto RETRY_INSERT;
+				}
+				else
 				{
-					found_empty_in_b = true;
+					persist(pop, &(e->off), sizeof(uint64_t));
+					add_items(thread_id, 1);
+					release_tmp_entry(pop, tmp_entry);
 
-					result = VACANCY_IN_LEFT;
-					*e = &(f_b.slots[j].p);
-					level_num = i;
-					slot_idx = j;
+					return ret(expanded_flag, initial_capacity);
 				}
+
+			}
+			else
+			{
+#ifdef CLEVEL_DEBUG
+				std::cout << "insertion, cas fails, n_levels: " << n_levels
+					  << std::endl;
+#endif
+				add_stat(STAT_INSERT_CAS_FAILURES);
+				add_stat(STAT_INSERT_RETRIES);
+				goto RETRY_INSERT;
 			}
+		}
 
-			// flag used to skip vacant slots after finding an empty
-			// slot in a bucket.
-			found_empty_in_b = false;
-			bucket &s_b = cl->buckets[s_idx];
-			for (size_type j = 0; j < assoc_num; j++)
+		// start expanding
+		expanded_flag = true;
+		if (!expand(pop, thread_id, m_copy))
+			guard.renew();
+	} // end while(true)
+}
+
+template <typename Key, typename T, typename Hash, typename KeyEqual,
+	size_t HashPower, typename KVAllocator, typename ResizePolicy>
+void
+clevel_hash<Key, T, Hash, KeyEqual, HashPower, KVAllocator, ResizePolicy>::reserve(
+	size_type n, double load_factor)
+{
+	assert(load_factor > 0 && load_factor <= 1);
+	pool_base pop = get_pool_base();
+	size_type thread_id = this_thread_slot();
+	epoch_guard guard(this);
+
+	size_type slots = static_cast<size_type>(std::ceil(n / load_factor));
+	if (capacity(load_meta(pop)) >= slots)
+		return;
+
+	size_type power = reserve_power(n, load_factor);
+
+	// Raise the minimum size first, so that the expand thread does not
+	// shrink the table below the new levels.
+	hashpower.get_rw() = power;
+	persist(pop, hashpower);
+
+#ifdef CLEVEL_DEBUG
+	std::cout << "Thread-" << thread_id << " reserves " << n
+		<< " items, hash power: " << power << std::endl;
+#endif
+
+	// Each expansion appends its level above the first level.
+	expand(pop, thread_id, load_meta(pop), size_type(1) << (power - 1));
+	expand(pop, thread_id, load_meta(pop), size_type(1) << power);
+}
+
+/**
+ * Get the hash power of the top level of a pair of levels that holds n
+ * items at the given load factor, which is at least hashpower.
+ */
+template <typename Key, typename T, typename Hash, typename KeyEqual,
+	size_t HashPower, typename KVAllocator, typename ResizePolicy>
+typename clevel_hash<Key, T, Hash, KeyEqual, HashPower, KVAllocator, ResizePolicy>::size_type
+clevel_hash<Key, T, Hash, KeyEqual, HashPower, KVAllocator, ResizePolicy>::reserve_power(
+	size_type n, double load_factor) const
+{
+	size_type slots = static_cast<size_type>(std::ceil(n / load_factor));
+
+	// Levels of 2^power and 2^(power - 1) buckets hold
+	// 3 * 2^(power - 1) * assoc_num slots.
+	size_type power = hashpower;
+	while ((size_type(3) << (power - 1)) * assoc_num < slots)
+		power++;
+
+	return power;
+}
+
+template <typename Key, typename T, typename Hash, typename KeyEqual,
+	size_t HashPower, typename KVAllocator, typename ResizePolicy>
+template <typename RandomIt>
+typename clevel_hash<Key, T, Hash, KeyEqual, HashPower, KVAllocator, ResizePolicy>::size_type
+clevel_hash<Key, T, Hash, KeyEqual, HashPower, KVAllocator, ResizePolicy>::bulk_load(
+	RandomIt first, RandomIt last, size_type nthreads)
+{
+	assert(nthreads > 0);
+	using it_diff = typename std::iterator_traits<RandomIt>::difference_type;
+
+	size_type n = static_cast<size_type>(last - first);
+	if (n == 0)
+		return 0;
+
+	pool_base pop = get_pool_base();
+
+	// The pair also holds the items that are rehashed from the table.
+	size_type items = ResizePolicy::count_items ? item_count() :
+		static_cast<size_type>(estimate_load_factor() * capacity());
+	size_type power = reserve_power(items + n, default_reserve_load_factor);
+
+	make_level(pop, bulk_bottom, size_type(1) << (power - 1));
+	make_level(pop, bulk_top, size_type(1) << power);
+	bulk_bottom->up = level_ptr_t(bulk_top.raw().off);
+	persist(pop, &(bulk_bottom->up.off), sizeof(uint64_t));
+
+	// Candidate classes: the first and the second half of the bottom
+	// level, then of the top level. Unlike insert(), the bottom level is
+	// filled first, which leaves room in the top level for the items
+	// rehashed from the table. A bucket belongs to one class, and the
+	// buckets of each class are split into nthreads ranges, so a thread
+	// owns the buckets it writes.
+	bucket *buckets[2] = {bulk_bottom->buckets.get(), bulk_top->buckets.get()};
+	size_type capacities[2] = {bulk_bottom->capacity, bulk_top->capacity};
+
+	auto target = [&](size_type c, hv_type hv) {
+		size_type capacity = capacities[c / 2];
+		difference_type idx = first_index(hv, capacity);
+		if (c % 2 == 1)
+			idx = second_index(get_partial(hv), idx, capacity);
+
+		return static_cast<size_type>(idx);
+	};
+	auto owner = [&](size_type c, size_type idx) {
+		size_type half = capacities[c / 2] / 2;
+		return idx % half * nthreads / half;
+	};
+
+	struct bulk_item
+	{
+		hv_type hv;
+		size_type pos;
+	};
+
+	// Items of class c from thread src to thread dst are in
+	// lists[c % 2][src * nthreads + dst].
+	std::vector<std::vector<bulk_item>> lists[2];
+	lists[0].resize(nthreads * nthreads);
+	lists[1].resize(nthreads * nthreads);
+	std::vector<std::vector<size_type>> leftovers(nthreads);
+	std::atomic<size_type> placed(0);
+
+	std::atomic<size_type> arrived(0);
+	auto barrier = [&](size_type phase) {
+		arrived.fetch_add(1);
+		while (arrived.load() < (phase + 1) * nthreads)
+			std::this_thread::yield();
+	};
+
+	auto work = [&](size_type p) {
+		size_type thread_id = this_thread_slot();
+		persistent_ptr<KV_entry> &tmp_entry =
+			get_thread_slot(thread_id).tmp_entry;
+		for (size_type i = n * p / nthreads; i < n * (p + 1) / nthreads;
+			i++)
+		{
+			hv_type hv = hasher{}((*(first + static_cast<it_diff>(i))).first);
+			lists[0][p * nthreads + owner(0, target(0, hv))].push_back(
+				bulk_item{hv, i});
+		}
+		barrier(0);
+
+		size_type my_placed = 0;
+		for (size_type c = 0; c < 4; c++)
+		{
+			for (size_type src = 0; src < nthreads; src++)
 			{
-				if (!found_empty_in_b && s_b.slots[j].p.get_offset() == 0)
+				std::vector<bulk_item> &items =
+					lists[c % 2][src * nthreads + p];
+				for (const bulk_item &it : items)
 				{
-					found_empty_in_b = true;
+					bucket &b = buckets[c / 2][target(c, it.hv)];
+					size_type j = 0;
+					while (j < assoc_num && b.slots[j].p.get_offset() != 0)
+						j++;
 
-					// We prefer the less loaded bucket
-					if (result == VACANCY_IN_LEFT && level_num == i &&
-						slot_idx <= j)
+					if (j == assoc_num)
+					{
+						if (c == 3)
+							leftovers[p].push_back(it.pos);
+						else
+							lists[(c + 1) % 2][p * nthreads +
+								owner(c + 1, target(c + 1, it.hv))]
+								.push_back(it);
 						continue;
+					}
 
-					result = VACANCY_IN_RIGHT;
-					*e = &(s_b.slots[j].p);
-					level_num = i;
-					slot_idx = j;
+					const value_type &v = *(first + static_cast<it_diff>(it.pos));
+					allocate_KV_copy_construct(pop, thread_id, tmp_entry,
+						it.hv, &v);
+					KV_entry_ptr_u created(tmp_entry.raw().off);
+					created.x.partial = get_partial(it.hv);
+
+					// The entry is freed with the levels of an
+					// interrupted load once its slot is persistent,
+					// so before the next allocation reuses tmp_entry.
+					b.slots[j].p = created.p;
+					persist(pop, &(b.slots[j].p.off), sizeof(uint64_t));
+					my_placed++;
+				}
+				std::vector<bulk_item>().swap(items);
+			}
+			barrier(c + 1);
+		}
+		placed.fetch_add(my_placed);
+		release_tmp_entry(pop, tmp_entry);
+	};
+
+	std::vector<std::thread> workers;
+	for (size_type p = 1; p < nthreads; p++)
+		workers.emplace_back(work, p);
+	work(0);
+	for (auto &w : workers)
+		w.join();
+
+	{
+		persistent_ptr<level_meta> &tmp_meta =
+			get_thread_slot(this_thread_slot()).tmp_meta;
+		epoch_guard guard(this);
+
+		// Link the pair above the first level, which makes the load
+		// survive a crash. Levels that the expand thread appended first
+		// are promoted before retrying.
+		while (true)
+		{
+			level_meta_ptr_t m_copy = load_meta(pop);
+			level_meta *m = static_cast<level_meta *>(m_copy(my_pool_uuid, pool_addr));
+			level_bucket *cl = m->first_level.get_address(my_pool_uuid, pool_addr);
+
+			// See expand(). Waiting outside the epoch lets the expand
+			// thread retire levels.
+			if (level_count() + 2 > insert_max_levels)
+			{
+				std::this_thread::yield();
+				guard.renew();
+				continue;
+			}
+
+			bool rc = cl->up == nullptr &&
+				CAS(&(cl->up.off), 0, bulk_bottom.raw().off);
+			persist(pop, &(cl->up.off), sizeof(uint64_t));
+			if (rc)
+				break;
+
+			promote_level(pop, cl, tmp_meta, m_copy);
+		}
+
+		bulk_bottom = nullptr;
+		persist(pop, bulk_bottom);
+		bulk_top = nullptr;
+		persist(pop, bulk_top);
+
+		// Make the top level of the pair the first level. The levels
+		// below are rehashed into it in the background.
+		while (true)
+		{
+			level_meta_ptr_t m_copy = load_meta(pop);
+			level_meta *m = static_cast<level_meta *>(m_copy(my_pool_uuid, pool_addr));
+			level_bucket *cl = m->first_level.get_address(my_pool_uuid, pool_addr);
+			if (cl->up == nullptr)
+				break;
+
+			persist(pop, &(cl->up.off), sizeof(uint64_t));
+			promote_level(pop, cl, tmp_meta, m_copy);
+		}
+	}
+
+	size_type loaded = placed.load();
+	add_items(this_thread_slot(), static_cast<difference_type>(loaded));
+
+	// Items whose candidate buckets are all full go through insert().
+	for (auto &l : leftovers)
+	{
+		for (size_type pos : l)
+		{
+			if (!insert(*(first + static_cast<it_diff>(pos))).found)
+				loaded++;
+		}
+	}
+
+	return loaded;
+}
+
+template <typename Key, typename T, typename Hash, typename KeyEqual,
+	size_t HashPower, typename KVAllocator, typename ResizePolicy>
+typename clevel_hash<Key, T, Hash, KeyEqual, HashPower, KVAllocator, ResizePolicy>::ret
+clevel_hash<Key, T, Hash, KeyEqual, HashPower, KVAllocator, ResizePolicy>::erase(
+	const key_type &key)
+{
+	pool_base pop = get_pool_base();
+	size_type thread_id = this_thread_slot();
+
+	hv_type hv = hasher{}(key);
+	partial_t partial = get_partial(hv);
+	bool succ_deletion = false;
+
+	// Offset of the entry retired by this erase.
+	uint64_t retired_off = 0;
+
+	// Entry deleted from a bucket being rehashed, which is retired once
+	// its copy is deleted, or after the retries if there is no copy.
+	KV_entry_ptr_t pending = nullptr;
+
+	wait_for_limbo(thread_id);
+	epoch_guard guard(this);
+
+	while(true)
+	{
+RETRY_ERASE:
+		const level_dir *d = get_level_dir();
+		level_meta_ptr_t m_copy(d->meta);
+
+		difference_type f_idx, s_idx;
+		uint32_t match, empty;
+		for (size_type i = 0; i < d->n_levels; i++)
+		{
+			const level_info &cl = d->levels[i];
+			f_idx = first_index(hv, cl);
+			s_idx = second_index(partial, f_idx, cl);
+
+			bucket &f_b = cl.buckets[f_idx];
+			match_bucket(f_b, partial, match, empty);
+			for (; match != 0; match &= match - 1)
+			{
+				size_type j = first_slot(match);
+				KV_entry_ptr_u tmp(f_b.slots[j].p.off);
+				if (tmp.x.partial == partial
+					&& tmp.p.get_offset() != 0)
+				{
+					if (key_equal{}(
+						tmp.p.get_address(my_pool_uuid, pool_addr)->first, key))
+					{
+						bool logged = log_retire(pop, thread_id, tmp.p);
+						if (CAS(&(f_b.slots[j].p.off), tmp.p.off, 0))
+						{
+							persist(pop, &(f_b.slots[j].p.off), sizeof(uint64_t));
+							succ_deletion = true;
+
+
+				// Instead of redoing the delete to guarantee the deletion is
+				// successful, we apply context checking to avoid unnecessary
+				// re-executions. The deletion fails only when the item to be
+				// deleted is copied by rehashing threads after checking and
+				// before deletion's CAS. Therefore, we can do context
+				// checking to avoid such failures.
+							if (!same_meta(m_copy) || (i == 0
+								&& f_idx < expand_bucket))
+							{
+								// The entry may have been copied by rehashing
+								// threads. Delete the copy once the bucket is
+								// rehashed.
+								if (logged)
+									cancel_retire(pop, thread_id);
+								if (pending.get_offset() == 0)
+									pending = tmp.p;
+								add_stat(STAT_CONTEXT_RETRIES);
+								wait_for_rehashed(f_idx);
+								goto RETRY_ERASE;
+							}
+
+							// Duplicated slots may refer to the same entry.
+							if (logged && tmp.p.get_offset() != retired_off)
+							{
+								commit_retire(thread_id);
+								retired_off = tmp.p.get_offset();
+							}
+							else if (logged)
+							{
+								cancel_retire(pop, thread_id);
+							}
+							if (tmp.p.get_offset() == pending.get_offset())
+								pending = nullptr;
+						}
+						else
+						{
+							add_stat(STAT_ERASE_CAS_FAILURES);
+							if (logged)
+								cancel_retire(pop, thread_id);
+							continue;
+						}
+					}
+				}
+			}
+
+			bucket &s_b = cl.buckets[s_idx];
+			match_bucket(s_b, partial, match, empty);
+			for (; match != 0; match &= match - 1)
+			{
+				size_type j = first_slot(match);
+				KV_entry_ptr_u tmp(s_b.slots[j].p.off);
+				if (tmp.x.partial == partial
+					&& tmp.p.get_offset() != 0)
+				{
+					if (key_equal{}(
+						tmp.p.get_address(my_pool_uuid, pool_addr)->first, key))
+					{
+						bool logged = log_retire(pop, thread_id, tmp.p);
+						if (CAS(&(s_b.slots[j].p.off), tmp.p.off, 0))
+						{
+							persist(pop, &(s_b.slots[j].p.off), sizeof(uint64_t));
+							succ_deletion = true;
+
+
+				// Instead of redoing the delete to guarantee the deletion is
+				// successful, we apply context checking to avoid unnecessary
+				// re-executions. The deletion fails only when the item to be
+				// deleted is copied by rehashing threads after checking and
+				// before deletion's CAS. Therefore, we can do context
+				// checking to avoid such failures.
+							if (!same_meta(m_copy) || (i == 0
+								&& s_idx < expand_bucket))
+							{
+								// The entry may have been copied by rehashing
+								// threads. Delete the copy once the bucket is
+								// rehashed.
+								if (logged)
+									cancel_retire(pop, thread_id);
+								if (pending.get_offset() == 0)
+									pending = tmp.p;
+								add_stat(STAT_CONTEXT_RETRIES);
+								wait_for_rehashed(s_idx);
+								goto RETRY_ERASE;
+							}
+
+							// Duplicated slots may refer to the same entry.
+							if (logged && tmp.p.get_offset() != retired_off)
+							{
+								commit_retire(thread_id);
+								retired_off = tmp.p.get_offset();
+							}
+							else if (logged)
+							{
+								cancel_retire(pop, thread_id);
+							}
+							if (tmp.p.get_offset() == pending.get_offset())
+								pending = nullptr;
+						}
+						else
+						{
+							add_stat(STAT_ERASE_CAS_FAILURES);
+							if (logged)
+								cancel_retire(pop, thread_id);
+							continue;
+						}
+					}
+				}
+			}		}
+
+		// Context checking.
+		if (same_meta(m_copy))
+		{
+			// The rehashing threads did not copy the pending entry.
+			if (pending.get_offset() != 0
+				&& log_retire(pop, thread_id, pending))
+				commit_retire(thread_id);
+
+			if (succ_deletion)
+				add_items(thread_id, -1);
+			return ret(succ_deletion);
+		}
+		add_stat(STAT_CONTEXT_RETRIES);
+	} // end while(true)
+
+}
+
+template <typename Key, typename T, typename Hash, typename KeyEqual,
+	size_t HashPower, typename KVAllocator, typename ResizePolicy>
+typename clevel_hash<Key, T, Hash, KeyEqual, HashPower, KVAllocator, ResizePolicy>::ret
+clevel_hash<Key, T, Hash, KeyEqual, HashPower, KVAllocator, ResizePolicy>::generic_update(
+	const key_type &key, const void *param,
+	void (clevel_hash::*allocate_KV)(pool_base &, size_type,
+		persistent_ptr<KV_entry> &, hv_type, const void *))
+{
+	pool_base pop = get_pool_base();
+	size_type thread_id = this_thread_slot();
+	persistent_ptr<KV_entry> &tmp_entry = get_thread_slot(thread_id).tmp_entry;
+
+	hv_type hv = hasher{}(key);
+	partial_t partial = get_partial(hv);
+
+	(this->*allocate_KV)(pop, thread_id, tmp_entry, hv, param);
+	KV_entry_ptr_u created(tmp_entry.raw().off);
+	created.x.partial = partial;
+
+	wait_for_limbo(thread_id);
+	epoch_guard guard(this);
+
+	bool succ_update = false;
+	while (true)
+	{
+		level_meta_ptr_t m_copy = load_meta(pop);
+
+		size_type n_levels;
+		uint64_t level_num = 0;
+		difference_type idx;
+		KV_entry_ptr_t *e, old_e;
+
+		f_code_t result = find(pop, key, hv, partial, n_levels,
+			old_e, &e, level_num, idx, /*fix_dup=*/true, thread_id, m_copy);
+
+		if (result == FOUND_IN_LEFT || result == FOUND_IN_RIGHT)
+		{
+			if (succ_update && old_e == created.p)
+			{
+				// The only item in table after update is the modified one,
+				// which indicates a successful update.
+				release_tmp_entry(pop, tmp_entry);
+				return ret(true);
+			}
+
+			bool logged = log_retire(pop, thread_id, old_e);
+			if (CAS(&(e->off), old_e.raw(), created.p.raw()))
+			{
+				persist(pop, &(e->off), sizeof(uint64_t));
+
+				// Instead of simply issuing another find to guarantee the
+				// update is successful, we apply context checking to avoid
+				// unnecessary second find. The update fails only when the
+				// item to be updated is copied by rehashing threads after
+				// find and before update's CAS. Therefore, we can do
+				// context checking to avoid such failure.
+				if (!same_meta(m_copy) || (level_num == 0 && idx < expand_bucket))
+				{
+					// The replaced entry may still be referred by its copy,
+					// which is retired when the copy is replaced.
+					if (logged)
+						cancel_retire(pop, thread_id);
+					add_stat(STAT_CONTEXT_RETRIES);
+					succ_update = true;
+					continue;
+				}
+				else
+				{
+					if (logged)
+						commit_retire(thread_id);
+					release_tmp_entry(pop, tmp_entry);
+					return ret(true);
 				}
 			}
-
-			if (result != ABSENT_AND_NO_VACANCY)
-				break;
-		}
-
-		// Context checking.
-		if (m_copy == meta)
-		{
-			return result;
+			else
+			{
+				add_stat(STAT_UPDATE_CAS_FAILURES);
+				if (logged)
+					cancel_retire(pop, thread_id);
+			}
 		}
 		else
 		{
-			m_copy = meta;
-			pop.persist(&(meta.off), sizeof(uint64_t));
+			if (!succ_update)
+			{
+				kv_allocator.deallocate(thread_id, tmp_entry);
+			}
+			else
+			{
+				release_tmp_entry(pop, tmp_entry);
+			}
+			// Even the updated item is deleted by other threads, our update
+			// succeeds anyway.
+			return ret(succ_update);
 		}
 	}
 }
 
+/**
+ * The update linearizes at the CAS on the value. Rehashing moves the
+ * pointers to KV entries rather than the entries, so the entry found is
+ * the one readers see wherever it is moved, and no context checking is
+ * needed. Duplicates are removed by find() first, like generic_update().
+ */
 template <typename Key, typename T, typename Hash, typename KeyEqual,
-	size_t HashPower>
-typename clevel_hash<Key, T, Hash, KeyEqual, HashPower>::f_code_t
-clevel_hash<Key, T, Hash, KeyEqual, HashPower>::find(
-	pool_base &pop, const key_type &key, partial_t partial,
-	size_type &n_levels, KV_entry_ptr_t &old_e, KV_entry_ptr_t **e,
-	uint64_t &level_num, difference_type &idx, bool fix_dup,
-	size_type thread_id, level_meta_ptr_t &m_copy)
+	size_t HashPower, typename KVAllocator, typename ResizePolicy>
+typename clevel_hash<Key, T, Hash, KeyEqual, HashPower, KVAllocator, ResizePolicy>::ret
+clevel_hash<Key, T, Hash, KeyEqual, HashPower, KVAllocator, ResizePolicy>::update_in_place(
+	const key_type &key, const mapped_type &value)
+{
+	pool_base pop = get_pool_base();
+	size_type thread_id = this_thread_slot();
+
+	hv_type hv = hasher{}(key);
+	partial_t partial = get_partial(hv);
+
+	wait_for_limbo(thread_id);
+	epoch_guard guard(this);
+
+	level_meta_ptr_t m_copy = load_meta(pop);
+
+	size_type n_levels;
+	uint64_t level_num = 0;
+	difference_type idx;
+	KV_entry_ptr_t *e, old_e;
+
+	f_code_t result = find(pop, key, hv, partial, n_levels, old_e, &e,
+		level_num, idx, /*fix_dup=*/true, thread_id, m_copy);
+	if (result != FOUND_IN_LEFT && result != FOUND_IN_RIGHT)
+		return ret(false);
+
+	// The entry is not reclaimed in the epoch even if it is erased
+	// meanwhile, in which case the update precedes the erase.
+	value_type *entry = old_e.get_address(my_pool_uuid, pool_addr);
+	mapped_type expected = entry->second;
+	while (!cas_mapped(pop, entry, expected, value))
+		add_stat(STAT_UPDATE_CAS_FAILURES);
+
+	return ret(true);
+}
+
+/**
+ * A single find() with fix_dup locates the item or a vacancy for it. A
+ * present item is updated in place if in_place_update, and otherwise
+ * replaced like generic_update(), by an entry computed from the one it
+ * replaces. An absent item is inserted like generic_insert(). A failed
+ * CAS retries from the find, recomputing the entry only if the item it
+ * was computed from has changed.
+ */
+template <typename Key, typename T, typename Hash, typename KeyEqual,
+	size_t HashPower, typename KVAllocator, typename ResizePolicy>
+template <typename Fn>
+typename clevel_hash<Key, T, Hash, KeyEqual, HashPower, KVAllocator, ResizePolicy>::ret
+clevel_hash<Key, T, Hash, KeyEqual, HashPower, KVAllocator, ResizePolicy>::compute(
+	const key_type &key, Fn fn)
 {
+	pool_base pop = get_pool_base();
+	size_type thread_id = this_thread_slot();
+	persistent_ptr<KV_entry> &tmp_entry = get_thread_slot(thread_id).tmp_entry;
+
 	hv_type hv = hasher{}(key);
+	partial_t partial = get_partial(hv);
+
+	// The entry allocated for the item, if any, and the entry whose value
+	// it was computed from, which is null for an insert.
+	bool has_created = false;
+	KV_entry_ptr_u created;
+	KV_entry_ptr_t base;
+
+	auto make_created = [&](KV_entry_ptr_t from, const mapped_type *old) {
+		if (has_created)
+			kv_allocator.deallocate(thread_id, tmp_entry);
+
+		value_type v(key, fn(old));
+		allocate_KV_move_construct(pop, thread_id, tmp_entry, hv, &v);
+		created.p = KV_entry_ptr_t(tmp_entry.raw().off);
+		created.x.partial = partial;
+		has_created = true;
+		base = from;
+	};
+
+	wait_for_limbo(thread_id);
+	epoch_guard guard(this);
+
+	bool expanded_flag = false;
+	bool check_duplicate = true;
+	// Set once created has replaced base, which a copy made by rehashing
+	// may still refer to.
+	bool replaced = false;
 
 	while (true)
 	{
-RETRY_FIND:
-		level_meta *m = static_cast<level_meta *>(m_copy(my_pool_uuid));
-		*e = nullptr;
-
-		level_ptr_t levels[MAX_LEVEL];
-		difference_type f_idx, s_idx;
-		KV_entry_ptr_t f_e, s_e;
-		uint64_t slot_idx;
+		level_meta_ptr_t m_copy = load_meta(pop);
 
+		size_type n_levels;
+		uint64_t level_num = 0;
+		difference_type idx;
+		KV_entry_ptr_t *e, old_e;
 		f_code_t result;
-		KV_entry_ptr_t prev_e;
-		size_type prev_i;
-
-		n_levels = 0;
-		level_ptr_t li = nullptr, next_li = m->last_level;
-		do
+		if (check_duplicate)
+		{
+			result = find(pop, key, hv, partial, n_levels,
+				old_e, &e, level_num, idx, /*fix_dup=*/true, thread_id, m_copy);
+		}
+		else
 		{
-			li = next_li;
-			levels[n_levels] = li;
-			n_levels++;
-			next_li = li.get_address(my_pool_uuid)->up;
-		} while(li != m->first_level);
+			result = find_empty_slot(pop, hv, partial, n_levels,
+				&e, level_num, m_copy);
+		}
 
-		level_bucket *cl;
-		result = ABSENT_AND_NO_VACANCY;
+		level_meta *m = static_cast<level_meta *>(m_copy(my_pool_uuid, pool_addr));
 
-		// Bottom-to-top search.
-		for (size_type i = 0; i < n_levels; i++)
+		if (result == FOUND_IN_LEFT || result == FOUND_IN_RIGHT)
 		{
-			cl = levels[i].get_address(my_pool_uuid);
-			f_idx = first_index(hv, cl->capacity);
-			s_idx = second_index(partial, f_idx, cl->capacity);
+			if (replaced)
+			{
+				// Done unless the copy of base is found, and even if
+				// the item was updated by others since.
+				if (old_e.get_offset() != base.get_offset())
+				{
+					release_tmp_entry(pop, tmp_entry);
+					return ret(true);
+				}
+			}
+			else
+			{
+				value_type *cur = old_e.get_address(my_pool_uuid, pool_addr);
+				if (compute_in_place(pop, cur, fn,
+					std::integral_constant<bool, in_place_update>()))
+				{
+					if (has_created)
+						kv_allocator.deallocate(thread_id, tmp_entry);
+					return ret(true);
+				}
 
-			// flag used to skip vacant slots after finding an empty slot
-			// in a bucket.
-			bool found_empty_in_b = false;
-			bucket &f_b = cl->buckets[f_idx];
-			for (size_type j = 0; j < assoc_num; j++)
+				if (!has_created || base.get_offset() != old_e.get_offset())
+					make_created(old_e, &cur->second);
+			}
+
+			bool logged = log_retire(pop, thread_id, old_e);
+			if (CAS(&(e->off), old_e.raw(), created.p.raw()))
 			{
-				f_e = f_b.slots[j].p;
-				if (f_e.get_offset() == 0)
+				persist(pop, &(e->off), sizeof(uint64_t));
+
+				// See the context checking of generic_update().
+				if (!same_meta(m_copy) || (level_num == 0 && idx < expand_bucket))
 				{
-					// Since empty slots in top levels are preferred, update
-					// vacancy info as long as identical keys are not found.
-					if (result != FOUND_IN_LEFT && result != FOUND_IN_RIGHT &&
-						!found_empty_in_b)
-					{
-						found_empty_in_b = true;
-
-						result = VACANCY_IN_LEFT;
-						old_e = f_e;
-						*e = &(f_b.slots[j].p);
-						level_num = i;
-						idx = f_idx;
-						slot_idx = j;
-					}
+					if (logged)
+						cancel_retire(pop, thread_id);
+					add_stat(STAT_CONTEXT_RETRIES);
+					replaced = true;
 					continue;
 				}
 
-				if (f_b.slots[j].x.partial != partial || !key_equal{}(
-					f_e.get_address(my_pool_uuid)->first, key))
-					continue;
+				if (logged)
+					commit_retire(thread_id);
+				release_tmp_entry(pop, tmp_entry);
+				return ret(true);
+			}
 
-				if (!fix_dup)
-				{
-					result = FOUND_IN_LEFT;
-					level_num = i;
-					idx = f_idx;
-					slot_idx = j;
+			add_stat(STAT_UPDATE_CAS_FAILURES);
+			if (logged)
+				cancel_retire(pop, thread_id);
+			continue;
+		}
 
-					return result;
-				}
+		// The replaced item has been erased by others since.
+		if (replaced)
+		{
+			release_tmp_entry(pop, tmp_entry);
+			return ret(true);
+		}
 
-				if (result == FOUND_IN_LEFT || result == FOUND_IN_RIGHT)
+		if ((result == VACANCY_IN_LEFT || result == VACANCY_IN_RIGHT) &&
+			(level_num > 0 || !m->is_resizing))
+		{
+			if (!has_created || base.get_offset() != 0)
+				make_created(nullptr, nullptr);
+
+			if (CAS(&(e->off), old_e.raw(), created.p.raw()))
+			{
+				if (!m->is_resizing && meta(my_pool_uuid, pool_addr)->is_resizing &&
+					level_num == 0)
 				{
-					// Refer to the same location
-					if (f_e.get_offset() == prev_e.get_offset())
-					{
-						// Duplication due to the re-insertion in normal
-						// executions or os scheduling during a rehashing
-						// operation. In this case, delete the pointer in
-						// bottom level.
-						if (prev_i < i)
-						{
-							del_dup(pop, &f_b.slots[j], &(levels[level_num]
-								.get_address(my_pool_uuid)->buckets[idx]
-								.slots[slot_idx]), f_e, prev_e);
-						}
-						else
-						{
-							// Never fires!
-							assert(false);
-						}
-					}
-					// Refer to different locations
-					else
-					{
-						// Duplication due to the re-insertion after a crash
-						// or concurrent insertions of same key. To fix the
-						// duplication, simply delete the previous item.
-						del_dup(pop, &f_b.slots[j], &(levels[level_num]
-							.get_address(my_pool_uuid)->buckets[idx]
-							.slots[slot_idx]), f_e, prev_e);
-					}
-					goto RETRY_FIND;
+					// See generic_insert(): redo the insertion, whose
+					// possible duplicate is fixed by later finds.
+					check_duplicate = false;
+					add_stat(STAT_INSERT_RETRIES);
+					continue;
 				}
-				else
-				{
-					result = FOUND_IN_LEFT;
-					old_e = f_e;
-					*e = &(f_b.slots[j].p);
-					level_num = i;
-					idx = f_idx;
-					slot_idx = j;
 
-					prev_e = f_e;
-					prev_i = i;
-				} // end if result in FOUND_IN_LEFT or FOUND_IN_RIGHT
-			} // end for j, f_idx, f_b
+				persist(pop, &(e->off), sizeof(uint64_t));
+				add_items(thread_id, 1);
+				release_tmp_entry(pop, tmp_entry);
+				return ret(expanded_flag, 0);
+			}
+			add_stat(STAT_INSERT_CAS_FAILURES);
+			add_stat(STAT_INSERT_RETRIES);
+			continue;
+		}
 
-			found_empty_in_b = false;
-			bucket &s_b = cl->buckets[s_idx];
-			for (size_type j = 0; j < assoc_num; j++)
+		expanded_flag = true;
+		if (!expand(pop, thread_id, m_copy))
+		{
+			// The value of created may be computed from an entry
+			// that is freed once the epoch is left.
+			if (has_created)
 			{
-				s_e = s_b.slots[j].p;
-				if (s_e.get_offset() == 0)
-				{
-					// Since empty slots in top levels are preferred, update
-					// vacancy info as long as identical keys are not found.
-					if (result != FOUND_IN_LEFT && result != FOUND_IN_RIGHT &&
-						!found_empty_in_b)
-					{
-						found_empty_in_b = true;
+				kv_allocator.deallocate(thread_id, tmp_entry);
+				has_created = false;
+			}
+			guard.renew();
+		}
+	}
+}
 
-						// We prefer the less loaded bucket
-						if (result == VACANCY_IN_LEFT && level_num == i &&
-							slot_idx <= j)
-							continue;
+/**
+ * Expand the table for an insert or an update, using the buffers of the
+ * thread slot.
+ * @returns false if the table has insert_max_levels levels, in which case
+ * the caller should retry once rehashing has retired the last level.
+ */
+template <typename Key, typename T, typename Hash, typename KeyEqual,
+	size_t HashPower, typename KVAllocator, typename ResizePolicy>
+bool
+clevel_hash<Key, T, Hash, KeyEqual, HashPower, KVAllocator, ResizePolicy>::expand(
+	pool_base &pop, size_type thread_id, level_meta_ptr_t m_copy,
+	size_type new_capacity)
+{
+	if (level_count() >= insert_max_levels)
+	{
+		std::this_thread::yield();
+		return false;
+	}
 
-						result = VACANCY_IN_RIGHT;
-						old_e = s_e;
-						*e = &(s_b.slots[j].p);
-						level_num = i;
-						idx = s_idx;
-						slot_idx = j;
-					}
-					continue;
-				}
+	thread_slot &slot = get_thread_slot(thread_id);
+	return expand(pop, thread_id, slot.tmp_level, slot.tmp_meta, m_copy,
+		new_capacity);
+}
 
-				if (s_b.slots[j].x.partial != partial || !key_equal{}(
-					s_e.get_address(my_pool_uuid)->first, key))
-					continue;
+/**
+ * Append a level above the first level of m_copy, unless one has been
+ * appended already, and promote it.
+ * @returns false if the table has MAX_LEVEL levels, which the level
+ * directory is limited to.
+ */
+template <typename Key, typename T, typename Hash, typename KeyEqual,
+	size_t HashPower, typename KVAllocator, typename ResizePolicy>
+bool
+clevel_hash<Key, T, Hash, KeyEqual, HashPower, KVAllocator, ResizePolicy>::expand(
+	pool_base &pop, size_type thread_id,
+	persistent_ptr<level_bucket> &t_level,
+	persistent_ptr<level_meta> &t_meta, level_meta_ptr_t m_copy,
+	size_type new_capacity)
+{
+	level_meta *m = static_cast<level_meta *>(m_copy(my_pool_uuid, pool_addr));
+	level_bucket *cl = m->first_level.get_address(my_pool_uuid, pool_addr);
 
-				if (!fix_dup)
-				{
-					result = FOUND_IN_RIGHT;
-					level_num = i;
-					idx = s_idx;
-					slot_idx = j;
+	if (cl->up == nullptr)
+	{
+		if (level_count() >= MAX_LEVEL)
+		{
+			std::this_thread::yield();
+			return false;
+		}
 
-					return result;
-				}
+		if (new_capacity == 0)
+			new_capacity = new_level_capacity(cl->capacity);
 
-				if (result == FOUND_IN_LEFT || result == FOUND_IN_RIGHT)
-				{
-					// Refer to the same location
-					if (s_e.get_offset() == prev_e.get_offset())
-					{
-						// Duplication due to the re-insertion in normal
-						// executions or os scheduling during a rehashing
-						// operation. In this case, delete the pointer in
-						// bottom level.
-						if (prev_i < i)
-						{
-							del_dup(pop, &s_b.slots[j], &(levels[level_num]
-								.get_address(my_pool_uuid)->buckets[idx]
-								.slots[slot_idx]), s_e, prev_e);
-						}
-						else
-						{
-							// Never fires!
-							assert(false);
-						}
-					}
-					// Refer to different locations
-					else
-					{
-						// Duplication due to the re-insertion after a crash
-						// or concurrent insertions of same key. To fix the
-						// duplication, simply delete the previous item.
-						del_dup(pop, &s_b.slots[j], &(levels[level_num]
-							.get_address(my_pool_uuid)->buckets[idx]
-							.slots[slot_idx]), s_e, prev_e);
-					}
-					goto RETRY_FIND;
-				}
-				else
-				{
-					result = FOUND_IN_RIGHT;
-					old_e = s_e;
-					*e = &(s_b.slots[j].p);
-					level_num = i;
-					idx = s_idx;
-					slot_idx = j;
+		if (!link_prepared_level(pop, cl, new_capacity))
+		{
+#ifdef CLEVEL_DEBUG
+			std::cout << "Thread-" << thread_id << " starts expanding for "
+				<< new_capacity << " buckets" << std::endl;
+#endif
+			make_level(pop, t_level, new_capacity);
+
+			// Append a new level.
+			bool rc = CAS(&(cl->up.off), 0, t_level.raw().off);
+
+			if (rc == false)
+			{
+				// Ohter threads finished expanding
+				persist(pop, &(cl->up.off), sizeof(uint64_t));
+
+				delete_persistent_atomic<bucket[]>(
+					t_level->buckets, new_capacity);
+
+				delete_persistent_atomic<level_bucket>(t_level);
+			}
+			else
+			{
+				// The level is freed by retire_level() once rehashed,
+				// so the buffer must not keep it.
+				persist(pop, &(cl->up.off), sizeof(uint64_t));
+				t_level = nullptr;
+				persist(pop, t_level);
+			}
+		}
+	}
+
+	// Ohter threads may have finished expanding
+	persist(pop, &(cl->up.off), sizeof(uint64_t));
+
+	if (promote_level(pop, cl, t_meta, m_copy))
+	{
+		std::cout << "Thread-" << thread_id
+			<< " finishes expanding, capacity: "
+			<< capacity() << std::endl;
+	}
+
+	return true;
+}
+
+/**
+ * Make the level linked above cl the first level in the metadata and
+ * set is_resizing, unless the first level is no longer cl. Levels are
+ * fully built before they are linked, so any thread may promote them.
+ * @returns true if this thread updated the metadata.
+ */
+template <typename Key, typename T, typename Hash, typename KeyEqual,
+	size_t HashPower, typename KVAllocator, typename ResizePolicy>
+bool
+clevel_hash<Key, T, Hash, KeyEqual, HashPower, KVAllocator, ResizePolicy>::promote_level(
+	pool_base &pop, level_bucket *cl, persistent_ptr<level_meta> &t_meta,
+	level_meta_ptr_t m_copy)
+{
+	assert(cl->up != nullptr);
+
+	while (true)
+	{
+		level_meta *m = static_cast<level_meta *>(m_copy(my_pool_uuid, pool_addr));
 
-					prev_e = s_e;
-					prev_i = i;
-				} // end if result in FOUND_IN_LEFT or FOUND_IN_RIGHT
-			} // end for j, s_idx, s_b
+		// Other threads promoted the level, or completed rehashing and
+		// moved on.
+		if (m->first_level.get_address(my_pool_uuid, pool_addr) != cl)
+			return false;
 
-		} // end for i, n_levels; end for first round
+		make_persistent_atomic<level_meta>(pop, t_meta,
+			cl->up, m->last_level, true);
 
-		// Context checking.
-		if (m_copy == meta)
-		{
-			return result;
-		}
-		else
+		if (install_meta(pop, m_copy, t_meta.raw().off))
 		{
-			m_copy = meta;
-			pop.persist(&(meta.off), sizeof(uint64_t));
+			add_stat(STAT_EXPANSIONS);
+			return true;
 		}
-	} // end while
+
+		delete_persistent_atomic<level_meta>(t_meta);
+		m_copy = load_meta(pop);
+	}
 }
 
+/**
+ * Allocate an empty level of capacity buckets into level atomically.
+ */
 template <typename Key, typename T, typename Hash, typename KeyEqual,
-	size_t HashPower>
-typename clevel_hash<Key, T, Hash, KeyEqual, HashPower>::ret
-clevel_hash<Key, T, Hash, KeyEqual, HashPower>::generic_insert(
-	const key_type &key, const void *param,
-	void (*allocate_KV)(pool_base &, persistent_ptr<value_type> &,
-		const void *),
-	size_type thread_id, size_type id)
+	size_t HashPower, typename KVAllocator, typename ResizePolicy>
+void
+clevel_hash<Key, T, Hash, KeyEqual, HashPower, KVAllocator, ResizePolicy>::make_level(
+	pool_base &pop, persistent_ptr<level_bucket> &level, size_type capacity)
 {
-	pool_base pop = get_pool_base();
+	make_persistent_atomic<level_bucket>(pop, level);
+	make_persistent_atomic<bucket[]>(pop, level->buckets, capacity);
+
+	persist(pop, level->buckets);
+	level->capacity = capacity;
+	persist(pop, level->capacity);
+	level->up = nullptr;
+	persist(pop, &(level->up.off), sizeof(uint64_t));
+}
 
-	hv_type hv = hasher{}(key);
-	partial_t partial = get_partial(hv);
+template <typename Key, typename T, typename Hash, typename KeyEqual,
+	size_t HashPower, typename KVAllocator, typename ResizePolicy>
+void
+clevel_hash<Key, T, Hash, KeyEqual, HashPower, KVAllocator, ResizePolicy>::runtime_initialize()
+{
+	pool_base pop = get_pool_base();
 
-	difference_type t_id = static_cast<difference_type>(thread_id);
-	allocate_KV(pop, tmp_entry[t_id], param);
-	KV_entry_ptr_u created(tmp_entry[t_id].raw().off);
-	created.x.partial = partial;
+	// The pool may be mapped at a different address in this run.
+	pool_addr = get_pool_addr();
+
+	// Volatile members hold garbage from the previous run.
+	new (&expand_thread) std::thread();
+	new (&rehash_threads) std::vector<std::thread>();
+	new (&rehash_round) std::atomic<uint64_t>(0);
+	new (&rehash_active) std::atomic<size_type>(0);
+	new (&rehash_busy) std::atomic<size_type>(0);
+	new (&active_scans) std::atomic<size_type>(0);
+	new (&global_epoch) std::atomic<uint64_t>(0);
+	new (&stripes) std::unique_ptr<epoch_stripe[]>(
+		new epoch_stripe[epoch_stripes]());
+	new (&reclaim_thread) std::thread();
+	new (&run_reclaim_thread) std::atomic<bool>(false);
+	new (&level_directory) std::atomic<const level_dir *>(nullptr);
+	new (&dir_version) std::atomic<uint64_t>(0);
+	new (&dir_mutex) std::mutex();
+	new (&level_dirs) std::vector<std::unique_ptr<level_dir>>();
+	new (&prepared_level) std::atomic<uint64_t>(0);
+	new (&item_counts) std::unique_ptr<item_stripe[]>();
+	new (&expand_watermark) std::atomic<double>(default_expand_watermark);
+	new (&slot_registry) std::shared_ptr<thread_slot_registry>(
+		std::make_shared<thread_slot_registry>());
+	slot_registry_id = slot_registry->id();
+	new (&slot_mutex) std::mutex();
+	kv_allocator.runtime_initialize(thread_num);
+#ifdef CLEVEL_STATS
+	new (&stats_counts) std::unique_ptr<stats_stripe[]>(
+		new stats_stripe[epoch_stripes]());
+#endif
 
-	bool expanded_flag = false;
-	uint64_t initial_capacity = 0;
-	bool check_duplicate = true;
+	// A crash may leave meta marked dirty, which is meaningless now.
+	if (meta.raw() & meta_dirty)
+	{
+		meta.off &= ~meta_dirty;
+		persist(pop, &(meta.off), sizeof(uint64_t));
+	}
 
 #ifdef CLEVEL_DEBUG
-	uint64_t retry_insert_cnt = 0;
-	thread_logs[thread_id] << "Thread-" << thread_id << " starts inserting "
-		<< key << std::endl;
-#endif
-
-#ifdef DEBUG_RESIZING
-	initial_capacity = capacity();
+	new (&thread_logs) segmented_array<std::fstream, thread_slot_base,
+		thread_slot_segments>();
+	open_thread_logs(thread_num);
 #endif
 
-	while (true)
 	{
-RETRY_INSERT:
-#ifdef CLEVEL_DEBUG
-        retry_insert_cnt ++;
-        if (retry_insert_cnt > 10)
-        {
-            thread_logs[thread_id] << "Thread-" << thread_id
-				<< " [loop] retry_insert_cnt = " << retry_insert_cnt
-				<< ", key = " << key << std::endl;
-        }
-        else if (retry_insert_cnt > 1)
-        {
-            thread_logs[thread_id] << "Thread-" << thread_id
-				<< " retry_insert_cnt = " << retry_insert_cnt
-				<< ", key = " << key << std::endl;
-        }
-#endif
-		level_meta_ptr_t m_copy(meta);
-		pop.persist(&(meta.off), sizeof(uint64_t));
+		transaction::manual tx(pop);
 
-		size_type n_levels;
-		uint64_t level_num = 0;
-		difference_type idx;
-		KV_entry_ptr_t *e, old_e;
-		f_code_t result;
-		if (check_duplicate)
+		// Leases of the previous run are gone, and the slots are
+		// leased again from scratch.
+		reclaim_tmp_buffers();
+		recover_limbos();
+
+		// A prepared level is freed rather than reused, since the table
+		// may have expanded without it.
+		if (next_level != nullptr)
 		{
-			result = find(pop, key, partial, n_levels,
-				old_e, &e, level_num, idx, /*fix_dup=*/false, thread_id, m_copy);
+			if (is_reachable(next_level))
+				next_level = nullptr;
+			else
+				free_next_level();
 		}
-		else
+
+		// Levels of a bulk_load() that was interrupted before linking
+		// them are freed, so the partial load is discarded.
+		persistent_ptr<level_bucket> *bulk_levels[] = {&bulk_bottom, &bulk_top};
+		for (persistent_ptr<level_bucket> *l : bulk_levels)
 		{
-			result = find_empty_slot(pop, key, partial, n_levels,
-				&e, level_num, m_copy);
+			if (*l == nullptr)
+				continue;
+
+			if (is_reachable(*l))
+				*l = nullptr;
+			else
+				free_bulk_level(*l);
 		}
 
+		transaction::commit();
+	}
 
-		level_meta *m = static_cast<level_meta *>(m_copy(my_pool_uuid));
+	// Levels linked above the first level, by an expansion or a
+	// bulk_load(), are promoted before rehashing resumes.
+	while (true)
+	{
+		level_meta_ptr_t m_copy = load_meta(pop);
+		level_meta *m = static_cast<level_meta *>(m_copy(my_pool_uuid, pool_addr));
+		level_bucket *cl = m->first_level.get_address(my_pool_uuid, pool_addr);
+		if (cl->up == nullptr)
+			break;
 
-		if (result == FOUND_IN_LEFT || result == FOUND_IN_RIGHT)
-		{
-			delete_persistent_atomic<value_type>(tmp_entry[t_id]);
-			return ret(level_num, 0, 0);
-		}
-		else if ((result == VACANCY_IN_LEFT || result == VACANCY_IN_RIGHT) &&
-			(level_num > 0 || !m->is_resizing))
-		{
-			if (CAS(&(e->off), old_e.raw(), created.p.raw()))
-			{
-				if (!m->is_resizing && meta(my_pool_uuid)->is_resizing &&
-					level_num == 0)
-				{
-					// Resizing may occur during the insert. Hence, redo the
-					// insertion to avoid missing the new item. The possible
-					// duplication will be fixed in future updates and deletes.
-					pop.persist(&(meta.off), sizeof(uint64_t));
-					check_duplicate = false;
-					goto RETRY_INSERT;
-				}
-				else
-				{
-					pop.persist(&(e->off), sizeof(uint64_t));
+		promote_level(pop, cl, rehash_workers[0].tmp_meta, m_copy);
+	}
 
-					return ret(expanded_flag, initial_capacity);
-				}
+	// Resumed rehashing leases a thread slot for its limbo list, and
+	// may expand the table, which reads the item counts.
+	slot_registry->grow(thread_num);
+	reset_item_counts(0);
 
-			}
-			else
-			{
+	recover_rehash(pop);
+	recover_KV_allocator();
+
+	if (ResizePolicy::count_items)
+		reset_item_counts(static_cast<size_type>(
+			estimate_load_factor() * capacity()));
+
+	start_rehash_threads();
+	start_reclaim_thread();
+}
+
+/**
+ * Add a segment to the thread slot table, unless another thread grew it
+ * since it had capacity slots. The slots are allocated in a transaction
+ * together with the new thread_num, and the per-slot state of this run
+ * is set up before the registry leases them.
+ */
+template <typename Key, typename T, typename Hash, typename KeyEqual,
+	size_t HashPower, typename KVAllocator, typename ResizePolicy>
+void
+clevel_hash<Key, T, Hash, KeyEqual, HashPower, KVAllocator, ResizePolicy>::grow_thread_slots(
+	size_type capacity)
+{
+	std::lock_guard<std::mutex> lock(slot_mutex);
+	if (slot_registry->capacity() != capacity)
+		return;
+
+	size_type index;
+	size_type k = slot_layout::segment(thread_num, index);
+	assert(index == 0 && k < thread_slot_segments);
+
+	pool_base pop = get_pool_base();
+	transaction::run(pop, [&] {
+		thread_slots[k] =
+			make_persistent<thread_slot[]>(slot_layout::size(k));
+		thread_num = slot_layout::capacity(k + 1);
+	});
+
+	kv_allocator.set_thread_num(thread_num);
 #ifdef CLEVEL_DEBUG
-				std::cout << "insertion, cas fails, n_levels: " << n_levels
-					  << std::endl;
+	open_thread_logs(thread_num);
 #endif
-				goto RETRY_INSERT;
-			}
-		}
+	slot_registry->grow(thread_num);
+}
 
-		// start expanding
-		expanded_flag = true;
-		expand(pop, thread_id, m_copy);
-	} // end while(true)
+/**
+ * Set up the item counts, starting from items. Not thread safe.
+ */
+template <typename Key, typename T, typename Hash, typename KeyEqual,
+	size_t HashPower, typename KVAllocator, typename ResizePolicy>
+void
+clevel_hash<Key, T, Hash, KeyEqual, HashPower, KVAllocator, ResizePolicy>::reset_item_counts(
+	size_type items)
+{
+	item_counts.reset(new item_stripe[item_stripes]());
+	item_counts[0].cnt.store(static_cast<difference_type>(items));
+}
+
+/**
+ * Append the prepared level above cl if it has new_capacity buckets.
+ * @returns false if no such level is ready.
+ */
+template <typename Key, typename T, typename Hash, typename KeyEqual,
+	size_t HashPower, typename KVAllocator, typename ResizePolicy>
+bool
+clevel_hash<Key, T, Hash, KeyEqual, HashPower, KVAllocator, ResizePolicy>::link_prepared_level(
+	pool_base &pop, level_bucket *cl, size_type new_capacity)
+{
+	uint64_t off = prepared_level.load();
+	if (off == 0 || off == level_claimed ||
+		level_ptr_t(off).get_address(my_pool_uuid, pool_addr)->capacity !=
+		new_capacity)
+		return false;
+
+	if (!prepared_level.compare_exchange_strong(off, level_claimed))
+		return false;
+
+	// next_level stays owned until it is linked, so a crash in between
+	// frees it at recovery.
+	bool rc = CAS(&(cl->up.off), 0, off);
+	persist(pop, &(cl->up.off), sizeof(uint64_t));
+
+	if (rc)
+	{
+		next_level = nullptr;
+		persist(pop, next_level);
+	}
+	else
+	{
+		delete_persistent_atomic<bucket[]>(next_level->buckets,
+			new_capacity);
+		delete_persistent_atomic<level_bucket>(next_level);
+	}
+
+	prepared_level.store(0);
+	return rc;
 }
 
+/**
+ * Allocate the level of the next expansion ahead of time once the load
+ * factor reaches expand_watermark, or free a prepared level that the
+ * table has outgrown. Called by the expand thread while no resizing is
+ * in progress.
+ */
 template <typename Key, typename T, typename Hash, typename KeyEqual,
-	size_t HashPower>
-typename clevel_hash<Key, T, Hash, KeyEqual, HashPower>::ret
-clevel_hash<Key, T, Hash, KeyEqual, HashPower>::erase(
-	const key_type &key, size_type thread_id)
+	size_t HashPower, typename KVAllocator, typename ResizePolicy>
+void
+clevel_hash<Key, T, Hash, KeyEqual, HashPower, KVAllocator, ResizePolicy>::prepare_level(
+	pool_base &pop, level_meta *m)
 {
-	pool_base pop = get_pool_base();
+	uint64_t off = prepared_level.load();
+	if (off == level_claimed)
+		return;
 
-	hv_type hv = hasher{}(key);
-	partial_t partial = get_partial(hv);
-	difference_type expand_bucket_old;
-	bool succ_deletion = false;
+	level_bucket *cl = m->first_level.get_address(my_pool_uuid, pool_addr);
+	size_type new_capacity = new_level_capacity(cl->capacity);
 
-	while(true)
+	if (off != 0)
 	{
-		level_meta_ptr_t m_copy(meta);
-		level_meta *m = static_cast<level_meta *>(m_copy(my_pool_uuid));
+		// An expansion may claim and free next_level meanwhile, so the
+		// capacity is read through the offset, as link_prepared_level()
+		// does.
+		if (level_ptr_t(off).get_address(my_pool_uuid, pool_addr)->capacity ==
+			new_capacity)
+			return;
+
+		// The table expanded without the prepared level.
+		if (!prepared_level.compare_exchange_strong(off, level_claimed))
+			return;
+
+		delete_persistent_atomic<bucket[]>(next_level->buckets,
+			next_level->capacity);
+		delete_persistent_atomic<level_bucket>(next_level);
+		prepared_level.store(0);
+	}
 
-		difference_type f_idx, s_idx;
-		size_type i = 0;
-		level_ptr_t li = nullptr, next_li = m->last_level;
-		do
-		{
-			li = next_li;
-			level_bucket *cl = li.get_address(my_pool_uuid);
-			f_idx = first_index(hv, cl->capacity);
-			s_idx = second_index(partial, f_idx, cl->capacity);
+	double watermark = expand_watermark.load();
+	if (watermark <= 0 || cl->up != nullptr)
+		return;
 
-			bucket &f_b = cl->buckets[f_idx];
-			for (size_type j = 0; j < assoc_num; j++)
-			{
-				KV_entry_ptr_u tmp(f_b.slots[j].p.off);
-				if (tmp.x.partial == partial
-					&& tmp.p.get_offset() != 0)
-				{
-					if (key_equal{}(
-						tmp.p.get_address(my_pool_uuid)->first, key))
-					{
-						if (CAS(&(f_b.slots[j].p.off), tmp.p.off, 0))
-						{
-							pop.persist(&(f_b.slots[j].p.off), sizeof(uint64_t));
-							succ_deletion = true;
+	double load_factor = estimate_load_factor();
+	if (load_factor < watermark)
+		return;
 
-							PMEMoid oid = tmp.p.raw_ptr(my_pool_uuid);
-							pmemobj_free(&oid);
+#ifdef CLEVEL_DEBUG
+	std::cout << "Expand thread prepares a level of " << new_capacity
+		<< " buckets at load factor " << load_factor << std::endl;
+#endif
 
+	make_level(pop, next_level, new_capacity);
 
-				// Instead of redoing the delete to guarantee the deletion is
-				// successful, we apply context checking to avoid unnecessary
-				// re-executions. The deletion fails only when the item to be
-				// deleted is copied by rehashing threads after checking and
-				// before deletion's CAS. Therefore, we can do context
-				// checking to avoid such failures.
-							if (m_copy != meta || (i == 0
-								&& f_idx <= expand_bucket
-								&& f_idx >= expand_bucket_old))
-							{
-								continue;
-							}
-						}
-						else
-						{
-							continue;
-						}
-					}
-				}
-			}
+	prepared_level.store(next_level.raw().off);
+}
+
+/**
+ * Free next_level, which may be partially allocated. Should be called in
+ * a transaction.
+ */
+template <typename Key, typename T, typename Hash, typename KeyEqual,
+	size_t HashPower, typename KVAllocator, typename ResizePolicy>
+void
+clevel_hash<Key, T, Hash, KeyEqual, HashPower, KVAllocator, ResizePolicy>::free_next_level()
+{
+	next_level->clear();
+	delete_persistent<level_bucket>(next_level);
+	next_level = nullptr;
+}
 
-			bucket &s_b = cl->buckets[s_idx];
+/**
+ * Free a level of an interrupted bulk_load() with its entries, which may
+ * be partially allocated. Should be called in a transaction.
+ */
+template <typename Key, typename T, typename Hash, typename KeyEqual,
+	size_t HashPower, typename KVAllocator, typename ResizePolicy>
+void
+clevel_hash<Key, T, Hash, KeyEqual, HashPower, KVAllocator, ResizePolicy>::free_bulk_level(
+	persistent_ptr<level_bucket> &level)
+{
+	// Allocators recovering by scan reclaim the entries by themselves.
+	if (!KVAllocator::recover_by_scan && level->buckets != nullptr)
+	{
+		for (size_type i = 0; i < level->capacity; i++)
+		{
+			bucket &b = level->buckets[static_cast<difference_type>(i)];
 			for (size_type j = 0; j < assoc_num; j++)
 			{
-				KV_entry_ptr_u tmp(s_b.slots[j].p.off);
-				if (tmp.x.partial == partial
-					&& tmp.p.get_offset() != 0)
-				{
-					if (key_equal{}(
-						tmp.p.get_address(my_pool_uuid)->first, key))
-					{
-						if (CAS(&(s_b.slots[j].p.off), tmp.p.off, 0))
-						{
-							pop.persist(&(s_b.slots[j].p.off), sizeof(uint64_t));
-							succ_deletion = true;
+				if (b.slots[j].p.get_offset() == 0)
+					continue;
 
-							PMEMoid oid = tmp.p.raw_ptr(my_pool_uuid);
-							pmemobj_free(&oid);
+				persistent_ptr<KV_entry> e(PMEMoid{my_pool_uuid,
+					b.slots[j].p.get_offset()});
+				delete_persistent<KV_entry>(e);
+			}
+		}
+	}
 
+	level->clear();
+	delete_persistent<level_bucket>(level);
+	level = nullptr;
+}
 
-				// Instead of redoing the delete to guarantee the deletion is
-				// successful, we apply context checking to avoid unnecessary
-				// re-executions. The deletion fails only when the item to be
-				// deleted is copied by rehashing threads after checking and
-				// before deletion's CAS. Therefore, we can do context
-				// checking to avoid such failures.
-							if (m_copy != meta || (i == 0
-								&& s_idx <= expand_bucket
-								&& s_idx >= expand_bucket_old))
-							{
-								continue;
-							}
-						}
-						else
-						{
-							continue;
-						}
-					}
-				}
+/**
+ * Estimate the load factor of the table from up to load_samples buckets
+ * of each level.
+ */
+template <typename Key, typename T, typename Hash, typename KeyEqual,
+	size_t HashPower, typename KVAllocator, typename ResizePolicy>
+double
+clevel_hash<Key, T, Hash, KeyEqual, HashPower, KVAllocator, ResizePolicy>::estimate_load_factor() const
+{
+	static thread_local std::minstd_rand rng(std::random_device{}());
+
+	// Replaced level directories are freed after two epochs.
+	epoch_guard guard(this);
+	const level_dir *d = get_level_dir();
+	double items = 0;
+	double slots = 0;
+	for (size_type i = 0; i < d->n_levels; i++)
+	{
+		const level_info &cl = d->levels[i];
+		size_type capacity = static_cast<size_type>(cl.capacity);
+		size_type samples =
+			capacity < load_samples ? capacity : load_samples;
+
+		// Buckets are drawn independently, since evenly spaced ones
+		// alias with the regular bucket pattern that sequential keys
+		// produce under multiplicative hashing.
+		size_type occupied = 0;
+		for (size_type k = 0; k < samples; k++)
+		{
+			bucket &b = cl.buckets[static_cast<size_type>(rng()) &
+				(capacity - 1)];
+			for (size_type j = 0; j < assoc_num; j++)
+			{
+				if (b.slots[j].p.get_offset() != 0)
+					occupied++;
 			}
-			next_li = cl->up;
-			i++;
-		}while(li != m->first_level);
+		}
+
+		items += static_cast<double>(occupied) * capacity / samples;
+		slots += static_cast<double>(capacity * assoc_num);
+	}
+
+	return items / slots;
+}
+
+template <typename Key, typename T, typename Hash, typename KeyEqual,
+	size_t HashPower, typename KVAllocator, typename ResizePolicy>
+void
+clevel_hash<Key, T, Hash, KeyEqual, HashPower, KVAllocator, ResizePolicy>::start_rehash_threads()
+{
+	run_expand_thread.get_rw().store(true);
+	rehash_round.store(0);
+	rehash_active.store(0);
+
+	expand_thread = std::thread(&clevel_hash::resize, this);
+	for (size_type i = 1; i < rehash_thread_num; i++)
+		rehash_threads.emplace_back(&clevel_hash::rehash, this, i);
+}
+
+/**
+ * Finish the ranges that rehashing workers claimed but did not complete
+ * before a crash. Rehashing a bucket twice is harmless, since moved items
+ * are cleared from the last level. Not thread safe.
+ */
+template <typename Key, typename T, typename Hash, typename KeyEqual,
+	size_t HashPower, typename KVAllocator, typename ResizePolicy>
+void
+clevel_hash<Key, T, Hash, KeyEqual, HashPower, KVAllocator, ResizePolicy>::recover_rehash(
+	pool_base &pop)
+{
+	level_meta *m = static_cast<level_meta *>(meta(my_pool_uuid, pool_addr));
+
+	// The progress refers to a retired level, i.e., we crashed after
+	// updating meta and before resetting expand_bucket. Resizing of the
+	// current last level will start from scratch.
+	if (expand_level != m->last_level.raw())
+		return;
+
+	size_type n_levels = 1;
+	for (auto li = m->last_level; li != m->first_level;
+	    li = li.get_address(my_pool_uuid, pool_addr)->up)
+		n_levels++;
 
-		// Context checking.
-		if (m_copy == meta)
-			return ret(succ_deletion);
-	} // end while(true)
+	if (n_levels == 2)
+		return;
+
+	level_bucket *bl = m->last_level.get_address(my_pool_uuid, pool_addr);
+	difference_type capacity = static_cast<difference_type>(bl->capacity);
+	size_type thread_id = this_thread_slot();
+	for (size_type i = 0; i < rehash_thread_num; i++)
+	{
+		rehash_worker &w = rehash_workers[static_cast<difference_type>(i)];
+		if (w.begin >= w.end)
+			continue;
+
+#ifdef CLEVEL_DEBUG
+		std::cout << "Worker-" << i << " resumes rehashing buckets ["
+			<< w.begin << ", " << w.end << ")" << std::endl;
+#endif
+		for (difference_type idx = w.begin; idx < w.end && idx < capacity;
+			idx++)
+		{
+			rehash_bucket(pop, i, thread_id, bl, idx);
 
+			w.begin.get_rw() = idx + 1;
+			persist(pop, w.begin);
+		}
+	}
 }
 
+/**
+ * Free the scratch buffers of operations that were interrupted before
+ * their results were linked into the table. Buffers of completed
+ * operations are reachable from the table and only forgotten. Should be
+ * called in a transaction with no concurrent operations.
+ */
 template <typename Key, typename T, typename Hash, typename KeyEqual,
-	size_t HashPower>
-typename clevel_hash<Key, T, Hash, KeyEqual, HashPower>::ret
-clevel_hash<Key, T, Hash, KeyEqual, HashPower>::generic_update(
-	const key_type &key, const void *param,
-	void (*allocate_KV)(pool_base&, persistent_ptr<value_type>&, const void*),
-	size_type thread_id)
+	size_t HashPower, typename KVAllocator, typename ResizePolicy>
+void
+clevel_hash<Key, T, Hash, KeyEqual, HashPower, KVAllocator, ResizePolicy>::reclaim_tmp_buffers()
 {
-	pool_base pop = get_pool_base();
+	for (size_type i = 0; i < thread_num; i++)
+	{
+		thread_slot &slot = get_thread_slot(i);
+		if (!KVAllocator::recover_by_scan && slot.tmp_entry != nullptr
+			&& !is_reachable(slot.tmp_entry))
+			delete_persistent<KV_entry>(slot.tmp_entry);
+		slot.tmp_entry = nullptr;
 
-	hv_type hv = hasher{}(key);
-	partial_t partial = get_partial(hv);
+		if (slot.tmp_level != nullptr && !is_reachable(slot.tmp_level))
+		{
+			slot.tmp_level->clear();
+			delete_persistent<level_bucket>(slot.tmp_level);
+		}
+		slot.tmp_level = nullptr;
 
-	difference_type t_id = static_cast<difference_type>(thread_id);
-	allocate_KV(pop, tmp_entry[t_id], param);
-	KV_entry_ptr_u created(tmp_entry[t_id].raw().off);
-	created.x.partial = partial;
+		if (slot.tmp_meta != nullptr &&
+			slot.tmp_meta.raw().off != meta.get_offset())
+			delete_persistent<level_meta>(slot.tmp_meta);
+		slot.tmp_meta = nullptr;
+	}
 
-	difference_type expand_bucket_old;
-	bool succ_update = false;
-	while (true)
+	for (size_type i = 0; i < rehash_thread_num; i++)
 	{
-		level_meta_ptr_t m_copy(meta);
-		pop.persist(&(meta.off), sizeof(uint64_t));
+		rehash_worker &w = rehash_workers[static_cast<difference_type>(i)];
+		if (w.tmp_level != nullptr && !is_reachable(w.tmp_level))
+		{
+			w.tmp_level->clear();
+			delete_persistent<level_bucket>(w.tmp_level);
+		}
+		w.tmp_level = nullptr;
 
-		size_type n_levels;
-		uint64_t level_num = 0;
-		difference_type idx;
-		KV_entry_ptr_t *e, old_e;
+		if (w.tmp_meta != nullptr &&
+			w.tmp_meta.raw().off != meta.get_offset())
+			delete_persistent<level_meta>(w.tmp_meta);
+		w.tmp_meta = nullptr;
+	}
+}
 
-		expand_bucket_old = expand_bucket;
-		f_code_t result = find(pop, key, partial, n_levels,
-			old_e, &e, level_num, idx, /*fix_dup=*/true, thread_id, m_copy);
+template <typename Key, typename T, typename Hash, typename KeyEqual,
+	size_t HashPower, typename KVAllocator, typename ResizePolicy>
+bool
+clevel_hash<Key, T, Hash, KeyEqual, HashPower, KVAllocator, ResizePolicy>::is_reachable(
+	const persistent_ptr<KV_entry> &kv)
+{
+	hv_type hv = get_hash(reinterpret_cast<const value_type *>(kv.get()));
+	partial_t partial = get_partial(hv);
+	level_meta *m = static_cast<level_meta *>(meta(my_pool_uuid, pool_addr));
 
-		if (result == FOUND_IN_LEFT || result == FOUND_IN_RIGHT)
+	// Levels appended by an unfinished expansion are not in meta yet,
+	// and the levels of an interrupted bulk_load() are freed with their
+	// entries.
+	level_ptr_t roots[] = {m->last_level, level_ptr_t(bulk_bottom.raw().off)};
+	for (level_ptr_t root : roots)
+	{
+		for (level_ptr_t li = root; li != nullptr;
+			li = li.get_address(my_pool_uuid, pool_addr)->up)
 		{
-			if (succ_update && old_e == created.p)
-			{
-				// The only item in table after update is the modified one,
-				// which indicates a successful update.
-				return ret(true);
-			}
-			else if (CAS(&(e->off), old_e.raw(), created.p.raw()))
-			{
-				pop.persist(&(e->off), sizeof(uint64_t));
+			level_bucket *cl = li.get_address(my_pool_uuid, pool_addr);
+			if (cl->buckets == nullptr)
+				continue;
 
-				// Instead of simply issuing another find to guarantee the
-				// update is successful, we apply context checking to avoid
-				// unnecessary second find. The update fails only when the
-				// item to be updated is copied by rehashing threads after
-				// find and before update's CAS. Therefore, we can do
-				// context checking to avoid such failure.
-				if (m_copy != meta || (level_num == 0 && idx <= expand_bucket
-					&& idx >= expand_bucket_old))
-				{
-					succ_update = true;
-					continue;
-				}
-				else
-					return ret(true);
-			}
-		}
-		else
-		{
-			if (!succ_update)
+			difference_type f_idx = first_index(hv, cl->capacity);
+			difference_type s_idx =
+				second_index(partial, f_idx, cl->capacity);
+			for (size_type j = 0; j < assoc_num; j++)
 			{
-				delete_persistent_atomic<value_type>(tmp_entry[t_id]);
+				if (cl->buckets[f_idx].slots[j].p.get_offset() ==
+					kv.raw().off ||
+					cl->buckets[s_idx].slots[j].p.get_offset() ==
+					kv.raw().off)
+					return true;
 			}
-			// Even the updated item is deleted by other threads, our update
-			// succeeds anyway.
-			return ret(succ_update);
 		}
 	}
+
+	return false;
+}
+
+template <typename Key, typename T, typename Hash, typename KeyEqual,
+	size_t HashPower, typename KVAllocator, typename ResizePolicy>
+bool
+clevel_hash<Key, T, Hash, KeyEqual, HashPower, KVAllocator, ResizePolicy>::is_reachable(
+	const persistent_ptr<level_bucket> &level)
+{
+	level_meta *m = static_cast<level_meta *>(meta(my_pool_uuid, pool_addr));
+
+	for (level_ptr_t li = m->last_level; li != nullptr;
+		li = li.get_address(my_pool_uuid, pool_addr)->up)
+	{
+		if (li.get_offset() == level.raw().off)
+			return true;
+	}
+
+	return false;
 }
 
 template <typename Key, typename T, typename Hash, typename KeyEqual,
-	size_t HashPower>
+	size_t HashPower, typename KVAllocator, typename ResizePolicy>
 void
-clevel_hash<Key, T, Hash, KeyEqual, HashPower>::expand(
-	pool_base &pop, size_type thread_id, level_meta_ptr_t m_copy
-)
+clevel_hash<Key, T, Hash, KeyEqual, HashPower, KVAllocator, ResizePolicy>::resize()
 {
-	level_meta *m = static_cast<level_meta *>(m_copy(my_pool_uuid));
-	difference_type t_id = static_cast<difference_type>(thread_id);
-	level_bucket *cl = m->first_level.get_address(my_pool_uuid);
+	pool_base pop = get_pool_base();
+	rehash_worker &w = rehash_workers[0];
+	size_type low_load_rounds = 0;
 
-	if (cl->up == nullptr)
+	while (run_expand_thread.get_ro().load())
 	{
-		make_persistent_atomic<level_bucket>(pop, tmp_level[t_id]);
-		size_type new_capacity = cl->capacity * 2;
-		std::cout << "Thread-" << thread_id << " starts expanding for "
-			<< new_capacity << " buckets" << std::endl;
+		level_meta_ptr_t m_copy = load_meta(pop);
+
+		level_meta *m = static_cast<level_meta *>(m_copy(my_pool_uuid, pool_addr));
 
-		make_persistent_atomic<bucket[]>(
-			pop, tmp_level[t_id]->buckets, new_capacity);
+		size_type n_levels = 1;
+		if (m != nullptr)
+		{
+			for (auto li = m->last_level; li != m->first_level;
+			    li = li.get_address(my_pool_uuid, pool_addr)->up)
+				n_levels++;
+		}
 
-		pop.persist(tmp_level[t_id]->buckets);
-		tmp_level[t_id]->capacity = new_capacity;
-		pop.persist(tmp_level[t_id]->capacity);
-		tmp_level[t_id]->up = nullptr;
-		pop.persist(&(tmp_level[t_id]->up.off), sizeof(uint64_t));
+		if (m != nullptr && n_levels == 2 && ResizePolicy::count_items)
+		{
+			size_type items = item_count();
+			size_type slots = capacity(m_copy);
+			if (resize_policy.should_expand(items, slots))
+			{
+#ifdef CLEVEL_DEBUG
+				std::cout << "Expand thread expands at load factor "
+					<< static_cast<double>(items) / slots << std::endl;
+#endif
+				expand(pop, 0, w.tmp_level, w.tmp_meta, m_copy);
+				low_load_rounds = 0;
+				continue;
+			}
 
-		// Append a new level.
-		bool rc = CAS(&(cl->up.off), 0, tmp_level[t_id].raw().off);
+			if (resize_policy.should_shrink(items, slots))
+				low_load_rounds++;
+			else
+				low_load_rounds = 0;
+		}
 
-		if (rc == false)
+		if (m != nullptr && n_levels == 2)
 		{
-			// Ohter threads finished expanding
-			pop.persist(&(cl->up.off), sizeof(uint64_t));
+			// Halve the table: levels of x and 2x buckets become x/2 and
+			// x by appending a level of x/2 above them and rehashing x,
+			// then appending a level of x and rehashing 2x. Items only
+			// move up, as in an expansion, so searches stay correct. A
+			// top level smaller than the bottom one means the second
+			// step is due.
+			level_bucket *tl = m->first_level.get_address(my_pool_uuid, pool_addr);
+			level_bucket *bl = m->last_level.get_address(my_pool_uuid, pool_addr);
+			bool shrinking = tl->capacity < bl->capacity;
+			if (shrinking || (low_load_rounds >= shrink_rounds &&
+				bl->capacity >= (size_type(1) << hashpower)))
+			{
+#ifdef CLEVEL_DEBUG
+				std::cout << "Expand thread shrinks with a level of "
+					<< bl->capacity / 2 << " buckets" << std::endl;
+#endif
+				expand(pop, 0, w.tmp_level, w.tmp_meta, m_copy,
+					bl->capacity / 2);
+				low_load_rounds = 0;
+				continue;
+			}
+		}
 
-			delete_persistent_atomic<bucket[]>(
-				tmp_level[t_id]->buckets, new_capacity);
+		if (m == nullptr || n_levels == 2)
+		{
+			if (m != nullptr)
+				prepare_level(pop, m);
+			usleep(10000);
+			continue;
+		}
 
-			delete_persistent_atomic<level_bucket>(tmp_level[t_id]);
+		if (expand_level != m->last_level.raw())
+		{
+			expand_bucket.get_rw() = 0;
+			persist(pop, expand_bucket);
+			expand_level.get_rw() = m->last_level.raw();
+			persist(pop, expand_level);
 		}
 
-		pop.persist(&(cl->up.off), sizeof(uint64_t));
+		// Start a new round for the last level. This thread acts as
+		// worker 0 and the others join via rehash().
+		level_bucket *bl = m->last_level.get_address(my_pool_uuid, pool_addr);
+		rehash_active.store(rehash_thread_num);
+		rehash_round.fetch_add(1);
+
+		rehash_level(pop, 0);
+
+		// A worker that sees the shutdown before the new round never
+		// joins it, so the wait ends on shutdown too. Workers also stop
+		// early then, so the last level may not be fully rehashed.
+		rehash_active.fetch_sub(1);
+		while (rehash_active.load() != 0 &&
+			run_expand_thread.get_ro().load())
+			std::this_thread::yield();
+
+		if (!run_expand_thread.get_ro().load())
+			break;
+
+		assert(static_cast<size_type>(expand_bucket) >= bl->capacity);
+
+		// Keep the drained level in tmp_level, so that recovery frees it
+		// if it becomes unreachable before retire_level() does.
+		w.tmp_level = persistent_ptr<level_bucket>(pmemobj_oid(bl));
+		persist(pop, w.tmp_level);
 
-		// Update the first_level and is_resizing in the metadata.
 		while (true)
 		{
-			if (cl->capacity >= new_capacity)
-			{
-				// Help updating meta
-				make_persistent_atomic<level_meta>(pop, tmp_meta[t_id],
-					m->first_level, m->last_level, true);
-			}
-			else
+			m_copy = load_meta(pop);
+			m = static_cast<level_meta *>(m_copy(my_pool_uuid, pool_addr));
+
+			level_ptr_t li = m->last_level;
+			size_t levels_left = 0;
+			while (li != m->first_level)
 			{
-				assert(cl->up != nullptr);
-				make_persistent_atomic<level_meta>(pop, tmp_meta[t_id],
-					cl->up, m->last_level, true);
+				levels_left++;
+				li = li.get_address(my_pool_uuid, pool_addr)->up;
 			}
+			make_persistent_atomic<level_meta>(pop, w.tmp_meta,
+				m->first_level, bl->up, levels_left != 2);
 
-			if (CAS(&(meta.off), m_copy.off, tmp_meta[t_id].raw().off))
+			if (install_meta(pop, m_copy, w.tmp_meta.raw().off))
 			{
-				pop.persist(&(meta.off), sizeof(uint64_t));
+				std::cout << "Expand thread updates metadata, "
+					<< "is_resizing: " << bool(levels_left != 2)
+					<<  " levels_left: " << levels_left
+					<< std::endl;
 
-				std::cout << "Thread-" << thread_id
-					<< " finishes expanding, capacity: "
-					<< capacity() << std::endl;
+				expand_bucket.get_rw() = 0;
+				persist(pop, expand_bucket);
 				break;
 			}
 			else
 			{
-				m_copy = level_meta_ptr_t(meta);
-				m = static_cast<level_meta *>(m_copy(my_pool_uuid));
-				cl = m->first_level.get_address(my_pool_uuid);
-
-				if (cl->capacity >= new_capacity && m->is_resizing)
-				{
-					// CAS fails because other threads help updating meta
-					delete_persistent_atomic<level_meta>(tmp_meta[t_id]);
-					break;
-				}
-				// CAS fails because other threads complete rehashing.
+				delete_persistent_atomic<level_meta>(w.tmp_meta);
 			}
 		}
-	}
-	else
-	{
-		// Ohter threads finished expanding
-		pop.persist(&(cl->up.off), sizeof(uint64_t));
 
-		if (meta == m_copy)
-		{
-			size_type new_capacity = cl->capacity;
+		retire_level(w.tmp_level);
+	} // end while(run_expand_thread)
 
-			// Update the first_level and is_resizing in the metadata.
-			while (true)
-			{
-				// Help updating meta
-				if (cl->capacity >= new_capacity)
-				{
-					make_persistent_atomic<level_meta>(pop, tmp_meta[t_id],
-						m->first_level, m->last_level, true);
-				}
-				else
-				{
-					assert(cl->up != nullptr);
-					make_persistent_atomic<level_meta>(pop, tmp_meta[t_id],
-						cl->up, m->last_level, true);
-				}
+	std::cout << "expand_thread exits" << std::endl;
+}
 
-				if (CAS(&(meta.off), m_copy.off, tmp_meta[t_id].raw().off))
-				{
-					pop.persist(&(meta.off), sizeof(uint64_t));
+/**
+ * Free a level removed from the metadata once no operation can still
+ * see it, i.e. two epochs later. On shutdown the level is left to
+ * reclaim_tmp_buffers() at the next open.
+ */
+template <typename Key, typename T, typename Hash, typename KeyEqual,
+	size_t HashPower, typename KVAllocator, typename ResizePolicy>
+void
+clevel_hash<Key, T, Hash, KeyEqual, HashPower, KVAllocator, ResizePolicy>::retire_level(
+	persistent_ptr<level_bucket> &level)
+{
+	uint64_t epoch = global_epoch.load();
+	while (global_epoch.load() < epoch + 2)
+	{
+		if (!run_expand_thread.get_ro().load())
+			return;
+		usleep(reclaim_interval);
+	}
 
-					std::cout << "Thread-" << thread_id
-						<< " finishes expanding, capacity: "
-						<< capacity() << std::endl;
-					break;
-				}
-				else
-				{
-					m_copy = level_meta_ptr_t(meta);
-					m = static_cast<level_meta *>(m_copy(my_pool_uuid));
-					cl = m->first_level.get_address(my_pool_uuid);
+	delete_persistent_atomic<bucket[]>(level->buckets, level->capacity);
+	delete_persistent_atomic<level_bucket>(level);
+}
 
-					if (cl->capacity >= new_capacity && m->is_resizing)
-					{
-						// CAS fails because other threads help updating meta
-						delete_persistent_atomic<level_meta>(tmp_meta[t_id]);
-						break;
-					}
-					// CAS fails because other threads complete rehashing.
-				}
-			}
+template <typename Key, typename T, typename Hash, typename KeyEqual,
+	size_t HashPower, typename KVAllocator, typename ResizePolicy>
+void
+clevel_hash<Key, T, Hash, KeyEqual, HashPower, KVAllocator, ResizePolicy>::rehash(size_type worker_id)
+{
+	pool_base pop = get_pool_base();
+	uint64_t round = 0;
+
+	while (run_expand_thread.get_ro().load())
+	{
+		if (rehash_round.load() == round)
+		{
+			usleep(1000);
+			continue;
 		}
+
+		round++;
+		rehash_level(pop, worker_id);
+		rehash_active.fetch_sub(1);
 	}
 }
 
+/**
+ * Claim ranges of the last level from expand_bucket and rehash them until
+ * the level is exhausted.
+ */
 template <typename Key, typename T, typename Hash, typename KeyEqual,
-	size_t HashPower>
+	size_t HashPower, typename KVAllocator, typename ResizePolicy>
 void
-clevel_hash<Key, T, Hash, KeyEqual, HashPower>::resize()
+clevel_hash<Key, T, Hash, KeyEqual, HashPower, KVAllocator, ResizePolicy>::rehash_level(
+	pool_base &pop, size_type worker_id)
 {
-	size_type thread_id = 0;
-	difference_type t_id = static_cast<difference_type>(thread_id);
-	pool_base pop = get_pool_base();
+	rehash_worker &w =
+		rehash_workers[static_cast<difference_type>(worker_id)];
+	size_type thread_id = this_thread_slot();
+
+	// The last level only changes when expand_thread finishes a round.
+	level_meta *m = static_cast<level_meta *>(meta(my_pool_uuid, pool_addr));
+	level_bucket *bl = m->last_level.get_address(my_pool_uuid, pool_addr);
+	difference_type capacity = static_cast<difference_type>(bl->capacity);
 
 	while (run_expand_thread.get_ro().load())
 	{
-		level_meta_ptr_t m_copy(meta);
-		pop.persist(&(meta.off), sizeof(uint64_t));
-
-		level_meta *m = static_cast<level_meta *>(m_copy(my_pool_uuid));
+		// Scans see no item move, so wait for them between ranges. The
+		// scans in turn wait for the ranges in progress (see
+		// enter_scan()).
+		rehash_busy.fetch_add(1);
+		if (active_scans.load() != 0)
+		{
+			rehash_busy.fetch_sub(1);
+			usleep(1000);
+			continue;
+		}
 
-		size_type n_levels = 1;
-		if (m != nullptr)
+		difference_type begin = expand_bucket.get_ro();
+		if (begin >= capacity)
 		{
-			for (auto li = m->last_level; li != m->first_level;
-			    li = li.get_address(my_pool_uuid)->up)
-				n_levels++;
+			rehash_busy.fetch_sub(1);
+			break;
 		}
 
-		if (m == nullptr || n_levels == 2)
+		difference_type end = std::min(begin +
+			static_cast<difference_type>(resize_bulk), capacity);
+
+		// Persist the range before claiming it, so that recovery can
+		// find it if we crash before finishing.
+		w.begin.get_rw() = begin;
+		w.end.get_rw() = end;
+		persist(pop, &(w.begin), 2 * sizeof(difference_type));
+
+		if (!CAS(&(expand_bucket.get_rw()), begin, end))
 		{
-			usleep(10000);
+			// Erases wait for the buckets in the range (see
+			// wait_for_rehashed()), so withdraw it.
+			w.end.get_rw() = begin;
+			persist(pop, w.end);
+			rehash_busy.fetch_sub(1);
 			continue;
 		}
+		persist(pop, expand_bucket);
 
-		for (size_type ii = 0; ii < resize_bulk; ii++)
+#ifdef CLEVEL_STATS
+		auto start = std::chrono::steady_clock::now();
+#endif
+		for (difference_type idx = begin; idx < end; idx++)
 		{
-RETRY_REHASH:
-			m_copy = level_meta_ptr_t(meta);
-			pop.persist(&(meta.off), sizeof(uint64_t));
+			rehash_bucket(pop, worker_id, thread_id, bl, idx);
 
-			m = static_cast<level_meta *>(m_copy(my_pool_uuid));
-			level_bucket *bl = m->last_level.get_address(my_pool_uuid);
-			level_bucket *tl = m->first_level.get_address(my_pool_uuid);
+			w.begin.get_rw() = idx + 1;
+			persist(pop, w.begin);
+		}
+#ifdef CLEVEL_STATS
+		add_stat(STAT_REHASH_NS, static_cast<uint64_t>(
+			std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now() - start).count()));
+#endif
 
-			bucket &b = bl->buckets[expand_bucket.get_ro()];
-			for (size_type slot_idx = 0; slot_idx < assoc_num; slot_idx++)
-			{
-				KV_entry_ptr_t src_tmp = b.slots[slot_idx].p;
-				value_type *e = src_tmp.get_address(my_pool_uuid);
-				if (e == nullptr)
-					continue;
+		rehash_busy.fetch_sub(1);
+	}
+}
 
-				difference_type f_idx, s_idx;
-				bool succ = false;
-				hv_type hv = hasher{}(e->first);
-				partial_t partial = get_partial(hv);
-				f_idx = first_index(hv, tl->capacity);
-				s_idx = second_index(partial, f_idx, tl->capacity);
+/**
+ * Move the items of the bucket idx of the last level bl to the first
+ * level, with the limbo list of the thread slot thread_id for the stale
+ * copies that the move retires.
+ */
+template <typename Key, typename T, typename Hash, typename KeyEqual,
+	size_t HashPower, typename KVAllocator, typename ResizePolicy>
+void
+clevel_hash<Key, T, Hash, KeyEqual, HashPower, KVAllocator, ResizePolicy>::rehash_bucket(
+	pool_base &pop, size_type worker_id, size_type thread_id,
+	level_bucket *bl, difference_type idx)
+{
+	while (!try_rehash_bucket(pop, worker_id, thread_id, bl, idx))
+		wait_for_limbo(thread_id);
+}
 
-				bucket &dst_b1 = tl->buckets[f_idx];
-				bucket &dst_b2 = tl->buckets[s_idx];
-				for (size_type j = 0; j < assoc_num; j++)
-				{
-					// The rehashed item is inserted into the less-loaded
-					// bucket between the two candidata buckets in the new
-					// level.
-					KV_entry_ptr_t dst_tmp = dst_b1.slots[j].p;
-					if (dst_tmp.get_offset() == 0)
-					{
-						if (CAS(&(dst_b1.slots[j].p.off),
-							dst_tmp.raw(), src_tmp.raw()))
-						{
-							pop.persist(&(dst_b1.slots[j].p.off),
-								sizeof(uint64_t));
+/**
+ * Move the items of a bucket as rehash_bucket() does, each with room in
+ * the limbo list to retire a stale copy.
+ * @returns false if the limbo list is full, which is waited for outside
+ * the epoch before moving the remaining items.
+ */
+template <typename Key, typename T, typename Hash, typename KeyEqual,
+	size_t HashPower, typename KVAllocator, typename ResizePolicy>
+bool
+clevel_hash<Key, T, Hash, KeyEqual, HashPower, KVAllocator, ResizePolicy>::try_rehash_bucket(
+	pool_base &pop, size_type worker_id, size_type thread_id,
+	level_bucket *bl, difference_type idx)
+{
+	rehash_worker &w =
+		rehash_workers[static_cast<difference_type>(worker_id)];
+	limbo_list &l = get_thread_slot(thread_id).limbo;
 
-							b.slots[slot_idx].p = nullptr;
-							pop.persist(&(b.slots[slot_idx].p.off),
-								sizeof(uint64_t));
-							succ = true;
-							break;
-						}
-					}
+	epoch_guard guard(this);
 
-					dst_tmp = dst_b2.slots[j].p;
-					if (dst_tmp.get_offset() == 0)
-					{
-						if (CAS(&(dst_b2.slots[j].p.off),
-							dst_tmp.raw(), src_tmp.raw()))
-						{
-							pop.persist(&(dst_b2.slots[j].p.off),
-								sizeof(uint64_t));
+RETRY_REHASH:
+	level_meta_ptr_t m_copy = load_meta(pop);
 
-							b.slots[slot_idx].p = nullptr;
-							pop.persist(&(b.slots[slot_idx].p.off),
-								sizeof(uint64_t));
-							succ = true;
-							break;
-						}
-					}
-				} // end for
+	level_meta *m = static_cast<level_meta *>(m_copy(my_pool_uuid, pool_addr));
+	level_bucket *tl = m->first_level.get_address(my_pool_uuid, pool_addr);
 
-				if (!succ)
-				{
-					std::cout << "expand during resizing!" << std::endl;
-					expand(pop, thread_id, m_copy);
-					goto RETRY_REHASH;
-				}
-			} // end for (slot_idx)
+	bucket &b = bl->buckets[idx];
+	for (size_type slot_idx = 0; slot_idx < assoc_num; slot_idx++)
+	{
+		KV_entry_ptr_t src_tmp = b.slots[slot_idx].p;
+		value_type *e = src_tmp.get_address(my_pool_uuid, pool_addr);
+		if (e == nullptr)
+			continue;
+
+		if (l.tail.load() - l.head.load() >= limbo_size)
+			return false;
 
-			expand_bucket = expand_bucket + 1;
-			pop.persist(expand_bucket);
-			if (static_cast<size_type>(expand_bucket) == bl->capacity)
+		difference_type f_idx, s_idx;
+		bool succ = false;
+		hv_type hv = get_hash(e);
+		partial_t partial = get_partial(hv);
+		f_idx = first_index(hv, tl->capacity);
+		s_idx = second_index(partial, f_idx, tl->capacity);
+
+		bucket &dst_b1 = tl->buckets[f_idx];
+		bucket &dst_b2 = tl->buckets[s_idx];
+		for (size_type j = 0; j < assoc_num; j++)
+		{
+			// The rehashed item is inserted into the less-loaded
+			// bucket between the two candidata buckets in the new
+			// level.
+			KV_entry_ptr_t dst_tmp = dst_b1.slots[j].p;
+			if (dst_tmp.get_offset() == 0)
 			{
-				bool rc = false;
-				while (true)
+				if (CAS(&(dst_b1.slots[j].p.off),
+					dst_tmp.raw(), src_tmp.raw()))
 				{
-					level_ptr_t li = m->last_level;
-					size_t levels_left = 0;
-					while (li != m->first_level)
+					persist(pop, &(dst_b1.slots[j].p.off),
+						sizeof(uint64_t));
+
+					// An erase, update or del_dup() may have changed
+					// the source since it was read.
+					if (!CAS(&(b.slots[slot_idx].p.off),
+						src_tmp.raw(), 0))
 					{
-						levels_left++;
-						li = li.get_address(my_pool_uuid)->up;
+						add_stat(STAT_REHASH_CAS_FAILURES);
+						if (!keep_rehash_copy(pop, thread_id,
+							b.slots[slot_idx].p,
+							dst_b1.slots[j].p, src_tmp))
+							goto RETRY_REHASH;
 					}
-					make_persistent_atomic<level_meta>(pop, tmp_meta[t_id],
-						m->first_level, bl->up, levels_left != 2);
-
-					if (CAS(&(meta.off), m_copy.off, tmp_meta[t_id].raw().off))
+					else
 					{
-						std::cout << "Expand thread updates metadata, "
-							<< "is_resizing: " << bool(levels_left != 2)
-							<<  " levels_left: " << levels_left
-							<< std::endl;
-						pop.persist(&(meta.off), sizeof(uint64_t));
+						persist(pop, &(b.slots[slot_idx].p.off),
+							sizeof(uint64_t));
+					}
+					succ = true;
+					break;
+				}
+				add_stat(STAT_REHASH_CAS_FAILURES);
+			}
 
-						expand_bucket.get_rw() = 0;
-						pop.persist(expand_bucket);
+			dst_tmp = dst_b2.slots[j].p;
+			if (dst_tmp.get_offset() == 0)
+			{
+				if (CAS(&(dst_b2.slots[j].p.off),
+					dst_tmp.raw(), src_tmp.raw()))
+				{
+					persist(pop, &(dst_b2.slots[j].p.off),
+						sizeof(uint64_t));
 
-						rc = true;
-						break;
+					// An erase, update or del_dup() may have changed
+					// the source since it was read.
+					if (!CAS(&(b.slots[slot_idx].p.off),
+						src_tmp.raw(), 0))
+					{
+						add_stat(STAT_REHASH_CAS_FAILURES);
+						if (!keep_rehash_copy(pop, thread_id,
+							b.slots[slot_idx].p,
+							dst_b2.slots[j].p, src_tmp))
+							goto RETRY_REHASH;
 					}
 					else
 					{
-						delete_persistent_atomic<level_meta>(tmp_meta[t_id]);
-						m_copy = level_meta_ptr_t(meta);
-						pop.persist(&(meta.off), sizeof(uint64_t));
-						m = static_cast<level_meta *>(m_copy(my_pool_uuid));
+						persist(pop, &(b.slots[slot_idx].p.off),
+							sizeof(uint64_t));
 					}
-				}
-
-				if (rc)
+					succ = true;
 					break;
+				}
+				add_stat(STAT_REHASH_CAS_FAILURES);
 			}
-		} // end for (ii)
-	} // end while(run_expand_thread)
+		} // end for
 
-	std::cout << "expand_thread exits" << std::endl;
+		if (!succ)
+		{
+			std::cout << "expand during resizing!" << std::endl;
+			expand(pop, worker_id, w.tmp_level, w.tmp_meta, m_copy);
+			goto RETRY_REHASH;
+		}
+		add_stat(STAT_REHASHED_ITEMS);
+	} // end for (slot_idx)
+
+	return true;
+}
+
+/**
+ * Settle the copy src_tmp of a source slot src in dst after the rehashing
+ * CAS on src failed. A source cleared by an erase or by del_dup() leaves
+ * the copy as the only reference to the entry: del_dup() found both, and
+ * the erase retries until it deletes the copy. A source replaced by an
+ * update makes the copy stale, so the copy is taken back and retired,
+ * since the update leaves the retirement to whoever deletes the copy.
+ * @returns true if the copy is kept.
+ */
+template <typename Key, typename T, typename Hash, typename KeyEqual,
+	size_t HashPower, typename KVAllocator, typename ResizePolicy>
+bool
+clevel_hash<Key, T, Hash, KeyEqual, HashPower, KVAllocator, ResizePolicy>::keep_rehash_copy(
+	pool_base &pop, size_type thread_id, KV_entry_ptr_t &src,
+	KV_entry_ptr_t &dst, KV_entry_ptr_t src_tmp)
+{
+	KV_entry_ptr_t cur = src;
+	if (cur.get_offset() == 0)
+		return true;
+
+	// try_rehash_bucket() checked that the limbo list has room.
+	bool logged = log_retire(pop, thread_id, src_tmp);
+	assert(logged);
+	(void)logged;
+
+	if (CAS(&(dst.off), src_tmp.raw(), 0))
+	{
+		persist(pop, &(dst.off), sizeof(uint64_t));
+		commit_retire(thread_id);
+	}
+	else
+	{
+		cancel_retire(pop, thread_id);
+	}
+
+	return false;
+}
+
+/**
+ * Wait until no rehashing thread works on the bucket idx of the last
+ * level, so that the copies of its items are visible.
+ */
+template <typename Key, typename T, typename Hash, typename KeyEqual,
+	size_t HashPower, typename KVAllocator, typename ResizePolicy>
+void
+clevel_hash<Key, T, Hash, KeyEqual, HashPower, KVAllocator, ResizePolicy>::wait_for_rehashed(
+	difference_type idx)
+{
+	for (size_type i = 0; i < rehash_thread_num; i++)
+	{
+		rehash_worker &w = rehash_workers[static_cast<difference_type>(i)];
+		while (run_expand_thread.get_ro().load()
+			&& w.begin.get_ro() <= idx && idx < w.end.get_ro())
+			std::this_thread::yield();
+	}
 }
 
 template <typename Key, typename T, typename Hash, typename KeyEqual,
-	size_t HashPower>
-typename clevel_hash<Key, T, Hash, KeyEqual, HashPower>::KV_entry_ptr_t&
-clevel_hash<Key, T, Hash, KeyEqual, HashPower>::get_entry(
+	size_t HashPower, typename KVAllocator, typename ResizePolicy>
+typename clevel_hash<Key, T, Hash, KeyEqual, HashPower, KVAllocator, ResizePolicy>::KV_entry_ptr_t&
+clevel_hash<Key, T, Hash, KeyEqual, HashPower, KVAllocator, ResizePolicy>::get_entry(
 	level_ptr_t level, difference_type idx, uint64_t slot_idx)
 {
-	return level.get_address(my_pool_uuid)->buckets[idx].slots[slot_idx].p;
+	return level.get_address(my_pool_uuid, pool_addr)->buckets[idx].slots[slot_idx].p;
 }
 
 template <typename Key, typename T, typename Hash, typename KeyEqual,
-	size_t HashPower>
-typename clevel_hash<Key, T, Hash, KeyEqual, HashPower>::key_type
-clevel_hash<Key, T, Hash, KeyEqual, HashPower>::get_key(
+	size_t HashPower, typename KVAllocator, typename ResizePolicy>
+typename clevel_hash<Key, T, Hash, KeyEqual, HashPower, KVAllocator, ResizePolicy>::key_type
+clevel_hash<Key, T, Hash, KeyEqual, HashPower, KVAllocator, ResizePolicy>::get_key(
 	KV_entry_ptr_t &e)
 {
-	return e.get_address(my_pool_uuid)->first;
+	return e.get_address(my_pool_uuid, pool_addr)->first;
 }
 
 
 template <typename Key, typename T, typename Hash, typename KeyEqual,
-	size_t HashPower>
+	size_t HashPower, typename KVAllocator, typename ResizePolicy>
 void
-clevel_hash<Key, T, Hash, KeyEqual, HashPower>::clear()
+clevel_hash<Key, T, Hash, KeyEqual, HashPower, KVAllocator, ResizePolicy>::clear()
 {
 	std::cout << "level destroy!" << std::endl;
 }
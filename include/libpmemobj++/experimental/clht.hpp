@@ -247,6 +247,7 @@ public:
         PMEMoid oid = pmemobj_oid(this);
         assert(!OID_IS_NULL(oid));
         my_pool_uuid = oid.pool_uuid_lo;
+        pool_addr = reinterpret_cast<char *>(this) - oid.off;
 
 	    persistent_ptr<clht_hashtable_s> ht_tmp =
             make_persistent<clht_hashtable_s>(n_buckets);
@@ -260,6 +261,17 @@ public:
         ht_oldest = ht;
     }
 
+	/**
+	 * Refresh the cached pool base address. Should be called after
+	 * the pool is reopened, since it may be mapped elsewhere.
+	 */
+	void
+	runtime_initialize()
+	{
+		pool_addr = reinterpret_cast<char *>(this) -
+			pmemobj_oid(this).off;
+	}
+
 	bucket_ptr_t
 	clht_bucket_create_stats(pool_base &pop, clht_hashtable_s *ht_ptr,
 		int &resize)
@@ -336,7 +348,7 @@ public:
     get(const key_type &key) const
     {
 	    hv_type hv = hasher{}(key);
-        clht_hashtable_s *ht_ptr = ht.get_address(my_pool_uuid);
+        clht_hashtable_s *ht_ptr = ht.get_address(my_pool_uuid, pool_addr);
         difference_type idx = static_cast<difference_type>(
             hv % static_cast<hv_type>(ht_ptr->num_buckets));
         bucket_s *bucket = &ht_ptr->table[idx];
@@ -347,11 +359,11 @@ public:
             for (size_t j = 0; j < ENTRIES_PER_BUCKET; j++)
             {
                 if (bucket->slots[j] != nullptr && key_equal{}(
-                    bucket->slots[j].get_address(my_pool_uuid)->first, key))
+                    bucket->slots[j].get_address(my_pool_uuid, pool_addr)->first, key))
                     return ret(idx, step, j);
             }
 
-            bucket = bucket->next.get_address(my_pool_uuid);
+            bucket = bucket->next.get_address(my_pool_uuid, pool_addr);
             step++;
         } while (unlikely(bucket != nullptr));
 
@@ -366,11 +378,11 @@ public:
             for (size_t j = 0; j < ENTRIES_PER_BUCKET; j++)
             {
                 if (bucket->slots[j] != nullptr && key_equal{}(
-                    bucket->slots[j].get_address(my_pool_uuid)->first, key))
+                    bucket->slots[j].get_address(my_pool_uuid, pool_addr)->first, key))
                     return true;
             }
 
-            bucket = bucket->next.get_address(my_pool_uuid);
+            bucket = bucket->next.get_address(my_pool_uuid, pool_addr);
         } while (unlikely(bucket != nullptr));
         return false;
     }
@@ -418,7 +430,7 @@ public:
         persistent_ptr<value_type> tmp_entry;
         allocate_KV(pop, tmp_entry, param);
 
-	    clht_hashtable_s *ht_ptr = ht.get_address(my_pool_uuid);
+	    clht_hashtable_s *ht_ptr = ht.get_address(my_pool_uuid, pool_addr);
 	    hv_type hv = hasher{}(key);
 	    difference_type idx = static_cast<difference_type>(
             hv % static_cast<hv_type>(ht_ptr->num_buckets));
@@ -439,7 +451,7 @@ public:
         clht_lock_t *lock = &bucket->lock;
         while (!get_lock(pop, lock, ht_ptr))
         {
-            ht_ptr = ht.get_address(my_pool_uuid);
+            ht_ptr = ht.get_address(my_pool_uuid, pool_addr);
             idx = static_cast<difference_type>(
                 hv % static_cast<hv_type>(ht_ptr->num_buckets));
             bucket = &ht_ptr->table[idx];
@@ -452,7 +464,7 @@ public:
             for (size_t j = 0; j < ENTRIES_PER_BUCKET; j++)
             {
                 if (bucket->slots[j] != nullptr && key_equal{}(
-                    bucket->slots[j].get_address(my_pool_uuid)->first, key))
+                    bucket->slots[j].get_address(my_pool_uuid, pool_addr)->first, key))
                 {
 			        unlock(pop, lock);
                     return ret(true);
@@ -468,7 +480,7 @@ public:
                 {
                     bucket_ptr_t b_new = clht_bucket_create_stats(pop,
                         ht_ptr, resize);
-                    kv_ptr_t &s_new = b_new(my_pool_uuid)->slots[0];
+                    kv_ptr_t &s_new = b_new(my_pool_uuid, pool_addr)->slots[0];
 
                     s_new.off = tmp_entry.raw().off;
                     pop.persist(&s_new.off, sizeof(kv_ptr_t));
@@ -495,7 +507,7 @@ public:
                 }
                 return ret(expanded, initial_capacity);
             }
-            bucket = bucket->next.get_address(my_pool_uuid);
+            bucket = bucket->next.get_address(my_pool_uuid, pool_addr);
         } while (true);
     }
 
@@ -504,7 +516,7 @@ public:
     {
 	    pool_base pop = get_pool_base();
 	    hv_type hv = hasher{}(key);
-	    clht_hashtable_s *ht_ptr = ht.get_address(my_pool_uuid);
+	    clht_hashtable_s *ht_ptr = ht.get_address(my_pool_uuid, pool_addr);
 	    difference_type idx = static_cast<difference_type>(
 		    hv % static_cast<hv_type>(ht_ptr->num_buckets));
 	    bucket_s *bucket = &ht_ptr->table[idx];
@@ -518,7 +530,7 @@ public:
         clht_lock_t *lock = &bucket->lock;
         while (!get_lock(pop, lock, ht_ptr))
         {
-            ht_ptr = ht.get_address(my_pool_uuid);
+            ht_ptr = ht.get_address(my_pool_uuid, pool_addr);
             idx = static_cast<difference_type>(
                 hv % static_cast<hv_type>(ht_ptr->num_buckets));
             bucket = &ht_ptr->table[idx];
@@ -530,7 +542,7 @@ public:
             for (size_t j = 0; j < ENTRIES_PER_BUCKET; j++)
             {
                 if (bucket->slots[j] != nullptr && key_equal{}(
-                    bucket->slots[j].get_address(my_pool_uuid)->first, key))
+                    bucket->slots[j].get_address(my_pool_uuid, pool_addr)->first, key))
                 {
                     PMEMoid oid = bucket->slots[j].raw_ptr(my_pool_uuid);
                     pmemobj_free(&oid);
@@ -543,7 +555,7 @@ public:
                 }
             }
 
-            bucket = bucket->next.get_address(my_pool_uuid);
+            bucket = bucket->next.get_address(my_pool_uuid, pool_addr);
             step++;
         } while (unlikely(bucket != nullptr));
 
@@ -554,14 +566,14 @@ public:
     size_type
     size()
     {
-	    clht_hashtable_s *ht_ptr = ht.get_address(my_pool_uuid);
+	    clht_hashtable_s *ht_ptr = ht.get_address(my_pool_uuid, pool_addr);
         uint64_t n_buckets = ht_ptr->num_buckets;
 	    bucket_s *bucket = nullptr;
         size_type size = 0;
 
         for (difference_type idx = 0; idx < n_buckets; idx++)
         {
-            bucket = ht_ptr->table[idx].get_address(my_pool_uuid);
+            bucket = ht_ptr->table[idx].get_address(my_pool_uuid, pool_addr);
             do
             {
                 for (size_t j = 0; j < ENTRIES_PER_BUCKET; j++)
@@ -570,7 +582,7 @@ public:
                         size++;
                 }
 
-                bucket = bucket->next.get_address(my_pool_uuid);
+                bucket = bucket->next.get_address(my_pool_uuid, pool_addr);
             } while (unlikely(bucket != nullptr));
         }
 
@@ -584,7 +596,7 @@ public:
 	    if (try_lock(pop, &status_lock) && !is_increase)
             return 0;
 
-	    clht_hashtable_s *ht_ptr = ht.get_address(my_pool_uuid);
+	    clht_hashtable_s *ht_ptr = ht.get_address(my_pool_uuid, pool_addr);
         difference_type n_buckets = (difference_type)ht_ptr->num_buckets;
         bucket_s *bucket = nullptr;
         size_type size = 0;
@@ -607,7 +619,7 @@ public:
                         size++;
                 }
 
-                bucket = bucket->next.get_address(my_pool_uuid);
+                bucket = bucket->next.get_address(my_pool_uuid, pool_addr);
             } while (unlikely(bucket != nullptr));
 
             if (expands_cont > expands_max)
@@ -673,7 +685,7 @@ public:
     {
 	    pool_base pop = get_pool_base();
 
-	    clht_hashtable_s *ht_old = ht.get_address(my_pool_uuid);
+	    clht_hashtable_s *ht_old = ht.get_address(my_pool_uuid, pool_addr);
         if (try_lock(pop, &resize_lock))
             return 0;
 
@@ -770,13 +782,13 @@ public:
                 if (bucket->slots[j] != nullptr)
                 {
                     hv_type hv = hasher{}(
-                        bucket->slots[j].get_address(my_pool_uuid)->first);
+                        bucket->slots[j].get_address(my_pool_uuid, pool_addr)->first);
                     difference_type idx = static_cast<difference_type>(
                         hv % static_cast<hv_type>(ht_new->num_buckets));
                     put_seq(ht_new, bucket->slots[j], idx);
                 }
             }
-            bucket = bucket->next.get_address(my_pool_uuid);
+            bucket = bucket->next.get_address(my_pool_uuid, pool_addr);
         } while (unlikely(bucket != nullptr));
 
         return 1;
@@ -805,13 +817,13 @@ public:
                 int null;
                 bucket_ptr_t b_new = clht_bucket_create_stats(
                     pop, hashtable, null);
-                kv_ptr_t &s_new = b_new(my_pool_uuid)->slots[0];
+                kv_ptr_t &s_new = b_new(my_pool_uuid, pool_addr)->slots[0];
                 s_new.off = slot.off;
                 pop.persist(&s_new.off, sizeof(kv_ptr_t));
                 return true;
             }
 
-            bucket = bucket->next.get_address(my_pool_uuid);
+            bucket = bucket->next.get_address(my_pool_uuid, pool_addr);
         }
         while (true);
     }
@@ -828,7 +840,7 @@ public:
         {
             bucket_s *bucket = &hashtable->table[idx];
             if (!bucket_cpy(
-                bucket, hashtable->table_tmp.get_address(my_pool_uuid)))
+                bucket, hashtable->table_tmp.get_address(my_pool_uuid, pool_addr)))
                 break;
         }
 
@@ -838,7 +850,7 @@ public:
     void
     print()
     {
-        clht_hashtable_s *hashtable = ht.get_address(my_pool_uuid);
+        clht_hashtable_s *hashtable = ht.get_address(my_pool_uuid, pool_addr);
         difference_type n_buckets = (difference_type)hashtable->num_buckets;
         std::cout << "Number of buckets: " << n_buckets << std::endl;
 
@@ -854,13 +866,13 @@ public:
                     if (bucket->slots[j] != nullptr)
                     {
                         value_type* e =
-                            bucket->slots[j].get_address(my_pool_uuid);
+                            bucket->slots[j].get_address(my_pool_uuid, pool_addr);
                         std::cout << "(" << e->first
                             << "/" << e.second << ")-> ";
                     }
                 }
 
-                bucket = bucket->next.get_address(my_pool_uuid);
+                bucket = bucket->next.get_address(my_pool_uuid, pool_addr);
                 std::cout << " ** -> ";
             } while (unlikely(bucket != nullptr));
             std::cout << std::endl;
@@ -872,7 +884,7 @@ public:
     uint64_t
     capacity()
     {
-	    clht_hashtable_s *hashtable = ht.get_address(my_pool_uuid);
+	    clht_hashtable_s *hashtable = ht.get_address(my_pool_uuid, pool_addr);
 	    difference_type n_buckets = (difference_type)hashtable->num_buckets;
 
         uint64_t num = 0;
@@ -882,7 +894,7 @@ public:
             do
             {
                 num++;
-                bucket = bucket->next.get_address(my_pool_uuid);
+                bucket = bucket->next.get_address(my_pool_uuid, pool_addr);
             } while (unlikely(bucket != nullptr));
         }
 
@@ -901,6 +913,9 @@ public:
 
     /** ID of persistent memory pool where hash map resides. */
     p<uint64_t> my_pool_uuid;
+
+    /** Base address of the pool in this run. */
+    char *pool_addr;
 };
 
 } /* namespace experimental */
@@ -0,0 +1,421 @@
+#ifndef PMEMOBJ_KV_ALLOCATOR_HPP
+#define PMEMOBJ_KV_ALLOCATOR_HPP
+
+#include <libpmemobj++/detail/common.hpp>
+#include <libpmemobj++/experimental/concurrent_hash_map.hpp>
+#include <libpmemobj++/experimental/thread_slots.hpp>
+#include <libpmemobj++/make_persistent_atomic.hpp>
+#include <libpmemobj++/persistent_ptr.hpp>
+#include <libpmemobj++/pool.hpp>
+#include <libpmemobj++/transaction.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace pmem
+{
+namespace obj
+{
+namespace experimental
+{
+
+/**
+ * Allocator policy for the KV entries of clevel_hash, which allocates
+ * every entry from the pmemobj heap (the default).
+ *
+ * The map rebinds a policy to the type of its entries with rebind<U>.
+ * A policy provides allocate() and deallocate() for the entries, hooks
+ * for the number of thread slots, which only grows and may grow while
+ * other slots allocate, and the start of a run, and a recovery
+ * protocol: when recover_by_scan is true, the map reports every entry
+ * reachable from the table between recover_begin() and recover_end() at
+ * open, and the policy reclaims the rest by itself.
+ */
+template <typename V>
+class pmemobj_kv_allocator {
+public:
+	using size_type = size_t;
+
+	template <typename U>
+	struct rebind {
+		using other = pmemobj_kv_allocator<U>;
+	};
+
+	constexpr static bool recover_by_scan = false;
+
+	void
+	set_thread_num(size_type)
+	{
+	}
+
+	void
+	runtime_initialize(size_type)
+	{
+	}
+
+	/**
+	 * Allocate and construct an entry in a transaction, and store it
+	 * to ptr.
+	 */
+	template <typename... Args>
+	void
+	allocate(pool_base &pop, size_type, persistent_ptr<V> &ptr,
+		Args &&... args)
+	{
+		internal::make_persistent_object<V>(pop, ptr,
+			std::forward<Args>(args)...);
+	}
+
+	/**
+	 * Free the entry and clear ptr atomically.
+	 */
+	void
+	deallocate(size_type, persistent_ptr<V> &ptr)
+	{
+		delete_persistent_atomic<V>(ptr);
+	}
+
+	void
+	recover_begin()
+	{
+	}
+
+	void
+	recover_mark(const void *)
+	{
+	}
+
+	void
+	recover_end()
+	{
+	}
+};
+
+/**
+ * Allocator policy for the KV entries of clevel_hash, which carves
+ * fixed-size entries out of persistent slabs of SlabSize entries.
+ *
+ * Each thread allocates from its own free list and slab, so inserts do
+ * not go through the pmemobj heap (and its redo log) except for a new
+ * slab every SlabSize entries. Freed entries return to the free list of
+ * the thread passed to deallocate(), which is the thread that retired
+ * them.
+ *
+ * Only the list of slabs is persistent. The allocation state is rebuilt
+ * at open: the map marks reachable entries in a bitmap per slab and the
+ * unmarked entries become free, so no allocation or free persists
+ * anything but the constructed entry itself.
+ */
+template <typename V, size_t SlabSize = 4096>
+class slab_kv_allocator {
+public:
+	using size_type = size_t;
+
+	template <typename U>
+	struct rebind {
+		using other = slab_kv_allocator<U, SlabSize>;
+	};
+
+	constexpr static bool recover_by_scan = true;
+
+	static_assert(SlabSize > 0 && SlabSize % 64 == 0,
+		"SlabSize must be a multiple of 64");
+
+	slab_kv_allocator() : slabs(nullptr), cache_num(0)
+	{
+		set_pool();
+	}
+
+	slab_kv_allocator(const slab_kv_allocator &) = delete;
+	slab_kv_allocator &operator=(const slab_kv_allocator &) = delete;
+
+	/**
+	 * Add caches for up to num threads. The caches never move, so the
+	 * existing threads may allocate and free meanwhile. Not thread safe
+	 * with other calls.
+	 */
+	void
+	set_thread_num(size_type num)
+	{
+		if (num <= cache_num)
+			return;
+
+		caches.grow(num);
+		cache_num = num;
+	}
+
+	/**
+	 * Reset the volatile state, which holds garbage from the previous
+	 * run. The free lists are filled by recover_end().
+	 */
+	void
+	runtime_initialize(size_type num)
+	{
+		set_pool();
+		new (&caches) segmented_array<thread_cache>();
+		new (&slab_mutex) std::mutex();
+		new (&recovery) std::vector<slab_bitmap>();
+		cache_num = 0;
+
+		if (num > 0)
+			set_thread_num(num);
+	}
+
+	/**
+	 * Construct an entry in the slab of the thread, persist it, and
+	 * store it to ptr. ptr itself is not persisted, since allocations
+	 * are recovered from the table.
+	 *
+	 * Types with non-trivial destructors (e.g. persistent strings)
+	 * may allocate in their constructors, which requires a transaction.
+	 */
+	template <typename... Args>
+	void
+	allocate(pool_base &pop, size_type thread_id, persistent_ptr<V> &ptr,
+		Args &&... args)
+	{
+		assert(thread_id < caches.size());
+		void *e = take(pop, caches[thread_id]);
+
+		if (std::is_trivially_destructible<V>::value)
+		{
+			new (e) V(std::forward<Args>(args)...);
+		}
+		else
+		{
+			transaction::manual tx(pop);
+			new (e) V(std::forward<Args>(args)...);
+			transaction::commit();
+		}
+		pop.persist(e, sizeof(V));
+
+		ptr = persistent_ptr<V>(PMEMoid{pool_uuid,
+			static_cast<uint64_t>(static_cast<char *>(e) - base)});
+	}
+
+	/**
+	 * Return the entry to the free list of the thread and clear ptr.
+	 * Thread safe with respect to the allocations of that thread.
+	 */
+	void
+	deallocate(size_type thread_id, persistent_ptr<V> &ptr)
+	{
+		if (ptr == nullptr)
+			return;
+
+		assert(thread_id < caches.size());
+		std::atomic<void *> &head = caches[thread_id].remote_head;
+		void *e = ptr.get();
+		void *old = head.load();
+		do
+		{
+			*static_cast<void **>(e) = old;
+		} while (!head.compare_exchange_weak(old, e));
+
+		ptr = nullptr;
+	}
+
+	/**
+	 * Start rebuilding the allocation state. Not thread safe.
+	 */
+	void
+	recover_begin()
+	{
+		recovery.clear();
+		for (slab *s = slabs.get(); s != nullptr; s = s->next.get())
+			recovery.emplace_back(s);
+
+		std::sort(recovery.begin(), recovery.end(),
+			[](const slab_bitmap &a, const slab_bitmap &b) {
+				return a.s < b.s;
+			});
+	}
+
+	/**
+	 * Mark an entry reachable from the table.
+	 */
+	void
+	recover_mark(const void *e)
+	{
+		auto it = std::upper_bound(recovery.begin(), recovery.end(), e,
+			[](const void *p, const slab_bitmap &b) {
+				return p < static_cast<const void *>(b.s);
+			});
+		if (it == recovery.begin())
+			return;
+
+		--it;
+		const char *first =
+			reinterpret_cast<const char *>(&it->s->entries[0]);
+		const char *p = static_cast<const char *>(e);
+		if (p < first || p >= first + sizeof(entry_storage) * SlabSize)
+			return;
+
+		size_type k = static_cast<size_type>(p - first) /
+			sizeof(entry_storage);
+		it->bits[k / 64] |= 1ULL << (k % 64);
+	}
+
+	/**
+	 * Hand the unmarked entries of every slab to the free lists, spread
+	 * over the threads slab by slab.
+	 */
+	void
+	recover_end()
+	{
+		for (size_type i = 0; i < cache_num; i++)
+		{
+			caches[i].cur = nullptr;
+			caches[i].cursor = 0;
+			caches[i].free_head = nullptr;
+			caches[i].remote_head.store(nullptr);
+		}
+
+		for (size_type i = 0; i < recovery.size(); i++)
+		{
+			thread_cache &t = caches[i % cache_num];
+			slab_bitmap &b = recovery[i];
+			for (size_type k = 0; k < SlabSize; k++)
+			{
+				if (b.bits[k / 64] & (1ULL << (k % 64)))
+					continue;
+
+				push_local(t, &b.s->entries[k]);
+			}
+		}
+
+		std::vector<slab_bitmap>().swap(recovery);
+	}
+
+private:
+	using entry_storage =
+		typename std::aligned_storage<sizeof(V), alignof(V)>::type;
+
+	struct slab {
+		persistent_ptr<slab> next;
+		entry_storage entries[SlabSize];
+	};
+
+	struct slab_bitmap {
+		slab_bitmap(slab *_s) : s(_s), bits()
+		{
+		}
+
+		slab *s;
+		uint64_t bits[SlabSize / 64];
+	};
+
+	struct thread_cache {
+		thread_cache()
+			: cur(nullptr), cursor(0), free_head(nullptr),
+			  remote_head(nullptr)
+		{
+		}
+
+		// Slab being carved and the index of its next entry.
+		slab *cur;
+		size_type cursor;
+		// Free entries linked through their first word.
+		void *free_head;
+		// Entries freed by other threads, taken by the owner at once.
+		std::atomic<void *> remote_head;
+		char padding[64 - 4 * sizeof(void *)];
+	};
+
+	static_assert(sizeof(V) >= sizeof(void *),
+		"entries must be able to hold a free list link");
+
+	void
+	set_pool()
+	{
+		PMEMoid oid = pmemobj_oid(this);
+		assert(!OID_IS_NULL(oid));
+		pool_uuid = oid.pool_uuid_lo;
+		base = reinterpret_cast<char *>(this) - oid.off;
+	}
+
+	static void
+	push_local(thread_cache &t, void *e)
+	{
+		*static_cast<void **>(e) = t.free_head;
+		t.free_head = e;
+	}
+
+	static int
+	slab_constructor(PMEMobjpool *pop, void *ptr, void *arg)
+	{
+		// Only the header is persisted; entries are persisted when
+		// they are allocated.
+		slab *s = static_cast<slab *>(ptr);
+		new (&s->next) persistent_ptr<slab>(
+			*static_cast<persistent_ptr<slab> *>(arg));
+		pmemobj_persist(pop, &s->next, sizeof(s->next));
+
+		return 0;
+	}
+
+	void *
+	take(pool_base &pop, thread_cache &t)
+	{
+		if (t.free_head == nullptr)
+			t.free_head = t.remote_head.exchange(nullptr);
+
+		if (t.free_head != nullptr)
+		{
+			void *e = t.free_head;
+			t.free_head = *static_cast<void **>(e);
+			return e;
+		}
+
+		if (t.cur == nullptr || t.cursor == SlabSize)
+		{
+			t.cur = new_slab(pop);
+			t.cursor = 0;
+		}
+
+		return &t.cur->entries[t.cursor++];
+	}
+
+	/**
+	 * Allocate a slab and link it to the head of the list atomically.
+	 * @throw std::bad_alloc on allocation failure.
+	 */
+	slab *
+	new_slab(pool_base &pop)
+	{
+		std::lock_guard<std::mutex> lock(slab_mutex);
+
+		persistent_ptr<slab> next = slabs;
+		int ret = pmemobj_alloc(pop.handle(), slabs.raw_ptr(),
+			sizeof(slab), 0, &slab_constructor, &next);
+		if (ret != 0)
+			throw std::bad_alloc();
+
+		return slabs.get();
+	}
+
+	persistent_ptr<slab> slabs;
+
+	// Volatile members, reset by runtime_initialize().
+	uint64_t pool_uuid;
+	char *base;
+	segmented_array<thread_cache> caches;
+	size_type cache_num;
+	std::mutex slab_mutex;
+	std::vector<slab_bitmap> recovery;
+};
+
+} /* namespace experimental */
+} /* namespace obj */
+} /* namespace pmem */
+
+#endif /* PMEMOBJ_KV_ALLOCATOR_HPP */
@@ -0,0 +1,118 @@
+#ifndef PMEMOBJ_RESIZE_POLICY_HPP
+#define PMEMOBJ_RESIZE_POLICY_HPP
+
+#include <cstddef>
+
+namespace pmem
+{
+namespace obj
+{
+namespace experimental
+{
+
+/**
+ * Resize policy of clevel_hash, which expands the table only when an
+ * insert finds no vacancy in the candidate buckets of any level (the
+ * default).
+ *
+ * A policy declares whether the map counts its items (count_items),
+ * decides whether the expand thread should expand or shrink the table
+ * with the given number of items and slots (should_expand() and
+ * should_shrink()), and sizes the level appended by an expansion
+ * (expand_capacity()). Inserts that find no vacancy always expand the
+ * table, whatever the policy.
+ */
+class insert_failure_resize_policy {
+public:
+	using size_type = size_t;
+
+	constexpr static bool count_items = false;
+
+	bool
+	should_expand(size_type, size_type) const
+	{
+		return false;
+	}
+
+	bool
+	should_shrink(size_type, size_type) const
+	{
+		return false;
+	}
+
+	/**
+	 * Get the number of buckets of the level appended above a top level
+	 * of capacity buckets.
+	 */
+	size_type
+	expand_capacity(size_type capacity, size_type, size_type) const
+	{
+		return capacity * 2;
+	}
+};
+
+/**
+ * Resize policy of clevel_hash, which also makes the expand thread expand
+ * the table once its load factor reaches MaxLoad percent, so that inserts
+ * rarely wait for an expansion.
+ *
+ * The appended level has GrowthFactor times the buckets of the top level,
+ * doubled until the load factor would drop to TargetLoad percent once the
+ * bottom level is rehashed.
+ *
+ * The expand thread halves the table once its load factor stays below
+ * MinLoad percent (0 disables shrinking), but never below the initial
+ * capacity.
+ */
+template <size_t MaxLoad = 85, size_t TargetLoad = 50, size_t GrowthFactor = 2,
+	size_t MinLoad = 10>
+class load_factor_resize_policy {
+public:
+	using size_type = size_t;
+
+	static_assert(0 < TargetLoad && TargetLoad <= MaxLoad && MaxLoad <= 100,
+		"load factors must satisfy 0 < TargetLoad <= MaxLoad <= 100");
+	static_assert(GrowthFactor >= 2 &&
+		(GrowthFactor & (GrowthFactor - 1)) == 0,
+		"GrowthFactor must be a power of two");
+	static_assert(MinLoad * 2 <= TargetLoad,
+		"MinLoad must be at most half of TargetLoad, or a halved table "
+		"would expand again");
+
+	constexpr static bool count_items = true;
+
+	bool
+	should_expand(size_type items, size_type slots) const
+	{
+		return items * 100 >= slots * MaxLoad;
+	}
+
+	bool
+	should_shrink(size_type items, size_type slots) const
+	{
+		return items * 100 < slots * MinLoad;
+	}
+
+	/**
+	 * Get the number of buckets of the level appended above a top level
+	 * of capacity buckets of bucket_size slots, when the table holds
+	 * items items. The top and the new level remain after rehashing.
+	 */
+	size_type
+	expand_capacity(size_type capacity, size_type items,
+		size_type bucket_size) const
+	{
+		size_type new_capacity = capacity * GrowthFactor;
+		while ((capacity + new_capacity) * bucket_size * TargetLoad <
+			items * 100)
+			new_capacity *= 2;
+
+		return new_capacity;
+	}
+};
+
+} /* namespace experimental */
+} /* namespace obj */
+} /* namespace pmem */
+
+#endif /* PMEMOBJ_RESIZE_POLICY_HPP */
@@ -0,0 +1,302 @@
+#ifndef PMEMOBJ_THREAD_SLOTS_HPP
+#define PMEMOBJ_THREAD_SLOTS_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace pmem
+{
+namespace obj
+{
+namespace experimental
+{
+
+/**
+ * Layout of a table of thread slots that grows by segments, so that slots
+ * never move. Segment 0 holds the first Base slots and segment k > 0
+ * holds Base << (k - 1) slots, i.e., each segment doubles the table.
+ */
+template <size_t Base, size_t SegmentNum>
+struct slot_segments {
+	static_assert(Base > 0 && (Base & (Base - 1)) == 0,
+		"Base must be a power of two");
+
+	constexpr static size_t segment_num = SegmentNum;
+	constexpr static size_t max_slots = Base << (SegmentNum - 1);
+
+	/**
+	 * Get the segment of slot id, and the index of the slot in it.
+	 */
+	static size_t
+	segment(size_t id, size_t &index)
+	{
+		if (id < Base)
+		{
+			index = id;
+			return 0;
+		}
+
+		size_t k = static_cast<size_t>(
+			64 - __builtin_clzll(static_cast<unsigned long long>(id / Base)));
+		index = id - (Base << (k - 1));
+		return k;
+	}
+
+	/**
+	 * Get the number of slots in segment k.
+	 */
+	static size_t
+	size(size_t k)
+	{
+		return k == 0 ? Base : Base << (k - 1);
+	}
+
+	/**
+	 * Get the number of slots in the first k segments.
+	 */
+	static size_t
+	capacity(size_t k)
+	{
+		return k == 0 ? 0 : Base << (k - 1);
+	}
+};
+
+/**
+ * Volatile array that grows by segments of slot_segments. Elements are
+ * value-initialized and never move, so they can be accessed while the
+ * array grows.
+ */
+template <typename T, size_t Base = 8, size_t SegmentNum = 16>
+class segmented_array {
+public:
+	using layout = slot_segments<Base, SegmentNum>;
+
+	segmented_array() : n(0)
+	{
+	}
+
+	segmented_array(const segmented_array &) = delete;
+	segmented_array &operator=(const segmented_array &) = delete;
+
+	T &
+	operator[](size_t id)
+	{
+		size_t index;
+		size_t k = layout::segment(id, index);
+		return segments[k][index];
+	}
+
+	/**
+	 * Get the number of elements, a segment boundary.
+	 */
+	size_t
+	size() const
+	{
+		return n.load(std::memory_order_acquire);
+	}
+
+	/**
+	 * Add segments until the array holds at least num elements. Thread
+	 * safe with respect to accesses to the existing elements, but not
+	 * with other calls.
+	 */
+	void
+	grow(size_t num)
+	{
+		assert(num <= layout::max_slots);
+
+		size_t k = 0;
+		while (layout::capacity(k) < n.load(std::memory_order_relaxed))
+			k++;
+
+		for (; layout::capacity(k) < num; k++)
+			segments[k].reset(new T[layout::size(k)]());
+
+		n.store(layout::capacity(k), std::memory_order_release);
+	}
+
+private:
+	std::unique_ptr<T[]> segments[SegmentNum];
+	std::atomic<size_t> n;
+};
+
+/**
+ * Volatile registry of the thread slots of a container in one run. A
+ * thread leases a free slot on its first call to this_thread_slot() and
+ * the lease is released when the thread exits, so threads may come and
+ * go while slot ids stay dense. Leasing and releasing are lock-free.
+ * Growing the slots is left to the container, which sets up its
+ * per-slot state before calling grow().
+ */
+class thread_slot_registry {
+public:
+	thread_slot_registry() : registry_id(next_id().fetch_add(1) + 1)
+	{
+	}
+
+	thread_slot_registry(const thread_slot_registry &) = delete;
+	thread_slot_registry &operator=(const thread_slot_registry &) = delete;
+
+	/**
+	 * Get the id of the registry, unique in the process.
+	 */
+	uint64_t
+	id() const
+	{
+		return registry_id;
+	}
+
+	size_t
+	capacity() const
+	{
+		return leased.size();
+	}
+
+	/**
+	 * Make at least num slots available for leases. Not thread safe
+	 * with other calls.
+	 */
+	void
+	grow(size_t num)
+	{
+		leased.grow(num);
+	}
+
+	/**
+	 * Get the slot that the calling thread leases from the registry of
+	 * the given id, which costs a thread-local read.
+	 * @returns false if the thread leased no slot recently.
+	 */
+	static bool
+	cached_slot(uint64_t id, size_t &slot)
+	{
+		thread_leases &l = local();
+		if (l.last_id != id)
+			return false;
+
+		slot = l.last_slot;
+		return true;
+	}
+
+	/**
+	 * Get the slot that the calling thread leases from r, and lease one
+	 * if it has none. grow(capacity) is called to add slots to r when
+	 * all of its capacity slots are leased.
+	 */
+	template <typename Grow>
+	static size_t
+	this_thread_slot(const std::shared_ptr<thread_slot_registry> &r,
+		Grow grow)
+	{
+		thread_leases &l = local();
+		auto it = std::find_if(l.leases.begin(), l.leases.end(),
+			[&](const lease &e) { return e.id == r->id(); });
+
+		size_t slot;
+		if (it != l.leases.end())
+		{
+			slot = it->slot;
+		}
+		else
+		{
+			// Forget the leases of registries that are gone.
+			l.leases.erase(std::remove_if(l.leases.begin(),
+				l.leases.end(), [](const lease &e) {
+					return e.registry.expired();
+				}), l.leases.end());
+
+			while (!r->try_acquire(slot))
+				grow(r->capacity());
+
+			l.leases.push_back(lease{r->id(), slot, r});
+		}
+
+		l.last_id = r->id();
+		l.last_slot = slot;
+		return slot;
+	}
+
+private:
+	struct lease {
+		uint64_t id;
+		size_t slot;
+		std::weak_ptr<thread_slot_registry> registry;
+	};
+
+	/**
+	 * Leases of a thread, released when the thread exits.
+	 */
+	struct thread_leases {
+		thread_leases() : last_id(0), last_slot(0)
+		{
+		}
+
+		~thread_leases()
+		{
+			for (auto &e : leases)
+			{
+				std::shared_ptr<thread_slot_registry> r =
+					e.registry.lock();
+				if (r)
+					r->release(e.slot);
+			}
+		}
+
+		uint64_t last_id;
+		size_t last_slot;
+		std::vector<lease> leases;
+	};
+
+	static thread_leases &
+	local()
+	{
+		static thread_local thread_leases l;
+		return l;
+	}
+
+	static std::atomic<uint64_t> &
+	next_id()
+	{
+		static std::atomic<uint64_t> id(0);
+		return id;
+	}
+
+	bool
+	try_acquire(size_t &slot)
+	{
+		size_t num = leased.size();
+		for (size_t i = 0; i < num; i++)
+		{
+			bool expected = false;
+			if (!leased[i].load(std::memory_order_relaxed) &&
+				leased[i].compare_exchange_strong(expected, true,
+					std::memory_order_acquire))
+			{
+				slot = i;
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	void
+	release(size_t slot)
+	{
+		leased[slot].store(false, std::memory_order_release);
+	}
+
+	const uint64_t registry_id;
+	segmented_array<std::atomic<bool>> leased;
+};
+
+} /* namespace experimental */
+} /* namespace obj */
+} /* namespace pmem */
+
+#endif /* PMEMOBJ_THREAD_SLOTS_HPP */
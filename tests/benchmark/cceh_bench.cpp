@@ -0,0 +1,117 @@
+#include "ycsb_bench.hpp"
+#include <libpmemobj++/experimental/cceh.hpp>
+
+// 1024 * 2^6 = 65536
+#define INITIAL_DEPTH 6U
+// 1024 * 2^8 = 262144
+#define LARGE_INITIAL_DEPTH 8U
+
+namespace
+{
+
+typedef nvobj::experimental::CCEH persistent_map_type;
+
+class cceh_adapter {
+public:
+	struct root {
+		nvobj::persistent_ptr<persistent_map_type> cons;
+	};
+
+	// CCEH has neither updates nor deletes.
+	static const bool supports_update = false;
+	static const bool supports_erase = false;
+	// CCEH stores the first 8 bytes of a key apart from the rest.
+	static const size_t min_key_size = 8;
+
+	static const char *
+	name()
+	{
+		return "cceh";
+	}
+
+	cceh_adapter(nvobj::pool<root> &pop, const bench_config &cfg)
+	{
+		{
+			nvobj::transaction::manual tx(pop);
+
+			pop.root()->cons =
+				nvobj::make_persistent<persistent_map_type>(
+					cfg.large ? LARGE_INITIAL_DEPTH
+						  : INITIAL_DEPTH);
+
+			nvobj::transaction::commit();
+		}
+
+		map = pop.root()->cons;
+	}
+
+	size_t
+	background_threads() const
+	{
+		return 0;
+	}
+
+	/*
+	 * CCEH does not look for the key before inserting it, so every
+	 * insert succeeds.
+	 */
+	bool
+	insert(size_t tid, const char *key, size_t key_len, const char *value,
+		size_t value_len)
+	{
+		return map->insert(to_key(key), to_key(value), key_len,
+			value_len, tid).found;
+	}
+
+	bool
+	read(size_t, const char *key, size_t key_len)
+	{
+		return map->get(to_key(key), key_len).found;
+	}
+
+	bool
+	erase(size_t, const char *, size_t)
+	{
+		return false;
+	}
+
+	bool
+	update(size_t, const char *, size_t, const char *, size_t)
+	{
+		return false;
+	}
+
+	void
+	idle(size_t)
+	{
+		std::this_thread::yield();
+	}
+
+	uint64_t
+	capacity()
+	{
+		return map->Capacity();
+	}
+
+	void
+	finish()
+	{
+	}
+
+private:
+	static persistent_map_type::key_type
+	to_key(const char *key)
+	{
+		return reinterpret_cast<uint8_t *>(const_cast<char *>(key));
+	}
+
+	nvobj::persistent_ptr<persistent_map_type> map;
+};
+
+} /* Annoymous namespace */
+
+int
+main(int argc, char *argv[])
+{
+	return run_benchmark<cceh_adapter>(argc, argv);
+}
@@ -0,0 +1,114 @@
+#include "ycsb_bench.hpp"
+#include <libpmemobj++/experimental/clevel_hash.hpp>
+
+// (2^12 + 2^11) * 8 = 49152
+#define HASH_POWER 12
+// (2^14 + 2^13) * 8 = 196608
+#define LARGE_HASH_POWER 14
+
+namespace
+{
+
+typedef nvobj::experimental::clevel_hash<string_t, string_t, string_hasher,
+	std::equal_to<string_t>, HASH_POWER>
+	persistent_map_type;
+
+class clevel_hash_adapter {
+public:
+	struct root {
+		nvobj::persistent_ptr<persistent_map_type> cons;
+	};
+
+	static const bool supports_update = true;
+	static const bool supports_erase = true;
+	static const size_t min_key_size = 1;
+
+	static const char *
+	name()
+	{
+		return "clevel_hash";
+	}
+
+	clevel_hash_adapter(nvobj::pool<root> &pop, const bench_config &cfg)
+	    : n_background(cfg.background_threads)
+	{
+		{
+			nvobj::transaction::manual tx(pop);
+
+			pop.root()->cons =
+				nvobj::make_persistent<persistent_map_type>(
+					cfg.background_threads,
+					static_cast<size_t>(cfg.large
+						? LARGE_HASH_POWER : HASH_POWER));
+
+			nvobj::transaction::commit();
+		}
+
+		map = pop.root()->cons;
+	}
+
+	size_t
+	background_threads() const
+	{
+		return n_background;
+	}
+
+	bool
+	insert(size_t, const char *key, size_t key_len, const char *value,
+		size_t value_len)
+	{
+		return !map->insert(persistent_map_type::value_type(
+			string_t(key, key_len), string_t(value, value_len))).found;
+	}
+
+	bool
+	read(size_t, const char *key, size_t key_len)
+	{
+		persistent_map_type::const_accessor acc;
+		return map->find(acc, string_t(key, key_len));
+	}
+
+	bool
+	erase(size_t, const char *key, size_t key_len)
+	{
+		return map->erase(string_t(key, key_len)).found;
+	}
+
+	bool
+	update(size_t, const char *key, size_t key_len, const char *value,
+		size_t value_len)
+	{
+		return map->update(persistent_map_type::value_type(
+			string_t(key, key_len), string_t(value, value_len))).found;
+	}
+
+	void
+	idle(size_t)
+	{
+		std::this_thread::yield();
+	}
+
+	uint64_t
+	capacity()
+	{
+		return map->capacity();
+	}
+
+	void
+	finish()
+	{
+		map->stop_rehash_threads();
+	}
+
+private:
+	nvobj::persistent_ptr<persistent_map_type> map;
+	size_t n_background;
+};
+
+} /* Annoymous namespace */
+
+int
+main(int argc, char *argv[])
+{
+	return run_benchmark<clevel_hash_adapter>(argc, argv);
+}
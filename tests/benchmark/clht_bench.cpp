@@ -0,0 +1,107 @@
+#include "ycsb_bench.hpp"
+#include <libpmemobj++/experimental/clht.hpp>
+
+#define N_BUCKETS 16384
+#define LARGE_N_BUCKETS 65536
+
+namespace
+{
+
+typedef nvobj::experimental::clht<string_t, string_t, string_hasher,
+	std::equal_to<string_t>>
+	persistent_map_type;
+
+class clht_adapter {
+public:
+	struct root {
+		nvobj::persistent_ptr<persistent_map_type> cons;
+	};
+
+	// CLHT has no updates.
+	static const bool supports_update = false;
+	static const bool supports_erase = true;
+	static const size_t min_key_size = 1;
+
+	static const char *
+	name()
+	{
+		return "clht";
+	}
+
+	clht_adapter(nvobj::pool<root> &pop, const bench_config &cfg)
+	{
+		{
+			nvobj::transaction::manual tx(pop);
+
+			pop.root()->cons =
+				nvobj::make_persistent<persistent_map_type>(
+					static_cast<uint64_t>(cfg.large
+						? LARGE_N_BUCKETS : N_BUCKETS));
+
+			nvobj::transaction::commit();
+		}
+
+		map = pop.root()->cons;
+	}
+
+	size_t
+	background_threads() const
+	{
+		return 0;
+	}
+
+	bool
+	insert(size_t tid, const char *key, size_t key_len, const char *value,
+		size_t value_len)
+	{
+		return !map->put(persistent_map_type::value_type(
+			string_t(key, key_len), string_t(value, value_len)),
+			tid).found;
+	}
+
+	bool
+	read(size_t, const char *key, size_t key_len)
+	{
+		return map->get(string_t(key, key_len)).found;
+	}
+
+	bool
+	erase(size_t, const char *key, size_t key_len)
+	{
+		return map->erase(string_t(key, key_len)).found;
+	}
+
+	bool
+	update(size_t, const char *, size_t, const char *, size_t)
+	{
+		return false;
+	}
+
+	void
+	idle(size_t)
+	{
+		std::this_thread::yield();
+	}
+
+	uint64_t
+	capacity()
+	{
+		return map->capacity();
+	}
+
+	void
+	finish()
+	{
+	}
+
+private:
+	nvobj::persistent_ptr<persistent_map_type> map;
+};
+
+} /* Annoymous namespace */
+
+int
+main(int argc, char *argv[])
+{
+	return run_benchmark<clht_adapter>(argc, argv);
+}
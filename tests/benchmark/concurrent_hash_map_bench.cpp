@@ -0,0 +1,110 @@
+#include "ycsb_bench.hpp"
+#include <libpmemobj++/experimental/concurrent_hash_map.hpp>
+
+// The capacity for level hashing with level size = 12
+#define RESERVE_BUCKET_NUM 49152
+// The capacity for level hashing with level size = 16
+#define LARGE_RESERVE_BUCKET_NUM 196608
+
+namespace
+{
+
+typedef nvobj::experimental::concurrent_hash_map<string_t, string_t,
+	string_hasher>
+	persistent_map_type;
+
+class concurrent_hash_map_adapter {
+public:
+	struct root {
+		nvobj::persistent_ptr<persistent_map_type> cons;
+	};
+
+	// concurrent_hash_map is benchmarked without updates.
+	static const bool supports_update = false;
+	static const bool supports_erase = true;
+	static const size_t min_key_size = 1;
+
+	static const char *
+	name()
+	{
+		return "concurrent_hash_map";
+	}
+
+	concurrent_hash_map_adapter(nvobj::pool<root> &pop,
+		const bench_config &cfg)
+	{
+		{
+			nvobj::transaction::manual tx(pop);
+
+			pop.root()->cons =
+				nvobj::make_persistent<persistent_map_type>();
+
+			nvobj::transaction::commit();
+		}
+
+		map = pop.root()->cons;
+		map->reserve_bucket(cfg.large ? LARGE_RESERVE_BUCKET_NUM
+					      : RESERVE_BUCKET_NUM);
+	}
+
+	size_t
+	background_threads() const
+	{
+		return 0;
+	}
+
+	bool
+	insert(size_t, const char *key, size_t key_len, const char *value,
+		size_t value_len)
+	{
+		return map->insert(persistent_map_type::value_type(
+			string_t(key, key_len), string_t(value, value_len)));
+	}
+
+	bool
+	read(size_t, const char *key, size_t key_len)
+	{
+		persistent_map_type::accessor acc;
+		return map->find(acc, string_t(key, key_len));
+	}
+
+	bool
+	erase(size_t, const char *key, size_t key_len)
+	{
+		return map->erase(string_t(key, key_len));
+	}
+
+	bool
+	update(size_t, const char *, size_t, const char *, size_t)
+	{
+		return false;
+	}
+
+	void
+	idle(size_t)
+	{
+		std::this_thread::yield();
+	}
+
+	uint64_t
+	capacity()
+	{
+		return map->bucket_count();
+	}
+
+	void
+	finish()
+	{
+	}
+
+private:
+	nvobj::persistent_ptr<persistent_map_type> map;
+};
+
+} /* Annoymous namespace */
+
+int
+main(int argc, char *argv[])
+{
+	return run_benchmark<concurrent_hash_map_adapter>(argc, argv);
+}
@@ -0,0 +1,119 @@
+#include "ycsb_bench.hpp"
+#include <libpmemobj++/experimental/level_hash.hpp>
+
+// the level size of level hashing
+#define HASH_POWER 13
+#define LARGE_HASH_POWER 15
+
+namespace
+{
+
+typedef nvobj::experimental::level_hash<string_t, string_t, string_hasher,
+	std::equal_to<string_t>>
+	persistent_map_type;
+
+class level_hash_adapter {
+public:
+	struct root {
+		nvobj::persistent_ptr<persistent_map_type> cons;
+	};
+
+	static const bool supports_update = true;
+	static const bool supports_erase = true;
+	static const size_t min_key_size = 1;
+
+	static const char *
+	name()
+	{
+		return "level_hash";
+	}
+
+	level_hash_adapter(nvobj::pool<root> &pop, const bench_config &cfg)
+	    : idle_key("idle", 4)
+	{
+		// Every worker crosses the resizing barrier, so it counts
+		// the worker threads.
+		{
+			nvobj::transaction::manual tx(pop);
+
+			pop.root()->cons =
+				nvobj::make_persistent<persistent_map_type>(
+					static_cast<uint64_t>(cfg.large
+						? LARGE_HASH_POWER : HASH_POWER),
+					cfg.threads);
+
+			nvobj::transaction::commit();
+		}
+
+		map = pop.root()->cons;
+	}
+
+	size_t
+	background_threads() const
+	{
+		return 0;
+	}
+
+	bool
+	insert(size_t tid, const char *key, size_t key_len, const char *value,
+		size_t value_len)
+	{
+		return !map->insert(persistent_map_type::value_type(
+			string_t(key, key_len), string_t(value, value_len)),
+			tid).found;
+	}
+
+	bool
+	read(size_t tid, const char *key, size_t key_len)
+	{
+		return map->query(string_t(key, key_len), tid).found;
+	}
+
+	bool
+	erase(size_t tid, const char *key, size_t key_len)
+	{
+		return map->erase(string_t(key, key_len), tid).found;
+	}
+
+	bool
+	update(size_t tid, const char *key, size_t key_len, const char *value,
+		size_t value_len)
+	{
+		return map->update(persistent_map_type::value_type(
+			string_t(key, key_len), string_t(value, value_len)),
+			tid).found;
+	}
+
+	/*
+	 * A query crosses the resizing barrier if an expansion waits for
+	 * this thread.
+	 */
+	void
+	idle(size_t tid)
+	{
+		map->query(idle_key, tid);
+	}
+
+	uint64_t
+	capacity()
+	{
+		return map->capacity();
+	}
+
+	void
+	finish()
+	{
+	}
+
+private:
+	nvobj::persistent_ptr<persistent_map_type> map;
+	string_t idle_key;
+};
+
+} /* Annoymous namespace */
+
+int
+main(int argc, char *argv[])
+{
+	return run_benchmark<level_hash_adapter>(argc, argv);
+}
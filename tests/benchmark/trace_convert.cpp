@@ -0,0 +1,62 @@
+#include <cstdio>
+#include <cstdlib>
+
+#include "trace_format.hpp"
+
+/*
+ * Convert a text workload trace of "OP KEY [TIME_NS]" lines into the
+ * binary format of trace_format.hpp, which the *_bench drivers map and
+ * replay directly.
+ */
+int
+main(int argc, char *argv[])
+{
+	if (argc < 3 || argc > 5) {
+		printf("usage: %s <text_trace> <binary_trace> [partitions] [key_size]\n\n",
+			argv[0]);
+		printf("    text_trace: lines of \"OP KEY [TIME_NS]\", with OP one of INSERT, READ, DELETE and UPDATE\n");
+		printf("    binary_trace: the trace to write\n");
+		printf("    partitions: the number of threads to deal the operations to (default: 1)\n");
+		printf("    key_size: pad or cut the keys to this many bytes, or 0 to keep them (default: 0)\n");
+		exit(1);
+	}
+
+	long partitions = argc > 3 ? atol(argv[3]) : 1;
+	long key_size = argc > 4 ? atol(argv[4]) : 0;
+	if (partitions <= 0 || key_size < 0 || key_size > UINT16_MAX)
+	{
+		printf("invalid partitions or key_size\n");
+		exit(1);
+	}
+
+	trace_builder b(static_cast<uint32_t>(partitions));
+	if (read_text_trace(argv[1], static_cast<size_t>(key_size), false, b) < 0)
+	{
+		printf("failed to read %s, or its lines mix timestamps and none\n",
+			argv[1]);
+		exit(1);
+	}
+
+	FILE *fp = fopen(argv[2], "wb");
+	if (fp == nullptr)
+	{
+		printf("failed to open %s\n", argv[2]);
+		exit(1);
+	}
+	bool ok = b.write(fp);
+	ok = fclose(fp) == 0 && ok;
+	if (!ok)
+	{
+		printf("failed to write %s\n", argv[2]);
+		exit(1);
+	}
+
+	std::vector<char> head = b.head();
+	const trace_header *h = reinterpret_cast<const trace_header *>(head.data());
+	printf("%lu operations in %u partitions, keys of %u to %u bytes%s\n",
+		static_cast<unsigned long>(h->num_ops), h->num_partitions,
+		h->min_key_len, h->max_key_len,
+		(h->flags & TRACE_TIMESTAMPS) ? ", with timestamps" : "");
+
+	return 0;
+}
@@ -0,0 +1,598 @@
+#pragma once
+
+#include <cassert>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <utility>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+ * Binary workload traces, which the benchmark drivers map into memory
+ * and replay without parsing or copying. All integers are little-endian
+ * and nothing is aligned. A trace is
+ *
+ *	trace_header
+ *	trace_partition[num_partitions]
+ *	records of partition 0, records of partition 1, ...
+ *
+ * and each record is
+ *
+ *	uint8_t op			a bench_op
+ *	uint16_t key_len
+ *	uint32_t value_len		if flags has TRACE_VALUES
+ *	uint64_t time_ns		if flags has TRACE_TIMESTAMPS
+ *	key[key_len]
+ *	value[value_len]		if flags has TRACE_VALUES
+ *
+ * A partition is the share of one thread, and time_ns is the arrival
+ * time of the operation since the start of the capture. Records without
+ * a value, or with value_len 0, take the value of the driver.
+ */
+
+enum class bench_op : uint8_t {
+	UNKNOWN,
+	INSERT,
+	READ,
+	DELETE,
+	UPDATE,
+
+	MAX_OP
+};
+
+const size_t bench_op_num = static_cast<size_t>(bench_op::MAX_OP);
+const char *const bench_op_names[] = {"UNKNOWN", "INSERT", "READ", "DELETE",
+	"UPDATE"};
+
+const char trace_magic[8] = {'P', 'M', 'T', 'R', 'A', 'C', 'E', '\0'};
+const uint32_t trace_version = 1;
+
+enum trace_flags : uint32_t {
+	TRACE_VALUES = 1,
+	TRACE_TIMESTAMPS = 2
+};
+
+struct trace_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t flags;
+	uint64_t num_ops;
+	uint32_t num_partitions;
+	uint32_t min_key_len;
+	uint32_t max_key_len;
+	uint32_t reserved;
+	/* the largest time_ns of the trace */
+	uint64_t duration_ns;
+};
+
+struct trace_partition {
+	/* from the start of the trace */
+	uint64_t offset;
+	uint64_t size;
+	uint64_t num_ops;
+};
+
+static_assert(sizeof(trace_header) == 48 && sizeof(trace_partition) == 24,
+	"the trace layout must not have padding");
+
+struct trace_record {
+	bench_op op;
+	const char *key;
+	size_t key_len;
+	/* nullptr if the record has no value */
+	const char *value;
+	size_t value_len;
+	uint64_t time_ns;
+};
+
+/*
+ * Get the size of the record at pos of a trace with flags, or 0 if it
+ * runs past end.
+ */
+inline size_t
+trace_record_size(const char *pos, const char *end, uint32_t flags)
+{
+	size_t fixed = sizeof(uint8_t) + sizeof(uint16_t) +
+		(flags & TRACE_VALUES ? sizeof(uint32_t) : 0) +
+		(flags & TRACE_TIMESTAMPS ? sizeof(uint64_t) : 0);
+	if (static_cast<size_t>(end - pos) < fixed)
+		return 0;
+
+	uint16_t klen;
+	uint32_t vlen = 0;
+	memcpy(&klen, pos + sizeof(uint8_t), sizeof(klen));
+	if (flags & TRACE_VALUES)
+		memcpy(&vlen, pos + sizeof(uint8_t) + sizeof(klen),
+			sizeof(vlen));
+
+	size_t size = fixed + klen + vlen;
+	return static_cast<size_t>(end - pos) < size ? 0 : size;
+}
+
+/*
+ * Builds a trace in memory, dealing the records round-robin to the
+ * partitions. Whether records carry values and timestamps is set by the
+ * first one, and the others must follow it.
+ */
+class trace_builder {
+public:
+	trace_builder(uint32_t num_partitions)
+	    : parts(num_partitions), counts(num_partitions, 0), flags(0),
+	      num_ops(0), min_key_len(UINT16_MAX), max_key_len(0),
+	      duration_ns(0)
+	{
+	}
+
+	/*
+	 * Append a record. Return false if it does not fit the format or
+	 * the records before it.
+	 */
+	bool
+	add(bench_op op, const char *key, size_t key_len, const char *value,
+		size_t value_len, bool has_time, uint64_t time_ns)
+	{
+		uint32_t f = (value != nullptr ? uint32_t(TRACE_VALUES) : 0) |
+			(has_time ? uint32_t(TRACE_TIMESTAMPS) : 0);
+		if (num_ops == 0)
+			flags = f;
+		if (f != flags || key_len > UINT16_MAX ||
+			value_len > UINT32_MAX)
+			return false;
+
+		std::vector<char> &p = parts[num_ops % parts.size()];
+		uint8_t code = static_cast<uint8_t>(op);
+		uint16_t klen = static_cast<uint16_t>(key_len);
+		append(p, &code, sizeof(code));
+		append(p, &klen, sizeof(klen));
+		if (flags & TRACE_VALUES)
+		{
+			uint32_t vlen = static_cast<uint32_t>(value_len);
+			append(p, &vlen, sizeof(vlen));
+		}
+		if (flags & TRACE_TIMESTAMPS)
+			append(p, &time_ns, sizeof(time_ns));
+		append(p, key, key_len);
+		if (flags & TRACE_VALUES)
+			append(p, value, value_len);
+
+		counts[num_ops % parts.size()]++;
+		num_ops++;
+		if (key_len < min_key_len)
+			min_key_len = static_cast<uint32_t>(key_len);
+		if (key_len > max_key_len)
+			max_key_len = static_cast<uint32_t>(key_len);
+		if (time_ns > duration_ns)
+			duration_ns = time_ns;
+
+		return true;
+	}
+
+	uint64_t
+	size() const
+	{
+		return num_ops;
+	}
+
+	/*
+	 * Get the header and the partition table.
+	 */
+	std::vector<char>
+	head() const
+	{
+		trace_header h;
+		memset(&h, 0, sizeof(h));
+		memcpy(h.magic, trace_magic, sizeof(h.magic));
+		h.version = trace_version;
+		h.flags = flags;
+		h.num_ops = num_ops;
+		h.num_partitions = static_cast<uint32_t>(parts.size());
+		h.min_key_len = num_ops > 0 ? min_key_len : 0;
+		h.max_key_len = max_key_len;
+		h.duration_ns = duration_ns;
+
+		std::vector<char> out;
+		append(out, &h, sizeof(h));
+		uint64_t offset = sizeof(h) + parts.size() * sizeof(trace_partition);
+		for (size_t i = 0; i < parts.size(); i++)
+		{
+			trace_partition p = {offset, parts[i].size(), counts[i]};
+			append(out, &p, sizeof(p));
+			offset += parts[i].size();
+		}
+
+		return out;
+	}
+
+	/*
+	 * Get the whole trace, emptying the builder.
+	 */
+	std::vector<char>
+	release()
+	{
+		std::vector<char> out = head();
+		for (auto &p : parts)
+		{
+			out.insert(out.end(), p.begin(), p.end());
+			std::vector<char>().swap(p);
+		}
+
+		return out;
+	}
+
+	bool
+	write(FILE *fp) const
+	{
+		std::vector<char> h = head();
+		if (fwrite(h.data(), 1, h.size(), fp) != h.size())
+			return false;
+		for (const auto &p : parts)
+		{
+			if (fwrite(p.data(), 1, p.size(), fp) != p.size())
+				return false;
+		}
+
+		return true;
+	}
+
+private:
+	static void
+	append(std::vector<char> &v, const void *data, size_t len)
+	{
+		const char *c = static_cast<const char *>(data);
+		v.insert(v.end(), c, c + len);
+	}
+
+	std::vector<std::vector<char>> parts;
+	std::vector<uint64_t> counts;
+	uint32_t flags;
+	uint64_t num_ops;
+	uint32_t min_key_len, max_key_len;
+	uint64_t duration_ns;
+};
+
+inline bench_op
+parse_op(const char *line, size_t &key_offset)
+{
+	static const struct {
+		const char *word;
+		bench_op op;
+	} words[] = {{"INSERT ", bench_op::INSERT}, {"READ ", bench_op::READ},
+		{"DELETE ", bench_op::DELETE}, {"UPDATE ", bench_op::UPDATE}};
+
+	for (const auto &w : words)
+	{
+		size_t len = strlen(w.word);
+		if (strncmp(line, w.word, len) == 0)
+		{
+			key_offset = len;
+			return w.op;
+		}
+	}
+
+	return bench_op::UNKNOWN;
+}
+
+/*
+ * Add the "OP KEY [TIME_NS]" lines of the text trace path to b, with the
+ * keys padded with '0' or cut to key_size bytes unless key_size is 0.
+ * Only INSERT lines are kept if inserts_only is set. Return the number
+ * of operations added, or -1 if the file is unreadable or a line does
+ * not fit the ones before it.
+ */
+inline long
+read_text_trace(const char *path, size_t key_size, bool inserts_only,
+	trace_builder &b)
+{
+	FILE *fp = fopen(path, "r");
+	if (fp == nullptr)
+		return -1;
+
+	char *line = nullptr;
+	size_t cap = 0;
+	long n = 0;
+	std::vector<char> key;
+	while (getline(&line, &cap, fp) != -1)
+	{
+		size_t offset = 0;
+		bench_op op = parse_op(line, offset);
+		if (op == bench_op::UNKNOWN ||
+			(inserts_only && op != bench_op::INSERT))
+			continue;
+
+		const char *k = line + offset;
+		size_t len = strcspn(k, " \r\n");
+		char *end = nullptr;
+		uint64_t time_ns = strtoull(k + len, &end, 10);
+		bool has_time = end != k + len;
+
+		size_t key_len = key_size > 0 ? key_size : len;
+		key.assign(key_len, '0');
+		memcpy(key.data(), k, len < key_len ? len : key_len);
+		if (!b.add(op, key.data(), key_len, nullptr, 0, has_time,
+				time_ns))
+		{
+			n = -1;
+			break;
+		}
+		n++;
+	}
+	free(line);
+	fclose(fp);
+
+	return n;
+}
+
+/*
+ * A binary trace, either mapped from a file or built in memory.
+ */
+class trace_file {
+public:
+	trace_file() : base(nullptr), len(0), mapped(false)
+	{
+	}
+
+	trace_file(const trace_file &) = delete;
+	trace_file &operator=(const trace_file &) = delete;
+
+	~trace_file()
+	{
+		if (mapped)
+			munmap(const_cast<char *>(base), len);
+	}
+
+	/*
+	 * Check whether path starts with the magic of binary traces.
+	 */
+	static bool
+	is_binary(const char *path)
+	{
+		char magic[sizeof(trace_magic)];
+		FILE *fp = fopen(path, "r");
+		if (fp == nullptr)
+			return false;
+
+		bool ret = fread(magic, 1, sizeof(magic), fp) == sizeof(magic) &&
+			memcmp(magic, trace_magic, sizeof(magic)) == 0;
+		fclose(fp);
+
+		return ret;
+	}
+
+	/*
+	 * Map the trace file path. Return false, having printed why, if it
+	 * is unreadable or invalid.
+	 */
+	bool
+	map(const char *path)
+	{
+		int fd = open(path, O_RDONLY);
+		if (fd < 0)
+		{
+			printf("failed to open %s\n", path);
+			return false;
+		}
+
+		struct stat st;
+		if (fstat(fd, &st) != 0 || st.st_size == 0)
+		{
+			printf("failed to stat %s\n", path);
+			close(fd);
+			return false;
+		}
+
+		len = static_cast<size_t>(st.st_size);
+		void *addr = mmap(nullptr, len, PROT_READ, MAP_PRIVATE, fd, 0);
+		close(fd);
+		if (addr == MAP_FAILED)
+		{
+			printf("failed to map %s\n", path);
+			return false;
+		}
+		madvise(addr, len, MADV_SEQUENTIAL);
+
+		base = static_cast<const char *>(addr);
+		mapped = true;
+
+		return check(path);
+	}
+
+	/*
+	 * Take the trace built in image.
+	 */
+	bool
+	adopt(std::vector<char> &&image, const char *name)
+	{
+		owned = std::move(image);
+		base = owned.data();
+		len = owned.size();
+
+		return check(name);
+	}
+
+	const trace_header &
+	header() const
+	{
+		return *reinterpret_cast<const trace_header *>(base);
+	}
+
+	const trace_partition &
+	partition(size_t i) const
+	{
+		return reinterpret_cast<const trace_partition *>(
+			base + sizeof(trace_header))[i];
+	}
+
+	const char *
+	data() const
+	{
+		return base;
+	}
+
+private:
+	bool
+	check(const char *name)
+	{
+		const char *err = nullptr;
+		if (len < sizeof(trace_header) ||
+			memcmp(header().magic, trace_magic,
+				sizeof(trace_magic)) != 0)
+			err = "not a binary trace";
+		else if (header().version != trace_version)
+			err = "unsupported version";
+		else if (header().num_partitions == 0 ||
+			len < sizeof(trace_header) +
+				header().num_partitions *
+					sizeof(trace_partition))
+			err = "truncated partition table";
+
+		for (size_t i = 0; err == nullptr && i < header().num_partitions;
+			i++)
+		{
+			const trace_partition &p = partition(i);
+			if (p.offset > len || p.size > len - p.offset)
+				err = "partition out of the file";
+			else
+			{
+				uint64_t n = count_records(p);
+				if (n == UINT64_MAX)
+					err = "record out of its partition";
+				else if (n != p.num_ops)
+					err = "partition size does not match its operations";
+			}
+		}
+
+		if (err != nullptr)
+		{
+			printf("invalid trace %s: %s\n", name, err);
+			return false;
+		}
+
+		return true;
+	}
+
+	/*
+	 * Count the records of p, or return UINT64_MAX if the last one runs
+	 * past the end of p.
+	 */
+	uint64_t
+	count_records(const trace_partition &p) const
+	{
+		const char *pos = base + p.offset;
+		const char *end = pos + p.size;
+		uint64_t n = 0;
+		while (pos < end)
+		{
+			size_t size = trace_record_size(pos, end, header().flags);
+			if (size == 0)
+				return UINT64_MAX;
+			pos += size;
+			n++;
+		}
+
+		return n;
+	}
+
+	const char *base;
+	size_t len;
+	bool mapped;
+	std::vector<char> owned;
+};
+
+/*
+ * Reads the records of partitions first, first + stride, ... of a trace
+ * in order, and starts over once it reaches the end, shifting the
+ * timestamps past the previous round. Keys and values point into the
+ * trace.
+ */
+class trace_cursor {
+public:
+	trace_cursor(const trace_file &f, size_t first, size_t stride)
+	    : flags(f.header().flags), span(f.header().duration_ns + 1),
+	      round_ns(0), num_ops(0), range(0)
+	{
+		for (size_t i = first; i < f.header().num_partitions; i += stride)
+		{
+			const trace_partition &p = f.partition(i);
+			if (p.num_ops == 0)
+				continue;
+
+			ranges.emplace_back(f.data() + p.offset,
+				f.data() + p.offset + p.size);
+			num_ops += p.num_ops;
+		}
+		pos = ranges.empty() ? nullptr : ranges[0].first;
+	}
+
+	/*
+	 * Get the number of records, which is 0 if there is nothing to
+	 * read.
+	 */
+	uint64_t
+	size() const
+	{
+		return num_ops;
+	}
+
+	/*
+	 * Read the next record. The trace_file checked that the records fit
+	 * their partitions.
+	 */
+	void
+	next(trace_record &r)
+	{
+		assert(trace_record_size(pos, ranges[range].second, flags) != 0);
+
+		uint8_t code;
+		uint16_t klen;
+		uint32_t vlen = 0;
+		uint64_t time_ns = 0;
+
+		read(&code, sizeof(code));
+		read(&klen, sizeof(klen));
+		if (flags & TRACE_VALUES)
+			read(&vlen, sizeof(vlen));
+		if (flags & TRACE_TIMESTAMPS)
+			read(&time_ns, sizeof(time_ns));
+
+		r.op = code < bench_op_num ? static_cast<bench_op>(code)
+					   : bench_op::UNKNOWN;
+		r.key = pos;
+		r.key_len = klen;
+		pos += klen;
+		r.value = vlen > 0 ? pos : nullptr;
+		r.value_len = vlen;
+		pos += vlen;
+		r.time_ns = round_ns + time_ns;
+
+		if (pos >= ranges[range].second)
+		{
+			if (++range == ranges.size())
+			{
+				range = 0;
+				round_ns += span;
+			}
+			pos = ranges[range].first;
+		}
+	}
+
+private:
+	void
+	read(void *dst, size_t n)
+	{
+		memcpy(dst, pos, n);
+		pos += n;
+	}
+
+	uint32_t flags;
+	uint64_t span;
+	uint64_t round_ns;
+	uint64_t num_ops;
+	std::vector<std::pair<const char *, const char *>> ranges;
+	size_t range;
+	const char *pos;
+};
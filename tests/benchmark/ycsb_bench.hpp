@@ -0,0 +1,1073 @@
+#pragma once
+
+#include <libpmemobj++/make_persistent.hpp>
+#include <libpmemobj++/p.hpp>
+#include <libpmemobj++/persistent_ptr.hpp>
+#include <libpmemobj++/pool.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <random>
+#include <thread>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <getopt.h>
+
+#include "../../examples/libpmemobj_cpp_examples_common.hpp"
+#include "../polymorphic_string.h"
+#include "../latency_histogram.hpp"
+#include "../ycsb_generator.hpp"
+#include "trace_format.hpp"
+
+/*
+ * A YCSB driver shared by the hash tables. Each table is wrapped in an
+ * adapter with the members below, and its driver calls
+ * run_benchmark<Adapter>(argc, argv).
+ *
+ *	struct root;			the root object of the pool
+ *	static const char *name();	the name of the table and pool layout
+ *	static const bool supports_update, supports_erase;
+ *	static const size_t min_key_size;	the shortest key it accepts
+ *	Adapter(pool<root> &, const bench_config &);
+ *	size_t background_threads() const;
+ *	bool insert(tid, key, key_len, value, value_len);
+ *	bool read(tid, key, key_len);
+ *	bool erase(tid, key, key_len);
+ *	bool update(tid, key, key_len, value, value_len);
+ *	void idle(tid);			called while a worker waits for the others
+ *	uint64_t capacity();
+ *	void finish();
+ *
+ * The operations return whether the key was inserted, found, erased or
+ * updated, and tid is in [0, threads). Unsupported operations are counted
+ * as skipped and not called.
+ */
+
+namespace nvobj = pmem::obj;
+
+namespace
+{
+
+class key_equal {
+public:
+	template <typename M, typename U>
+	bool operator()(const M &lhs, const U &rhs) const
+	{
+		return lhs == rhs;
+	}
+};
+
+class string_hasher {
+	/* hash multiplier used by fibonacci hashing */
+	static const size_t hash_multiplier = 11400714819323198485ULL;
+
+public:
+	using transparent_key_equal = key_equal;
+
+	size_t operator()(const polymorphic_string &str) const
+	{
+		return hash(str.c_str(), str.size());
+	}
+
+private:
+	size_t hash(const char *str, size_t size) const
+	{
+		size_t h = 0;
+		for (size_t i = 0; i < size; ++i) {
+			h = static_cast<size_t>(str[i]) ^ (h * hash_multiplier);
+		}
+		return h;
+	}
+};
+
+using string_t = polymorphic_string;
+
+enum class key_dist {
+	UNIFORM,
+	ZIPFIAN,
+	LATEST,
+	HOTSPOT,
+
+	MAX_DIST
+};
+
+const char *const key_dist_names[] = {"uniform", "zipfian", "latest",
+	"hotspot"};
+
+struct bench_config {
+	const char *pool_path = nullptr;
+	size_t threads = 1;
+	size_t background_threads = 1;
+	size_t key_size = 15;
+	size_t value_size = 16;
+	const char *load_file = nullptr;
+	const char *run_file = nullptr;
+	uint64_t records = 1000000;
+	uint64_t ops = 0;
+	double duration = 0;
+	double warmup = 0;
+	unsigned mix[bench_op_num] = {0, 0, 50, 0, 50};
+	key_dist dist = key_dist::UNIFORM;
+	double theta = 0.99;
+	double hot_set = 0.2;
+	double hot_ops = 0.8;
+	uint64_t seed = 1;
+	bool large = false;
+	bool latency = false;
+	bool timed = false;
+	const char *json_path = "result.json";
+	const char *tag = "";
+
+	bool
+	use_trace() const
+	{
+		return load_file != nullptr || run_file != nullptr;
+	}
+};
+
+/*
+ * Write the key of id as "user" followed by its lowest key_size - 4
+ * decimal digits, in the manner of YCSB.
+ */
+inline void
+make_key(uint64_t id, char *key, size_t key_size)
+{
+	memcpy(key, "user", 4);
+	for (size_t i = key_size; i > 4; i--)
+	{
+		key[i - 1] = static_cast<char>('0' + id % 10);
+		id /= 10;
+	}
+}
+
+/*
+ * Picks the record a read, update or delete goes to. Uniform, Zipfian
+ * and hotspot keys are among the loaded records, with the popular
+ * Zipfian ones scattered by hashing as in YCSB. Latest keys are Zipfian
+ * by recency among all records inserted so far.
+ */
+class key_chooser {
+public:
+	key_chooser(const bench_config &cfg)
+	    : dist(cfg.dist), records(cfg.records > 0 ? cfg.records : 1),
+	      zipf(dist == key_dist::ZIPFIAN || dist == key_dist::LATEST
+			      ? records : 1, cfg.theta),
+	      hot(records, cfg.hot_set, cfg.hot_ops)
+	{
+	}
+
+	/*
+	 * Draw a record, given that inserted records exist.
+	 */
+	template <typename Rng>
+	uint64_t
+	next(Rng &rng, uint64_t inserted)
+	{
+		switch (dist) {
+		case key_dist::ZIPFIAN:
+			return fnv1a_64(zipf.next(rng)) % records;
+		case key_dist::LATEST:
+			if (inserted == 0)
+				return 0;
+			return inserted - 1 - zipf.next(rng, inserted);
+		case key_dist::HOTSPOT:
+			return hot.next(rng);
+		default:
+			return std::uniform_int_distribution<uint64_t>(0,
+				records - 1)(rng);
+		}
+	}
+
+private:
+	key_dist dist;
+	uint64_t records;
+	zipfian_generator zipf;
+	hotspot_generator hot;
+};
+
+/*
+ * The operations of one thread: its partitions of a trace, replayed from
+ * the start once exhausted, or drawn from the generator. The generator picks
+ * the operation by the mix and the record by the key_chooser, and
+ * inserts new records from a counter shared by the threads. Nothing is
+ * generated ahead, and the stream of a thread depends only on the seed
+ * and the thread, apart from which thread gets which new record.
+ */
+class op_stream {
+public:
+	op_stream(const bench_config &cfg, trace_cursor *trace, size_t tid,
+		const key_chooser &chooser, std::atomic<uint64_t> *next_insert)
+	    : trace(trace), key_size(cfg.key_size), key(cfg.key_size),
+	      rng(cfg.seed * 0x9e3779b97f4a7c15ULL + tid),
+	      pick(0, 99),
+	      chooser(chooser),
+	      next_insert(next_insert)
+	{
+		unsigned bound = 0;
+		for (size_t op = 0; op < bench_op_num; op++)
+		{
+			bound += cfg.mix[op];
+			bounds[op] = bound;
+		}
+	}
+
+	/*
+	 * Get the next operation, whose key and value stay valid until the
+	 * following call.
+	 */
+	void
+	next(trace_record &r)
+	{
+		if (trace != nullptr)
+		{
+			trace->next(r);
+			return;
+		}
+
+		unsigned p = pick(rng);
+		size_t i = 0;
+		while (p >= bounds[i])
+			i++;
+		r.op = static_cast<bench_op>(i);
+
+		uint64_t id = r.op == bench_op::INSERT
+			? next_insert->fetch_add(1, std::memory_order_relaxed)
+			: chooser.next(rng, next_insert->load(
+				std::memory_order_relaxed));
+		make_key(id, key.data(), key_size);
+
+		r.key = key.data();
+		r.key_len = key_size;
+		r.value = nullptr;
+		r.value_len = 0;
+		r.time_ns = 0;
+	}
+
+private:
+	trace_cursor *trace;
+	size_t key_size;
+	std::vector<char> key;
+	std::mt19937_64 rng;
+	std::uniform_int_distribution<unsigned> pick;
+	key_chooser chooser;
+	std::atomic<uint64_t> *next_insert;
+	unsigned bounds[bench_op_num];
+};
+
+struct thread_result {
+	uint64_t count[bench_op_num];
+	uint64_t hits[bench_op_num];
+	uint64_t skipped;
+	latency_histogram *latency;
+	char padding[64];
+};
+
+/*
+ * The operations of all threads.
+ */
+struct bench_totals {
+	uint64_t count[bench_op_num] = {0};
+	uint64_t hits[bench_op_num] = {0};
+	uint64_t total = 0;
+	uint64_t skipped = 0;
+
+	bench_totals(const std::vector<thread_result> &results)
+	{
+		for (const auto &r : results)
+		{
+			for (size_t op = 0; op < bench_op_num; op++)
+			{
+				count[op] += r.count[op];
+				hits[op] += r.hits[op];
+				total += r.count[op];
+			}
+			skipped += r.skipped;
+		}
+	}
+};
+
+inline double
+elapsed_s(std::chrono::steady_clock::time_point from,
+	std::chrono::steady_clock::time_point to)
+{
+	return std::chrono::duration<double>(to - from).count();
+}
+
+inline void
+bench_usage(const char *prog)
+{
+	printf("usage: %s <pool_path> [options]\n\n", prog);
+	printf("    pool_path: the pool file required for PMDK\n");
+	printf("    -t, --threads N: the number of worker threads (default 1)\n");
+	printf("    -b, --background-threads N: the number of background threads of tables that resize in the background (default 1)\n");
+	printf("    -k, --key-size N: the key size in bytes, at least 8 (default 15)\n");
+	printf("    -v, --value-size N: the value size in bytes (default 16)\n");
+	printf("    -l, --load FILE: a text or binary workload file for the load phase\n");
+	printf("    -r, --run FILE: a text or binary workload file for the run phase\n");
+	printf("    -n, --records N: the number of keys the generator loads (default 1000000)\n");
+	printf("    -o, --ops N: the number of operations to run (default: the run file once, or 1000000)\n");
+	printf("    -d, --duration S: run for S seconds instead of a number of operations\n");
+	printf("    -w, --warmup S: run the workload untimed for S seconds first\n");
+	printf("    -m, --mix R,U,I,D: the percentages of reads, updates, inserts and deletes of the generator (default 50,50,0,0)\n");
+	printf("    -D, --dist NAME: the key distribution of the generator, uniform, zipfian, latest or hotspot (default uniform)\n");
+	printf("    -z, --theta T: the skew of zipfian and latest keys, in (0, 1) (default 0.99)\n");
+	printf("    -H, --hotspot S,O: the fractions of hotspot records and of operations on them (default 0.2,0.8)\n");
+	printf("    -W, --workload a|b|c|d|f: the mix and distribution of a YCSB core workload, which later options override\n");
+	printf("    -s, --seed N: the seed of the generator (default 1)\n");
+	printf("    -L, --large: use the initial size of the macro tests\n");
+	printf("    -p, --latency: record the latency of each operation\n");
+	printf("    -T, --timed: issue the operations of the run trace at their captured times, and measure latencies from them\n");
+	printf("    -j, --json FILE: the file of the JSON result, - for stdout (default result.json)\n");
+	printf("    -g, --tag STR: a label copied to the JSON result, e.g. the commit\n");
+}
+
+inline void
+set_mix(bench_config &cfg, unsigned read, unsigned update, unsigned insert,
+	unsigned del)
+{
+	cfg.mix[static_cast<size_t>(bench_op::UNKNOWN)] = 0;
+	cfg.mix[static_cast<size_t>(bench_op::READ)] = read;
+	cfg.mix[static_cast<size_t>(bench_op::UPDATE)] = update;
+	cfg.mix[static_cast<size_t>(bench_op::INSERT)] = insert;
+	cfg.mix[static_cast<size_t>(bench_op::DELETE)] = del;
+}
+
+/*
+ * Set the mix and the distribution of a YCSB core workload. Workload E
+ * is left out as the tables have no range scans, and the
+ * read-modify-writes of F are run as a read and an update apiece.
+ */
+inline bool
+set_workload(bench_config &cfg, const char *w)
+{
+	switch (w[0] == '\0' || w[1] != '\0' ? 0 : w[0] | 0x20) {
+	case 'a':
+		set_mix(cfg, 50, 50, 0, 0);
+		cfg.dist = key_dist::ZIPFIAN;
+		return true;
+	case 'b':
+		set_mix(cfg, 95, 5, 0, 0);
+		cfg.dist = key_dist::ZIPFIAN;
+		return true;
+	case 'c':
+		set_mix(cfg, 100, 0, 0, 0);
+		cfg.dist = key_dist::ZIPFIAN;
+		return true;
+	case 'd':
+		set_mix(cfg, 95, 0, 5, 0);
+		cfg.dist = key_dist::LATEST;
+		return true;
+	case 'f':
+		set_mix(cfg, 50, 50, 0, 0);
+		cfg.dist = key_dist::ZIPFIAN;
+		return true;
+	default:
+		return false;
+	}
+}
+
+/*
+ * Parse the command line into cfg. Return false if it is invalid.
+ */
+inline bool
+parse_args(int argc, char *argv[], bench_config &cfg)
+{
+	static const struct option options[] = {
+		{"threads", required_argument, nullptr, 't'},
+		{"background-threads", required_argument, nullptr, 'b'},
+		{"key-size", required_argument, nullptr, 'k'},
+		{"value-size", required_argument, nullptr, 'v'},
+		{"load", required_argument, nullptr, 'l'},
+		{"run", required_argument, nullptr, 'r'},
+		{"records", required_argument, nullptr, 'n'},
+		{"ops", required_argument, nullptr, 'o'},
+		{"duration", required_argument, nullptr, 'd'},
+		{"warmup", required_argument, nullptr, 'w'},
+		{"mix", required_argument, nullptr, 'm'},
+		{"dist", required_argument, nullptr, 'D'},
+		{"theta", required_argument, nullptr, 'z'},
+		{"hotspot", required_argument, nullptr, 'H'},
+		{"workload", required_argument, nullptr, 'W'},
+		{"seed", required_argument, nullptr, 's'},
+		{"large", no_argument, nullptr, 'L'},
+		{"latency", no_argument, nullptr, 'p'},
+		{"timed", no_argument, nullptr, 'T'},
+		{"json", required_argument, nullptr, 'j'},
+		{"tag", required_argument, nullptr, 'g'},
+		{"help", no_argument, nullptr, 'h'},
+		{nullptr, 0, nullptr, 0}};
+
+	int c;
+	while ((c = getopt_long(argc, argv, "t:b:k:v:l:r:n:o:d:w:m:D:z:H:W:s:LpTj:g:h",
+			options, nullptr)) != -1)
+	{
+		switch (c) {
+		case 't':
+			cfg.threads = strtoul(optarg, nullptr, 10);
+			break;
+		case 'b':
+			cfg.background_threads = strtoul(optarg, nullptr, 10);
+			break;
+		case 'k':
+			cfg.key_size = strtoul(optarg, nullptr, 10);
+			break;
+		case 'v':
+			cfg.value_size = strtoul(optarg, nullptr, 10);
+			break;
+		case 'l':
+			cfg.load_file = optarg;
+			break;
+		case 'r':
+			cfg.run_file = optarg;
+			break;
+		case 'n':
+			cfg.records = strtoull(optarg, nullptr, 10);
+			break;
+		case 'o':
+			cfg.ops = strtoull(optarg, nullptr, 10);
+			break;
+		case 'd':
+			cfg.duration = atof(optarg);
+			break;
+		case 'w':
+			cfg.warmup = atof(optarg);
+			break;
+		case 'm': {
+			unsigned r, u, i, d;
+			if (sscanf(optarg, "%u,%u,%u,%u", &r, &u, &i, &d) != 4 ||
+				r + u + i + d != 100)
+			{
+				printf("the mix must be four percentages adding up to 100\n");
+				return false;
+			}
+			set_mix(cfg, r, u, i, d);
+			break;
+		}
+		case 'D': {
+			size_t d = 0;
+			while (d < static_cast<size_t>(key_dist::MAX_DIST) &&
+				strcmp(optarg, key_dist_names[d]) != 0)
+				d++;
+			if (d == static_cast<size_t>(key_dist::MAX_DIST))
+			{
+				printf("unknown distribution %s\n", optarg);
+				return false;
+			}
+			cfg.dist = static_cast<key_dist>(d);
+			break;
+		}
+		case 'z':
+			cfg.theta = atof(optarg);
+			break;
+		case 'H':
+			if (sscanf(optarg, "%lf,%lf", &cfg.hot_set,
+				&cfg.hot_ops) != 2)
+				return false;
+			break;
+		case 'W':
+			if (!set_workload(cfg, optarg))
+			{
+				printf("unknown workload %s\n", optarg);
+				return false;
+			}
+			break;
+		case 's':
+			cfg.seed = strtoull(optarg, nullptr, 10);
+			break;
+		case 'L':
+			cfg.large = true;
+			break;
+		case 'p':
+			cfg.latency = true;
+			break;
+		case 'T':
+			cfg.timed = true;
+			break;
+		case 'j':
+			cfg.json_path = optarg;
+			break;
+		case 'g':
+			cfg.tag = optarg;
+			break;
+		default:
+			return false;
+		}
+	}
+
+	if (optind != argc - 1)
+		return false;
+	cfg.pool_path = argv[optind];
+
+	if (cfg.threads == 0 || cfg.key_size < 8 || cfg.value_size == 0 ||
+		cfg.duration < 0 || cfg.warmup < 0 || cfg.theta <= 0 ||
+		cfg.theta >= 1 || cfg.hot_set <= 0 || cfg.hot_set > 1 ||
+		cfg.hot_ops < 0 || cfg.hot_ops > 1)
+		return false;
+
+	if (cfg.timed && (cfg.run_file == nullptr || cfg.warmup > 0))
+	{
+		printf("--timed needs a run file and no warmup\n");
+		return false;
+	}
+
+	if (cfg.ops == 0 && cfg.duration == 0 && !cfg.use_trace())
+		cfg.ops = 1000000;
+
+	return true;
+}
+
+inline void
+json_string(FILE *fp, const char *s)
+{
+	if (s == nullptr)
+	{
+		fprintf(fp, "null");
+		return;
+	}
+
+	fputc('"', fp);
+	for (; *s != '\0'; s++)
+	{
+		if (*s == '"' || *s == '\\')
+			fprintf(fp, "\\%c", *s);
+		else if (static_cast<unsigned char>(*s) < 0x20)
+			fprintf(fp, "\\u%04x", *s);
+		else
+			fputc(*s, fp);
+	}
+	fputc('"', fp);
+}
+
+inline void
+json_phase(FILE *fp, uint64_t ops, double secs)
+{
+	fprintf(fp, "{\"ops\": %lu, \"seconds\": %f, \"mops\": %f",
+		static_cast<unsigned long>(ops), secs,
+		secs > 0 ? ops / secs / 1e6 : 0);
+}
+
+/*
+ * Run the operation of r with the adapter, and return whether it hit.
+ * Inserts and updates write the value of r if it has one, or else value
+ * and new_value of value_size bytes.
+ */
+template <typename Adapter>
+bool
+do_op(Adapter &map, size_t tid, const trace_record &r, const char *value,
+	const char *new_value, size_t value_size)
+{
+	switch (r.op) {
+	case bench_op::INSERT:
+		if (r.value != nullptr)
+			return map.insert(tid, r.key, r.key_len, r.value,
+				r.value_len);
+		return map.insert(tid, r.key, r.key_len, value, value_size);
+	case bench_op::READ:
+		return map.read(tid, r.key, r.key_len);
+	case bench_op::DELETE:
+		return map.erase(tid, r.key, r.key_len);
+	case bench_op::UPDATE:
+		if (r.value != nullptr)
+			return map.update(tid, r.key, r.key_len, r.value,
+				r.value_len);
+		return map.update(tid, r.key, r.key_len, new_value,
+			value_size);
+	default:
+		return false;
+	}
+}
+
+/*
+ * Wait until the time due_ns of CLOCK_MONOTONIC, sleeping through most
+ * of a long wait and spinning through the rest.
+ */
+inline void
+wait_until(uint64_t due_ns)
+{
+	uint64_t now = latency_histogram::now_ns();
+	while (now < due_ns)
+	{
+		if (due_ns - now > 100000)
+			std::this_thread::sleep_for(
+				std::chrono::nanoseconds(due_ns - now - 50000));
+		now = latency_histogram::now_ns();
+	}
+}
+
+inline bool
+op_supported(bench_op op, bool supports_update, bool supports_erase)
+{
+	return op != bench_op::UNKNOWN &&
+		(op != bench_op::UPDATE || supports_update) &&
+		(op != bench_op::DELETE || supports_erase);
+}
+
+/*
+ * Run up to limit operations of s, or until stop is set, counting them
+ * in r. With --timed, each operation waits for its captured time after
+ * start_ns, and its latency runs from that time rather than from the
+ * completion of the previous one, so that a table falling behind is
+ * charged for the queueing.
+ */
+template <typename Adapter>
+void
+run_ops(Adapter &map, size_t tid, op_stream &s, const bench_config &cfg,
+	uint64_t limit, const std::atomic<bool> &stop, uint64_t start_ns,
+	thread_result &r)
+{
+	std::vector<char> value(cfg.value_size, 'v');
+	std::vector<char> new_value(cfg.value_size, 'u');
+
+	uint64_t last = cfg.latency ? latency_histogram::now_ns() : 0;
+	for (uint64_t i = 0;
+		i < limit && !stop.load(std::memory_order_relaxed); i++)
+	{
+		trace_record req;
+		s.next(req);
+		size_t idx = static_cast<size_t>(req.op);
+
+		if (!op_supported(req.op, Adapter::supports_update,
+				Adapter::supports_erase))
+		{
+			r.skipped++;
+			continue;
+		}
+
+		if (cfg.timed)
+		{
+			wait_until(start_ns + req.time_ns);
+			last = start_ns + req.time_ns;
+		}
+
+		if (do_op(map, tid, req, value.data(), new_value.data(),
+				cfg.value_size))
+			r.hits[idx]++;
+		r.count[idx]++;
+
+		if (cfg.latency)
+		{
+			// Latencies run from the completion of the previous
+			// operation, so one clock read is taken per operation.
+			uint64_t now = latency_histogram::now_ns();
+			r.latency[idx].record(now - last);
+			last = now;
+		}
+	}
+}
+
+/*
+ * Start n workers running body(tid). A worker that is done keeps calling
+ * idle() until all are, since tables like level hashing expand only once
+ * every worker has reached the barrier.
+ */
+template <typename Adapter, typename Body>
+std::vector<std::thread>
+start_workers(Adapter &map, size_t n, std::atomic<size_t> &done, Body body)
+{
+	std::vector<std::thread> workers;
+	workers.reserve(n);
+	for (size_t t = 0; t < n; t++)
+	{
+		workers.emplace_back([&map, &done, n, body](size_t tid) {
+			body(tid);
+			done.fetch_add(1);
+			while (done.load() < n)
+				map.idle(tid);
+		}, t);
+	}
+
+	return workers;
+}
+
+inline void
+join_workers(std::vector<std::thread> &workers)
+{
+	for (auto &w : workers)
+		w.join();
+}
+
+template <typename Adapter>
+void
+write_json(FILE *fp, const bench_config &cfg, size_t background_threads,
+	uint64_t loaded, double load_secs, double run_secs,
+	const std::vector<thread_result> &results, const bench_totals &sum,
+	uint64_t capacity, uint64_t items)
+{
+
+	fprintf(fp, "{\n  \"index\": ");
+	json_string(fp, Adapter::name());
+	fprintf(fp, ",\n  \"tag\": ");
+	json_string(fp, cfg.tag);
+
+	fprintf(fp, ",\n  \"build\": {\"compiler\": ");
+#ifdef __VERSION__
+	json_string(fp, __VERSION__);
+#else
+	json_string(fp, "unknown");
+#endif
+	fprintf(fp, ", \"date\": ");
+	json_string(fp, __DATE__ " " __TIME__);
+#ifdef TESTS_LIBPMEMOBJ_VERSION
+	fprintf(fp, ", \"libpmemobj_version\": \"0x%x\"",
+		static_cast<unsigned>(TESTS_LIBPMEMOBJ_VERSION));
+#endif
+#ifdef NDEBUG
+	fprintf(fp, ", \"ndebug\": true");
+#else
+	fprintf(fp, ", \"ndebug\": false");
+#endif
+#ifdef LIBPMEMOBJ_CPP_USE_TBB_RW_MUTEX
+	fprintf(fp, ", \"tbb_rw_mutex\": true}");
+#else
+	fprintf(fp, ", \"tbb_rw_mutex\": false}");
+#endif
+
+	fprintf(fp, ",\n  \"config\": {\"threads\": %zu, "
+		"\"background_threads\": %zu, \"key_size\": %zu, "
+		"\"value_size\": %zu, \"workload\": ", cfg.threads,
+		background_threads, cfg.key_size, cfg.value_size);
+	json_string(fp, cfg.use_trace() ? "trace"
+		: key_dist_names[static_cast<size_t>(cfg.dist)]);
+	fprintf(fp, ", \"load_file\": ");
+	json_string(fp, cfg.load_file);
+	fprintf(fp, ", \"run_file\": ");
+	json_string(fp, cfg.run_file);
+	fprintf(fp, ", \"records\": %lu, \"ops\": %lu, \"duration\": %f, "
+		"\"warmup\": %f, \"mix\": {\"read\": %u, \"update\": %u, "
+		"\"insert\": %u, \"delete\": %u}, \"theta\": %f, "
+		"\"hotspot\": {\"set\": %f, \"ops\": %f}, \"seed\": %lu, "
+		"\"large\": %s, \"latency\": %s, \"timed\": %s}",
+		static_cast<unsigned long>(cfg.records),
+		static_cast<unsigned long>(cfg.ops), cfg.duration, cfg.warmup,
+		cfg.mix[static_cast<size_t>(bench_op::READ)],
+		cfg.mix[static_cast<size_t>(bench_op::UPDATE)],
+		cfg.mix[static_cast<size_t>(bench_op::INSERT)],
+		cfg.mix[static_cast<size_t>(bench_op::DELETE)], cfg.theta,
+		cfg.hot_set, cfg.hot_ops, static_cast<unsigned long>(cfg.seed),
+		cfg.large ? "true" : "false", cfg.latency ? "true" : "false",
+		cfg.timed ? "true" : "false");
+
+	fprintf(fp, ",\n  \"load\": ");
+	json_phase(fp, loaded, load_secs);
+	fprintf(fp, "}");
+
+	fprintf(fp, ",\n  \"run\": ");
+	json_phase(fp, sum.total, run_secs);
+	fprintf(fp, ", \"skipped\": %lu, \"operations\": {",
+		static_cast<unsigned long>(sum.skipped));
+
+	latency_histogram *merged = new latency_histogram();
+	bool first = true;
+	for (size_t op = 0; op < bench_op_num; op++)
+	{
+		if (sum.count[op] == 0)
+			continue;
+
+		fprintf(fp, "%s\n    \"%s\": {\"count\": %lu, \"hits\": %lu",
+			first ? "" : ",", bench_op_names[op],
+			static_cast<unsigned long>(sum.count[op]),
+			static_cast<unsigned long>(sum.hits[op]));
+		first = false;
+
+		if (cfg.latency)
+		{
+			merged->reset();
+			for (const auto &r : results)
+				merged->merge(r.latency[op]);
+			fprintf(fp, ", \"latency_ns\": {\"mean\": %f, "
+				"\"p50\": %lu, \"p99\": %lu, \"p99.9\": %lu, "
+				"\"p99.99\": %lu, \"max\": %lu}",
+				merged->mean(),
+				static_cast<unsigned long>(merged->percentile(50)),
+				static_cast<unsigned long>(merged->percentile(99)),
+				static_cast<unsigned long>(merged->percentile(99.9)),
+				static_cast<unsigned long>(merged->percentile(99.99)),
+				static_cast<unsigned long>(merged->max()));
+		}
+		fprintf(fp, "}");
+	}
+	delete merged;
+	fprintf(fp, "%s}}", first ? "" : "\n  ");
+
+	fprintf(fp, ",\n  \"capacity\": %lu, \"items\": %lu, "
+		"\"load_factor\": %f\n}\n", static_cast<unsigned long>(capacity),
+		static_cast<unsigned long>(items),
+		capacity > 0 ? static_cast<double>(items) / capacity : 0);
+}
+
+/*
+ * Open the workload file path as t: map it if it is a binary trace, or
+ * build one from the text with a partition per thread. Return false if
+ * it fails or its keys are shorter than min_key_size.
+ */
+inline bool
+open_trace(const char *path, const bench_config &cfg, bool inserts_only,
+	size_t min_key_size, trace_file &t)
+{
+	if (trace_file::is_binary(path))
+	{
+		if (!t.map(path))
+			return false;
+	}
+	else
+	{
+		trace_builder b(static_cast<uint32_t>(cfg.threads));
+		if (read_text_trace(path, cfg.key_size, inserts_only, b) < 0)
+		{
+			printf("failed to read %s\n", path);
+			return false;
+		}
+		if (!t.adopt(b.release(), path))
+			return false;
+	}
+
+	const trace_header &h = t.header();
+	if (h.num_ops > 0 && h.min_key_len < min_key_size)
+	{
+		printf("%s has keys of %u bytes, shorter than %zu\n", path,
+			h.min_key_len, min_key_size);
+		return false;
+	}
+	if (h.num_partitions < cfg.threads)
+		printf("%s has %u partitions, so %zu of the threads are idle\n",
+			path, h.num_partitions, cfg.threads - h.num_partitions);
+
+	return true;
+}
+
+} /* Annoymous namespace */
+
+/*
+ * Create the pool and the table of Adapter, load it, run the workload
+ * and report the result.
+ */
+template <typename Adapter>
+int
+run_benchmark(int argc, char *argv[])
+{
+	char *ptr = getenv("PMEM_WRITE_LATENCY_IN_NS");
+	if (ptr)
+		printf("PMEM_WRITE_LATENCY_IN_NS set to %s (ns)\n", ptr);
+	else
+		printf("write latency is not set\n");
+
+	bench_config cfg;
+	if (!parse_args(argc, argv, cfg))
+	{
+		bench_usage(argv[0]);
+		exit(1);
+	}
+	size_t n = cfg.threads;
+
+	// prepare the workload
+	trace_file load_trace, run_trace;
+	if (cfg.load_file != nullptr)
+	{
+		if (!open_trace(cfg.load_file, cfg, true, Adapter::min_key_size,
+				load_trace))
+			exit(1);
+		cfg.records = load_trace.header().num_ops;
+	}
+	else if (cfg.use_trace())
+	{
+		cfg.records = 0;
+	}
+
+	if (cfg.run_file != nullptr)
+	{
+		if (!open_trace(cfg.run_file, cfg, false, Adapter::min_key_size,
+				run_trace))
+			exit(1);
+
+		if (cfg.timed && (!(run_trace.header().flags & TRACE_TIMESTAMPS) ||
+				run_trace.header().num_partitions > n))
+		{
+			printf("--timed needs a run trace with timestamps "
+				"and at most one partition per thread\n");
+			exit(1);
+		}
+	}
+
+	// initialize the table
+	nvobj::pool<typename Adapter::root> pop;
+	remove(cfg.pool_path); // delete the mapped file.
+
+	pop = nvobj::pool<typename Adapter::root>::create(cfg.pool_path,
+		Adapter::name(), PMEMOBJ_MIN_POOL * 20480, S_IWUSR | S_IRUSR);
+	Adapter map(pop, cfg);
+	printf("initialization done.\n");
+	printf("%s: initial capacity %lu, %zu worker threads, "
+		"%zu background threads\n", Adapter::name(),
+		static_cast<unsigned long>(map.capacity()), n,
+		map.background_threads());
+
+	// load phase
+	std::vector<uint64_t> load_hits(n, 0);
+	std::atomic<size_t> done(0);
+	auto start = std::chrono::steady_clock::now();
+	auto workers = start_workers(map, n, done, [&](size_t tid) {
+		std::vector<char> value(cfg.value_size, 'v');
+		std::vector<char> key(cfg.key_size);
+		if (cfg.load_file != nullptr)
+		{
+			trace_cursor c(load_trace, tid, n);
+			trace_record r;
+			for (uint64_t i = 0; i < c.size(); i++)
+			{
+				c.next(r);
+				if (r.op == bench_op::INSERT &&
+					do_op(map, tid, r, value.data(), nullptr,
+						cfg.value_size))
+					load_hits[tid]++;
+			}
+		}
+		else if (!cfg.use_trace())
+		{
+			for (uint64_t id = tid; id < cfg.records; id += n)
+			{
+				make_key(id, key.data(), cfg.key_size);
+				if (map.insert(tid, key.data(), cfg.key_size,
+						value.data(), cfg.value_size))
+					load_hits[tid]++;
+			}
+		}
+	});
+	join_workers(workers);
+	double load_secs = elapsed_s(start, std::chrono::steady_clock::now());
+
+	uint64_t loaded = 0;
+	for (uint64_t h : load_hits)
+		loaded += h;
+	printf("Load phase finishes: %lu items are inserted\n",
+		static_cast<unsigned long>(loaded));
+	printf("Load phase time (s): %f, throughput (Mops/s): %f\n",
+		load_secs, loaded / load_secs / 1e6);
+
+	// run phase
+	std::vector<thread_result> results(n);
+	std::vector<thread_result> warmup_results(n);
+	for (size_t t = 0; t < n; t++)
+	{
+		memset(&results[t], 0, sizeof(thread_result));
+		memset(&warmup_results[t], 0, sizeof(thread_result));
+		if (cfg.latency)
+		{
+			results[t].latency = new latency_histogram[bench_op_num];
+			warmup_results[t].latency =
+				new latency_histogram[bench_op_num];
+		}
+	}
+
+	// Set up once, as zeta(n) takes a while, and copied by the threads.
+	key_chooser chooser(cfg);
+	std::atomic<uint64_t> next_insert(cfg.records);
+	std::atomic<bool> stop_warmup(false), stop(false), go(false);
+	std::atomic<size_t> ready(0);
+	std::atomic<uint64_t> start_ns(0);
+	done.store(0);
+	workers = start_workers(map, n, done, [&](size_t tid) {
+		std::unique_ptr<trace_cursor> c;
+		if (cfg.run_file != nullptr)
+			c.reset(new trace_cursor(run_trace, tid, n));
+		op_stream s(cfg, c.get(), tid, chooser, &next_insert);
+		bool empty = cfg.use_trace() && (c == nullptr || c->size() == 0);
+
+		if (cfg.warmup > 0 && !empty)
+			run_ops(map, tid, s, cfg, UINT64_MAX, stop_warmup, 0,
+				warmup_results[tid]);
+
+		ready.fetch_add(1);
+		while (!go.load())
+			map.idle(tid);
+
+		// A trace is replayed once unless --ops or --duration is
+		// given.
+		uint64_t limit = UINT64_MAX;
+		if (empty)
+			limit = 0;
+		else if (cfg.ops > 0)
+			limit = cfg.ops / n + (tid < cfg.ops % n ? 1 : 0);
+		else if (cfg.duration == 0)
+			limit = c->size();
+		run_ops(map, tid, s, cfg, limit, stop, start_ns.load(),
+			results[tid]);
+	});
+
+	if (cfg.warmup > 0)
+	{
+		std::this_thread::sleep_for(std::chrono::duration<double>(cfg.warmup));
+		stop_warmup.store(true);
+	}
+	while (ready.load() < n)
+		std::this_thread::yield();
+
+	printf("Run phase begins\n");
+	start = std::chrono::steady_clock::now();
+	start_ns.store(latency_histogram::now_ns());
+	go.store(true);
+	if (cfg.duration > 0)
+	{
+		std::this_thread::sleep_for(std::chrono::duration<double>(cfg.duration));
+		stop.store(true);
+	}
+	join_workers(workers);
+	double run_secs = elapsed_s(start, std::chrono::steady_clock::now());
+
+	bench_totals sum(results);
+
+	const size_t ins = static_cast<size_t>(bench_op::INSERT);
+	const size_t del = static_cast<size_t>(bench_op::DELETE);
+	uint64_t items = loaded + sum.hits[ins] - sum.hits[del];
+	uint64_t capacity = map.capacity();
+	printf("capacity (after insertion) %lu, load factor %f\n",
+		static_cast<unsigned long>(capacity),
+		capacity > 0 ? static_cast<double>(items) / capacity : 0);
+	for (size_t op = 1; op < bench_op_num; op++)
+	{
+		if (sum.count[op] > 0)
+			printf("%s operations: %lu, %lu hits\n", bench_op_names[op],
+				static_cast<unsigned long>(sum.count[op]),
+				static_cast<unsigned long>(sum.hits[op]));
+	}
+	if (sum.skipped > 0)
+		printf("%lu operations skipped as %s does not support them\n",
+			static_cast<unsigned long>(sum.skipped), Adapter::name());
+	printf("%f seconds\n", run_secs);
+	printf("%f reqs per second (%zu threads)\n", sum.total / run_secs, n);
+
+	if (cfg.latency)
+	{
+		std::vector<latency_histogram *> latency(n);
+		for (size_t t = 0; t < n; t++)
+			latency[t] = results[t].latency;
+		report_latency(latency.data(), n, bench_op_names, bench_op_num);
+	}
+
+	FILE *fp = strcmp(cfg.json_path, "-") == 0 ? stdout
+		: fopen(cfg.json_path, "w");
+	if (fp == nullptr)
+	{
+		printf("failed to open %s\n", cfg.json_path);
+	}
+	else
+	{
+		write_json<Adapter>(fp, cfg, map.background_threads(), loaded,
+			load_secs, run_secs, results, sum, capacity, items);
+		if (fp != stdout)
+			fclose(fp);
+	}
+
+	for (size_t t = 0; t < n; t++)
+	{
+		delete[] results[t].latency;
+		delete[] warmup_results[t].latency;
+	}
+
+	map.finish();
+	pop.close();
+
+	return 0;
+}
@@ -0,0 +1,103 @@
+#include <libpmemobj++/make_persistent.hpp>
+#include <libpmemobj++/p.hpp>
+#include <libpmemobj++/persistent_ptr.hpp>
+#include <libpmemobj++/pool.hpp>
+
+#include <sstream>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cassert>
+
+#include "../../examples/libpmemobj_cpp_examples_common.hpp"
+#include "clevel_hash_fixture.hpp"
+#include <libpmemobj++/experimental/clevel_hash.hpp>
+
+// (2^14 + 2^13) * 8 = 196608
+#define HASH_POWER 14
+
+namespace nvobj = pmem::obj;
+
+namespace
+{
+
+typedef nvobj::experimental::clevel_hash<uint64_t, uint64_t, int_hasher,
+	std::equal_to<uint64_t>, HASH_POWER,
+	nvobj::experimental::pmemobj_kv_allocator<value_t>>
+	pmemobj_map_type;
+
+typedef nvobj::experimental::clevel_hash<uint64_t, uint64_t, int_hasher,
+	std::equal_to<uint64_t>, HASH_POWER,
+	nvobj::experimental::slab_kv_allocator<value_t>>
+	slab_map_type;
+
+/*
+ * Insert n keys and then update each of them once with thread_num threads
+ * on a fresh pool, and report the throughput of both phases. Every key
+ * must then hold its updated value.
+ */
+template <typename Map>
+bool
+run(const char *name, const char *path, size_t n, size_t thread_num)
+{
+	map_pool<Map> pop = create_map_pool<Map>(path);
+	auto map = pop.root()->cons;
+
+	double insert_secs = run_threads(n, thread_num, [&](uint64_t k) {
+		map->insert(value_t(k, k));
+	});
+	double update_secs = run_threads(n, thread_num, [&](uint64_t k) {
+		map->update(value_t(k, k + 1));
+	});
+
+	printf("%s, %zu threads: insert %f Mops/s, update %f Mops/s\n", name,
+		thread_num, n / insert_secs / 1e6, n / update_secs / 1e6);
+
+	size_t wrong = 0;
+	for (uint64_t k = 0; k < n; k++)
+	{
+		typename Map::const_accessor acc;
+		if (!map->find(acc, k) || acc->second != k + 1)
+			wrong++;
+	}
+	if (wrong != 0)
+		printf("%s: %zu keys missing or not updated\n", name, wrong);
+
+	map->stop_rehash_threads();
+	pop.close();
+	remove(path);
+
+	return wrong == 0;
+}
+
+} /* Annoymous namespace */
+
+int
+main(int argc, char *argv[])
+{
+	if (argc != 3 && argc != 4) {
+		printf("usage: %s <pool_path> <key_num> [thread_nums]\n\n", argv[0]);
+		printf("    pool_path: the pool file required for PMDK\n");
+		printf("    key_num: the number of keys inserted in each run\n");
+		printf("    thread_nums: a comma-separated list of thread numbers (default 1,2,4,8,16,32,64)\n");
+		exit(1);
+	}
+
+	const char *path = argv[1];
+	size_t n = static_cast<size_t>(atol(argv[2]));
+	std::vector<size_t> thread_nums;
+	std::stringstream ss(argc == 4 ? argv[3] : "1,2,4,8,16,32,64");
+	std::string item;
+	while (std::getline(ss, item, ','))
+		thread_nums.push_back(static_cast<size_t>(atol(item.c_str())));
+
+	bool ok = true;
+	for (size_t t : thread_nums)
+	{
+		assert(t > 0);
+		ok = run<pmemobj_map_type>("pmemobj", path, n, t) && ok;
+		ok = run<slab_map_type>("slab", path, n, t) && ok;
+	}
+
+	return ok ? 0 : 1;
+}
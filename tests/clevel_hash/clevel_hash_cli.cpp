@@ -58,7 +58,7 @@ insert_item(nvobj::pool<root> &pop, int i)
 	auto map = pop.root()->cons;
 	UT_ASSERT(map != nullptr);
 
-	auto r = map->insert(persistent_map_type::value_type(i, i), 1, static_cast<size_t>(i));
+	auto r = map->insert(persistent_map_type::value_type(i, i));
 
 	if (!r.found)
 	{
@@ -77,7 +77,7 @@ delete_item(nvobj::pool<root> &pop, int i)
 	auto map = pop.root()->cons;
 	UT_ASSERT(map != nullptr);
 
-	auto r = map->erase(persistent_map_type::key_type(i), 1);
+	auto r = map->erase(persistent_map_type::key_type(i));
 
 	if (r.found)
 	{
@@ -152,13 +152,13 @@ main(int argc, char *argv[])
 		nvobj::transaction::manual tx(pop);
 
 		proot->cons = nvobj::make_persistent<persistent_map_type>();
-		proot->cons->set_thread_num(1);
 
 		nvobj::transaction::commit();
 	}
 	else
 	{
 		pop = nvobj::pool<root>::open(path, LAYOUT);
+		pop.root()->cons->runtime_initialize();
 	}
 
 	clevel_op op = parse_clevel_op(argv[2]);
@@ -185,6 +185,7 @@ main(int argc, char *argv[])
 			break;
 	}
 
+	pop.root()->cons->stop_rehash_threads();
 	pop.close();
 
 	return 0;
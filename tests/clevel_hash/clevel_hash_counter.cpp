@@ -0,0 +1,120 @@
+#include <libpmemobj++/make_persistent.hpp>
+#include <libpmemobj++/p.hpp>
+#include <libpmemobj++/persistent_ptr.hpp>
+#include <libpmemobj++/pool.hpp>
+
+#include <cstdio>
+#include <cassert>
+
+#include "../../examples/libpmemobj_cpp_examples_common.hpp"
+#include "clevel_hash_fixture.hpp"
+#include <libpmemobj++/experimental/clevel_hash.hpp>
+
+// (2^10 + 2^9) * 8 = 12288, small enough to resize while counting
+#define HASH_POWER 10
+
+namespace nvobj = pmem::obj;
+
+namespace
+{
+
+typedef nvobj::experimental::clevel_hash<uint64_t, uint64_t, int_hasher,
+	std::equal_to<uint64_t>, HASH_POWER>
+	persistent_map_type;
+
+#ifdef CLEVEL_STATS
+void
+print_stats(const persistent_map_type::stats_snapshot &s)
+{
+	for (int c = 0; c < persistent_map_type::STAT_NUM; c++)
+	{
+		auto counter = static_cast<persistent_map_type::stat_counter_t>(c);
+		printf("    %s: %lu\n", persistent_map_type::stat_name(counter),
+			s[counter]);
+	}
+	printf("    levels per lookup: %f, rehashed items/s: %f\n",
+		s.levels_per_lookup(), s.rehash_rate());
+}
+#endif
+
+} /* Annoymous namespace */
+
+int
+main(int argc, char *argv[])
+{
+	if (argc != 5) {
+		printf("usage: %s <pool_path> <key_num> <op_num> <thread_num>\n\n",
+			argv[0]);
+		printf("    pool_path: the pool file required for PMDK\n");
+		printf("    key_num: the number of counters\n");
+		printf("    op_num: the number of increments\n");
+		printf("    thread_num: the number of threads\n");
+		exit(1);
+	}
+
+	const char *path = argv[1];
+	size_t key_num = static_cast<size_t>(atol(argv[2]));
+	size_t op_num = static_cast<size_t>(atol(argv[3]));
+	size_t thread_num = static_cast<size_t>(atol(argv[4]));
+	assert(key_num > 0 && op_num > 0 && thread_num > 0);
+
+	map_pool<persistent_map_type> pop =
+		create_map_pool<persistent_map_type>(path);
+	auto map = pop.root()->cons;
+
+	// Counters start absent, so the first increments insert them while
+	// the table expands.
+	double secs = run_random_threads(key_num, op_num, thread_num,
+		[&](uint64_t k) { map->fetch_add(k, 1); });
+	printf("fetch_add: %f Mops/s (capacity %lu)\n", op_num / secs / 1e6,
+		map->capacity());
+
+	uint64_t sum = 0;
+	size_t missing = 0;
+	for (uint64_t k = 0; k < key_num; k++)
+	{
+		persistent_map_type::const_accessor acc;
+		if (map->find(acc, k))
+			sum += acc->second;
+		else
+			missing++;
+	}
+	printf("counted %lu of %zu increments, %zu counters missing\n", sum,
+		op_num, missing);
+	bool ok = sum == op_num;
+#ifdef CLEVEL_STATS
+	// Taken after the lookups above, which must all be counted, as well
+	// as the expansions of the table.
+	persistent_map_type::stats_snapshot s = map->stats();
+	print_stats(s);
+	ok = ok && s[persistent_map_type::STAT_LOOKUPS] >= key_num &&
+		s[persistent_map_type::STAT_EXPANSIONS] > 0;
+#endif
+
+	// The racy pattern fetch_add() replaces, for comparison.
+	secs = run_random_threads(key_num, op_num, thread_num,
+		[&](uint64_t k) {
+			persistent_map_type::const_accessor acc;
+			if (map->find(acc, k))
+			{
+				uint64_t v = acc->second + 1;
+				acc.release();
+				map->update(value_t(k, v));
+			}
+			else
+			{
+				map->insert(value_t(k, 1));
+			}
+		});
+	printf("find then update or insert: %f Mops/s\n", op_num / secs / 1e6);
+
+	secs = run_random_threads(key_num, op_num, thread_num,
+		[&](uint64_t k) { map->insert_or_assign(value_t(k, 0)); });
+	printf("insert_or_assign: %f Mops/s\n", op_num / secs / 1e6);
+
+	map->stop_rehash_threads();
+	pop.close();
+	remove(path);
+
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,2 @@
+#define CLEVEL_STATS 1
+#include "clevel_hash_counter.cpp"
@@ -0,0 +1,127 @@
+#pragma once
+
+#include <libpmemobj++/make_persistent.hpp>
+#include <libpmemobj++/persistent_ptr.hpp>
+#include <libpmemobj++/pool.hpp>
+#include <libpmemobj++/transaction.hpp>
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <sys/stat.h>
+
+/*
+ * The fixture of the clevel hashing tests on integer keys: tables of
+ * uint64_t keys and values created on a fresh pool, and helpers to time
+ * operations spread over threads. Each test keeps only its own checks.
+ */
+
+#define CLEVEL_TEST_LAYOUT "clevel_hash"
+
+class int_hasher {
+	/* hash multiplier used by fibonacci hashing */
+	static const size_t hash_multiplier = 11400714819323198485ULL;
+
+public:
+	size_t operator()(uint64_t key) const
+	{
+		return static_cast<size_t>(key * hash_multiplier);
+	}
+};
+
+using value_t = std::pair<const uint64_t, uint64_t>;
+
+template <typename Map>
+struct root {
+	pmem::obj::persistent_ptr<Map> cons;
+};
+
+template <typename Map>
+using map_pool = pmem::obj::pool<root<Map>>;
+
+/*
+ * Create the pool path afresh, with a Map constructed from args as the
+ * table of its root object.
+ */
+template <typename Map, typename... Args>
+map_pool<Map>
+create_map_pool(const char *path, Args &&... args)
+{
+	remove(path);
+	map_pool<Map> pop = map_pool<Map>::create(path, CLEVEL_TEST_LAYOUT,
+		PMEMOBJ_MIN_POOL * 1024, S_IWUSR | S_IRUSR);
+
+	{
+		pmem::obj::transaction::manual tx(pop);
+
+		pop.root()->cons = pmem::obj::make_persistent<Map>(
+			std::forward<Args>(args)...);
+
+		pmem::obj::transaction::commit();
+	}
+
+	return pop;
+}
+
+inline double
+elapsed_s(std::chrono::steady_clock::time_point from,
+	std::chrono::steady_clock::time_point to)
+{
+	return std::chrono::duration<double>(to - from).count();
+}
+
+/*
+ * Run op(k) on the keys k < n, each owned by one of thread_num threads,
+ * and return the elapsed seconds.
+ */
+template <typename Op>
+double
+run_threads(size_t n, size_t thread_num, Op op)
+{
+	std::vector<std::thread> workers;
+	workers.reserve(thread_num);
+
+	auto start = std::chrono::steady_clock::now();
+	for (size_t t = 0; t < thread_num; t++)
+	{
+		workers.emplace_back([&, t]() {
+			for (uint64_t k = t; k < n; k += thread_num)
+				op(k);
+		});
+	}
+	for (auto &w : workers)
+		w.join();
+
+	return elapsed_s(start, std::chrono::steady_clock::now());
+}
+
+/*
+ * Run op(k) op_num times with thread_num threads on random keys below
+ * key_num, and return the elapsed seconds.
+ */
+template <typename Op>
+double
+run_random_threads(size_t key_num, size_t op_num, size_t thread_num, Op op)
+{
+	std::vector<std::thread> workers;
+	workers.reserve(thread_num);
+
+	auto start = std::chrono::steady_clock::now();
+	for (size_t t = 0; t < thread_num; t++)
+	{
+		workers.emplace_back([&, t]() {
+			std::mt19937_64 rng(t + 1);
+			std::uniform_int_distribution<uint64_t> key(0, key_num - 1);
+			for (size_t i = t; i < op_num; i += thread_num)
+				op(key(rng));
+		});
+	}
+	for (auto &w : workers)
+		w.join();
+
+	return elapsed_s(start, std::chrono::steady_clock::now());
+}
@@ -0,0 +1,106 @@
+#define CLEVEL_STATS 1
+
+#include <libpmemobj++/make_persistent.hpp>
+#include <libpmemobj++/p.hpp>
+#include <libpmemobj++/persistent_ptr.hpp>
+#include <libpmemobj++/pool.hpp>
+
+#include <chrono>
+#include <thread>
+#include <cstdio>
+#include <cassert>
+
+#include "../../examples/libpmemobj_cpp_examples_common.hpp"
+#include "clevel_hash_fixture.hpp"
+#include <libpmemobj++/experimental/clevel_hash.hpp>
+
+// (2^10 + 2^9) * 8 = 12288, small enough to resize several times
+#define HASH_POWER 10
+
+namespace nvobj = pmem::obj;
+
+namespace
+{
+
+typedef nvobj::experimental::clevel_hash<uint64_t, uint64_t, int_hasher,
+	std::equal_to<uint64_t>, HASH_POWER>
+	persistent_map_type;
+
+const char *const phases[] = {"insert", "update", "reinsert"};
+
+} /* Annoymous namespace */
+
+int
+main(int argc, char *argv[])
+{
+	if (argc != 4) {
+		printf("usage: %s <pool_path> <key_num> <thread_num>\n\n", argv[0]);
+		printf("    pool_path: the pool file required for PMDK\n");
+		printf("    key_num: the number of keys to insert, update and then insert again\n");
+		printf("    thread_num: the number of threads\n");
+		exit(1);
+	}
+
+	const char *path = argv[1];
+	size_t n = static_cast<size_t>(atol(argv[2]));
+	size_t thread_num = static_cast<size_t>(atol(argv[3]));
+	assert(n > 0 && thread_num > 0);
+
+	map_pool<persistent_map_type> pop =
+		create_map_pool<persistent_map_type>(path);
+	auto map = pop.root()->cons;
+#ifdef CLEVEL_META_FLUSH_ON_READ
+	const char *mode = "flush on read";
+#else
+	const char *mode = "dirty bit";
+#endif
+
+	double per_op[3];
+	for (int phase = 0; phase < 3; phase++)
+	{
+		if (phase == 2)
+		{
+			// Let the background rehashing finish, so that the
+			// persists of the reinserts are counted alone.
+			uint64_t capacity = map->capacity();
+			size_t stable_polls = 0;
+			while (stable_polls < 10)
+			{
+				std::this_thread::sleep_for(
+					std::chrono::milliseconds(50));
+				uint64_t c = map->capacity();
+				stable_polls = c == capacity ? stable_polls + 1 : 0;
+				capacity = c;
+			}
+		}
+
+		uint64_t persists = map->persist_count();
+		double secs = run_threads(n, thread_num, [&](uint64_t k) {
+			if (phase == 1)
+				map->update(value_t(k, k + 1));
+			else
+				map->insert(value_t(k, k));
+		});
+		persists = map->persist_count() - persists;
+		per_op[phase] = static_cast<double>(persists) / n;
+
+		// Persists of the background rehashing are included.
+		printf("%s, %s: %f persists per op, %f Mops/s (capacity %lu)\n",
+			mode, phases[phase], per_op[phase], n / secs / 1e6,
+			map->capacity());
+	}
+
+	// An insert of a present key reads meta once and changes nothing,
+	// so it persists meta only if meta is flushed on every read.
+#ifdef CLEVEL_META_FLUSH_ON_READ
+	bool ok = per_op[2] >= 0.5;
+#else
+	bool ok = per_op[2] < 0.5;
+#endif
+
+	map->stop_rehash_threads();
+	pop.close();
+	remove(path);
+
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,2 @@
+#define CLEVEL_META_FLUSH_ON_READ 1
+#include "clevel_hash_persist.cpp"
\ No newline at end of file
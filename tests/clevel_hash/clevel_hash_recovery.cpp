@@ -0,0 +1,220 @@
+#include <libpmemobj++/make_persistent.hpp>
+#include <libpmemobj++/p.hpp>
+#include <libpmemobj++/persistent_ptr.hpp>
+#include <libpmemobj++/pool.hpp>
+
+#include <iterator>
+#include <thread>
+#include <vector>
+#include <sstream>
+#include <cstdio>
+#include <cassert>
+#include <time.h>
+
+#include "../../examples/libpmemobj_cpp_examples_common.hpp"
+#include "../polymorphic_string.h"
+#include <libpmemobj++/experimental/clevel_hash.hpp>
+
+#define LAYOUT "clevel_hash"
+#define KEY_LEN 15
+
+// (2^14 + 2^13) * 8 = 196608
+#define HASH_POWER 14
+
+namespace nvobj = pmem::obj;
+
+namespace
+{
+
+class key_equal {
+public:
+	template <typename M, typename U>
+	bool operator()(const M &lhs, const U &rhs) const
+	{
+		return lhs == rhs;
+	}
+};
+
+class string_hasher {
+	/* hash multiplier used by fibonacci hashing */
+	static const size_t hash_multiplier = 11400714819323198485ULL;
+
+public:
+	using transparent_key_equal = key_equal;
+
+	size_t operator()(const polymorphic_string &str) const
+	{
+		return hash(str.c_str(), str.size());
+	}
+
+
+private:
+	size_t hash(const char *str, size_t size) const
+	{
+		size_t h = 0;
+		for (size_t i = 0; i < size; ++i) {
+			h = static_cast<size_t>(str[i]) ^ (h * hash_multiplier);
+		}
+		return h;
+	}
+};
+
+using string_t = polymorphic_string;
+typedef nvobj::experimental::clevel_hash<string_t, string_t, string_hasher,
+	std::equal_to<string_t>, HASH_POWER>
+	persistent_map_type;
+
+struct root {
+	nvobj::persistent_ptr<persistent_map_type> cons;
+};
+
+double
+elapsed_ms(const struct timespec &start, const struct timespec &end)
+{
+	return (end.tv_sec - start.tv_sec) * 1000.0 +
+		(end.tv_nsec - start.tv_nsec) / 1000000.0;
+}
+
+void
+print_usage(char *exe)
+{
+	printf("usage: %s <pool_path> <load_file> <mode>\n\n", exe);
+	printf("    pool_path: the pool file required for PMDK\n");
+	printf("    load_file: an insert-only workload file\n");
+	printf("    mode: \"load\" creates the pool and inserts all keys of load_file,\n");
+	printf("          \"reopen\" opens the pool and measures the time to the first query\n");
+}
+
+void
+load(const char *path, const char *load_file)
+{
+	nvobj::pool<root> pop;
+	remove(path); // delete the mapped file.
+
+	pop = nvobj::pool<root>::create(
+		path, LAYOUT, PMEMOBJ_MIN_POOL * 20480, S_IWUSR | S_IRUSR);
+	auto proot = pop.root();
+
+	{
+		nvobj::transaction::manual tx(pop);
+
+		proot->cons = nvobj::make_persistent<persistent_map_type>();
+
+		nvobj::transaction::commit();
+	}
+
+	auto map = pop.root()->cons;
+
+	FILE *ycsb;
+	char buf[1024];
+	char *pbuf = buf;
+	size_t len = 1024;
+	size_t loaded = 0;
+
+	if ((ycsb = fopen(load_file, "r")) == nullptr)
+	{
+		printf("failed to read %s\n", load_file);
+		exit(1);
+	}
+
+	printf("Load phase begins \n");
+	while (getline(&pbuf, &len, ycsb) != -1) {
+		if (strncmp(buf, "INSERT", 6) == 0) {
+			string_t key(buf + 7, KEY_LEN);
+			auto ret = map->insert(
+				persistent_map_type::value_type(key, key));
+			if (!ret.found)
+				loaded++;
+		}
+	}
+	fclose(ycsb);
+	printf("Load phase finishes: %ld items are inserted \n", loaded);
+	printf("capacity %ld\n", map->capacity());
+
+	// Leave the pool without a graceful shutdown, which possibly
+	// interrupts an ongoing rehashing.
+	exit(0);
+}
+
+void
+reopen(const char *path, const char *load_file)
+{
+	FILE *ycsb;
+	char buf[1024];
+	char *pbuf = buf;
+	size_t len = 1024;
+
+	if ((ycsb = fopen(load_file, "r")) == nullptr)
+	{
+		printf("failed to read %s\n", load_file);
+		exit(1);
+	}
+	while (getline(&pbuf, &len, ycsb) != -1 && strncmp(buf, "INSERT", 6) != 0)
+		;
+	fclose(ycsb);
+	string_t key(buf + 7, KEY_LEN);
+
+	struct timespec start, opened, initialized, queried;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	nvobj::pool<root> pop = nvobj::pool<root>::open(path, LAYOUT);
+	auto map = pop.root()->cons;
+	clock_gettime(CLOCK_MONOTONIC, &opened);
+
+	map->runtime_initialize();
+	clock_gettime(CLOCK_MONOTONIC, &initialized);
+
+	auto ret = map->search(key);
+	clock_gettime(CLOCK_MONOTONIC, &queried);
+
+	printf("first query %s\n", ret.found ? "found" : "not found");
+	printf("pool open: %f ms\n", elapsed_ms(start, opened));
+	printf("runtime_initialize: %f ms\n", elapsed_ms(opened, initialized));
+	printf("first query: %f ms\n", elapsed_ms(initialized, queried));
+	printf("time to first query: %f ms\n", elapsed_ms(start, queried));
+
+	// Every key loaded before the crash must survive the recovery.
+	size_t missing = 0;
+	if ((ycsb = fopen(load_file, "r")) == nullptr)
+	{
+		printf("failed to read %s\n", load_file);
+		exit(1);
+	}
+	while (getline(&pbuf, &len, ycsb) != -1) {
+		if (strncmp(buf, "INSERT", 6) == 0) {
+			string_t k(buf + 7, KEY_LEN);
+			if (!map->search(k).found)
+				missing++;
+		}
+	}
+	fclose(ycsb);
+	printf("missing keys after recovery: %zu\n", missing);
+
+	map->stop_rehash_threads();
+	pop.close();
+
+	if (missing != 0)
+		exit(1);
+}
+
+} /* Annoymous namespace */
+
+int
+main(int argc, char *argv[])
+{
+	if (argc != 4) {
+		print_usage(argv[0]);
+		exit(1);
+	}
+
+	if (strcmp(argv[3], "load") == 0)
+		load(argv[1], argv[2]);
+	else if (strcmp(argv[3], "reopen") == 0)
+		reopen(argv[1], argv[2]);
+	else {
+		print_usage(argv[0]);
+		exit(1);
+	}
+
+	return 0;
+}
@@ -0,0 +1,101 @@
+#include <libpmemobj++/make_persistent.hpp>
+#include <libpmemobj++/p.hpp>
+#include <libpmemobj++/persistent_ptr.hpp>
+#include <libpmemobj++/pool.hpp>
+
+#include <chrono>
+#include <cstdio>
+#include <cassert>
+
+#include "../../examples/libpmemobj_cpp_examples_common.hpp"
+#include "clevel_hash_fixture.hpp"
+#include <libpmemobj++/experimental/clevel_hash.hpp>
+
+// (2^10 + 2^9) * 8 = 12288, the initial capacity without reservation
+#define HASH_POWER 10
+
+namespace nvobj = pmem::obj;
+
+namespace
+{
+
+typedef nvobj::experimental::clevel_hash<uint64_t, uint64_t, int_hasher,
+	std::equal_to<uint64_t>, HASH_POWER>
+	persistent_map_type;
+
+enum class sizing { grow, reserve, hash_power };
+
+/*
+ * Insert n keys with thread_num threads on a fresh pool, with the table
+ * sized up front as given, and report the throughput. A table sized up
+ * front must hold the keys at the default load factor of reserve()
+ * without expanding.
+ */
+bool
+run(const char *name, sizing how, const char *path, size_t n,
+	size_t thread_num)
+{
+	// The smallest hash power whose level pair holds n items at the
+	// load factor reserve() uses by default.
+	size_t hash_power = HASH_POWER;
+	while ((size_t(3) << (hash_power - 1)) * 8 * 0.5 < n)
+		hash_power++;
+
+	map_pool<persistent_map_type> pop = how == sizing::hash_power
+		? create_map_pool<persistent_map_type>(path, size_t(1), hash_power)
+		: create_map_pool<persistent_map_type>(path);
+	auto map = pop.root()->cons;
+
+	auto start = std::chrono::steady_clock::now();
+	if (how == sizing::reserve)
+		map->reserve(n);
+	uint64_t sized = map->capacity();
+
+	run_threads(n, thread_num, [&](uint64_t k) {
+		map->insert(value_t(k, k));
+	});
+	double secs = elapsed_s(start, std::chrono::steady_clock::now());
+	uint64_t capacity = map->capacity();
+
+	printf("%s, %zu threads: insert %f Mops/s (capacity %lu)\n", name,
+		thread_num, n / secs / 1e6, capacity);
+
+	// Rehashing the levels below a reservation only lowers the capacity,
+	// while an expansion appends a level larger than them.
+	bool ok = how == sizing::grow ||
+		(sized >= n / 0.5 && capacity <= sized);
+	if (!ok)
+		printf("%s: capacity %lu after sizing, %lu after the load\n",
+			name, sized, capacity);
+
+	map->stop_rehash_threads();
+	pop.close();
+	remove(path);
+
+	return ok;
+}
+
+} /* Annoymous namespace */
+
+int
+main(int argc, char *argv[])
+{
+	if (argc != 4) {
+		printf("usage: %s <pool_path> <key_num> <thread_num>\n\n", argv[0]);
+		printf("    pool_path: the pool file required for PMDK\n");
+		printf("    key_num: the number of keys to insert\n");
+		printf("    thread_num: the number of threads\n");
+		exit(1);
+	}
+
+	const char *path = argv[1];
+	size_t n = static_cast<size_t>(atol(argv[2]));
+	size_t thread_num = static_cast<size_t>(atol(argv[3]));
+	assert(n > 0 && thread_num > 0);
+
+	bool ok = run("grow", sizing::grow, path, n, thread_num);
+	ok = run("reserve", sizing::reserve, path, n, thread_num) && ok;
+	ok = run("hash_power", sizing::hash_power, path, n, thread_num) && ok;
+
+	return ok ? 0 : 1;
+}
@@ -47,6 +47,10 @@ class string_hasher {
 
 public:
 	using transparent_key_equal = key_equal;
+#ifdef CLEVEL_MEMOIZE_HASH
+	// Store hash values in KV entries for rehashing.
+	using memoize_hash = std::true_type;
+#endif
 
 	size_t operator()(const polymorphic_string &str) const
 	{
@@ -70,8 +74,18 @@ private:
 };
 
 using string_t = polymorphic_string;
+
+#ifdef CLEVEL_LOAD_FACTOR_POLICY
+// Expand in the background at a load factor of 85%.
+typedef nvobj::experimental::load_factor_resize_policy<> resize_policy_t;
+#else
+typedef nvobj::experimental::insert_failure_resize_policy resize_policy_t;
+#endif
+
 typedef nvobj::experimental::clevel_hash<string_t, string_t, string_hasher,
-	std::equal_to<string_t>, HASH_POWER>
+	std::equal_to<string_t>, HASH_POWER,
+	nvobj::experimental::pmemobj_kv_allocator<std::pair<const string_t, string_t>>,
+	resize_policy_t>
 	persistent_map_type;
 
 struct root {
@@ -117,14 +131,20 @@ main(int argc, char *argv[])
 #endif
 
 	// parse inputs
-	if (argc != 3) {
-		printf("usage: %s <pool_path> <load_file>\n\n", argv[0]);
+	if (argc < 3 || argc > 5) {
+		printf("usage: %s <pool_path> <load_file> [rehash_thread_num] [expand_watermark]\n\n", argv[0]);
 		printf("    pool_path: the pool file required for PMDK\n");
 		printf("    load_file: an insert-only workload file\n");
+		printf("    rehash_thread_num: the number of background threads for rehashing (default 1)\n");
+		printf("    expand_watermark: the load factor at which the next level is prepared in the background, 0 to disable (default 0.75)\n");
 		exit(1);
 	}
 
 	const char *path = argv[1];
+	size_t rehash_thread_num = 1;
+	if (argc >= 4)
+		rehash_thread_num = static_cast<size_t>(atoi(argv[3]));
+	assert(rehash_thread_num > 0);
 
 	// initialize clevel hash
 	nvobj::pool<root> pop;
@@ -137,13 +157,15 @@ main(int argc, char *argv[])
 	{
 		nvobj::transaction::manual tx(pop);
 
-		proot->cons = nvobj::make_persistent<persistent_map_type>();
-		proot->cons->set_thread_num(1);
+		proot->cons = nvobj::make_persistent<persistent_map_type>(
+			rehash_thread_num);
 
 		nvobj::transaction::commit();
 	}
 
 	auto map = pop.root()->cons;
+	if (argc == 5)
+		map->set_expand_watermark(atof(argv[4]));
 	printf("initialization done.\n");
 	printf("initial capacity %ld\n", map->capacity());
 
@@ -163,11 +185,33 @@ main(int argc, char *argv[])
 
 	printf("Load phase begins \n");
 	fprintf(fout, "inserted,capacity,load_factor\n");
+	struct timespec start, end, op_start, op_end;
+	double max_latency = 0;
+	uint64_t last_capacity = map->capacity();
+	clock_gettime(CLOCK_MONOTONIC, &start);
 	while (getline(&pbuf, &len, ycsb) != -1) {
 		if (strncmp(buf, "INSERT", 6) == 0) {
 			string_t key(buf + 7, KEY_LEN);
-			auto ret = map->insert(persistent_map_type::value_type(key, key), 1, loaded);
+			clock_gettime(CLOCK_MONOTONIC, &op_start);
+			auto ret = map->insert(persistent_map_type::value_type(key, key));
+			clock_gettime(CLOCK_MONOTONIC, &op_end);
+			// Expansions dominate the tail of insert latencies.
+			double latency = (op_end.tv_sec - op_start.tv_sec) * 1000000.0 +
+				(op_end.tv_nsec - op_start.tv_nsec) / 1000.0;
+			if (latency > max_latency)
+				max_latency = latency;
 			if (!ret.found) {
+				// ret.capacity is the capacity when the insertion began.
+				if (ret.capacity > last_capacity)
+				{
+					std::cout << "Expansion at load factor: "
+						<< (loaded - 1) * 1.0 / last_capacity
+						<< " inserted: " << loaded
+						<< " capacity: " << last_capacity << " -> "
+						<< ret.capacity << std::endl;
+				}
+				last_capacity = ret.capacity;
+
 				loaded++;
 				// if (loaded % 10000 == 0)
 				// 	std::cout << "[SUCCESS] inserted " << loaded
@@ -192,10 +236,16 @@ main(int argc, char *argv[])
 			}
 		}
 	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
 	fclose(ycsb);
 	fclose(fout);
-	printf("Load phase finishes: %ld items are inserted \n", loaded);
+	double elapsed_sec = (end.tv_sec - start.tv_sec) +
+		(end.tv_nsec - start.tv_nsec) / 1000000000.0;
+	printf("Load phase finishes: %ld items are inserted in %f seconds (%f reqs per second)\n",
+		loaded, elapsed_sec, loaded / elapsed_sec);
+	printf("Max insert latency: %f us\n", max_latency);
 
+	map->stop_rehash_threads();
 	pop.close();
 
 	return 0;
@@ -0,0 +1,2 @@
+#define CLEVEL_LOAD_FACTOR_POLICY 1
+#include "clevel_hash_resize.cpp"
\ No newline at end of file
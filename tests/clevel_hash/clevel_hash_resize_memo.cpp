@@ -0,0 +1,2 @@
+#define CLEVEL_MEMOIZE_HASH 1
+#include "clevel_hash_resize.cpp"
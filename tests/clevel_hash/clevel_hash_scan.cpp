@@ -0,0 +1,119 @@
+#include <libpmemobj++/make_persistent.hpp>
+#include <libpmemobj++/p.hpp>
+#include <libpmemobj++/persistent_ptr.hpp>
+#include <libpmemobj++/pool.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <cstdio>
+#include <cassert>
+
+#include "../../examples/libpmemobj_cpp_examples_common.hpp"
+#include "clevel_hash_fixture.hpp"
+#include <libpmemobj++/experimental/clevel_hash.hpp>
+
+// (2^10 + 2^9) * 8 = 12288, small enough to resize during the scans
+#define HASH_POWER 10
+
+namespace nvobj = pmem::obj;
+
+namespace
+{
+
+typedef nvobj::experimental::clevel_hash<uint64_t, uint64_t, int_hasher,
+	std::equal_to<uint64_t>, HASH_POWER>
+	persistent_map_type;
+
+/*
+ * Count the keys below n not visited exactly once, and reset the visits.
+ */
+size_t
+check_visits(std::unique_ptr<std::atomic<uint32_t>[]> &visits, size_t n)
+{
+	size_t wrong = 0;
+	for (size_t k = 0; k < n; k++)
+	{
+		if (visits[k].load() != 1)
+			wrong++;
+		visits[k].store(0);
+	}
+
+	return wrong;
+}
+
+} /* Annoymous namespace */
+
+int
+main(int argc, char *argv[])
+{
+	if (argc != 4) {
+		printf("usage: %s <pool_path> <key_num> <thread_num>\n\n", argv[0]);
+		printf("    pool_path: the pool file required for PMDK\n");
+		printf("    key_num: the number of keys present during the scans\n");
+		printf("    thread_num: the number of threads of parallel_scan\n");
+		exit(1);
+	}
+
+	const char *path = argv[1];
+	size_t n = static_cast<size_t>(atol(argv[2]));
+	size_t thread_num = static_cast<size_t>(atol(argv[3]));
+	assert(n > 0 && thread_num > 0);
+
+	map_pool<persistent_map_type> pop =
+		create_map_pool<persistent_map_type>(path);
+	auto map = pop.root()->cons;
+	for (uint64_t k = 0; k < n; k++)
+		map->insert(value_t(k, k));
+
+	// Keys from n on are inserted during the scans, which keeps the
+	// table resizing.
+	std::atomic<bool> run_inserter(true);
+	std::thread inserter([&]() {
+		for (uint64_t k = n; run_inserter.load(); k++)
+			map->insert(value_t(k, k));
+	});
+
+	std::unique_ptr<std::atomic<uint32_t>[]> visits(
+		new std::atomic<uint32_t>[n]());
+	size_t wrong = 0;
+
+	auto start = std::chrono::steady_clock::now();
+	size_t items = 0;
+	for (auto it = map->begin(); it != map->end(); ++it)
+	{
+		if (it->first < n)
+			visits[it->first].fetch_add(1);
+		items++;
+	}
+	double secs = elapsed_s(start, std::chrono::steady_clock::now());
+	size_t iter_wrong = check_visits(visits, n);
+	wrong += iter_wrong;
+	printf("iterator: %zu items, %f Mitems/s, %zu keys not visited once\n",
+		items, items / secs / 1e6, iter_wrong);
+
+	std::atomic<size_t> scanned(0);
+	start = std::chrono::steady_clock::now();
+	map->parallel_scan(thread_num, [&](const value_t &v) {
+		if (v.first < n)
+			visits[v.first].fetch_add(1, std::memory_order_relaxed);
+		scanned.fetch_add(1, std::memory_order_relaxed);
+	});
+	secs = elapsed_s(start, std::chrono::steady_clock::now());
+	size_t scan_wrong = check_visits(visits, n);
+	wrong += scan_wrong;
+	printf("parallel_scan with %zu threads: %zu items, %f Mitems/s, "
+		"%zu keys not visited once\n", thread_num, scanned.load(),
+		scanned.load() / secs / 1e6, scan_wrong);
+
+	run_inserter.store(false);
+	inserter.join();
+	printf("capacity %lu\n", map->capacity());
+
+	map->stop_rehash_threads();
+	pop.close();
+	remove(path);
+
+	return wrong == 0 ? 0 : 1;
+}
@@ -0,0 +1,102 @@
+#include <libpmemobj++/make_persistent.hpp>
+#include <libpmemobj++/p.hpp>
+#include <libpmemobj++/persistent_ptr.hpp>
+#include <libpmemobj++/pool.hpp>
+
+#include <chrono>
+#include <thread>
+#include <cstdio>
+#include <cassert>
+
+#include "../../examples/libpmemobj_cpp_examples_common.hpp"
+#include "clevel_hash_fixture.hpp"
+#include <libpmemobj++/experimental/clevel_hash.hpp>
+
+// (2^10 + 2^9) * 8 = 12288, the capacity the table shrinks back to
+#define HASH_POWER 10
+
+namespace nvobj = pmem::obj;
+
+namespace
+{
+
+typedef nvobj::experimental::clevel_hash<uint64_t, uint64_t, int_hasher,
+	std::equal_to<uint64_t>, HASH_POWER,
+	nvobj::experimental::pmemobj_kv_allocator<value_t>,
+	nvobj::experimental::load_factor_resize_policy<>>
+	persistent_map_type;
+
+} /* Annoymous namespace */
+
+int
+main(int argc, char *argv[])
+{
+	if (argc != 4 && argc != 5) {
+		printf("usage: %s <pool_path> <key_num> <thread_num> [erase_percent]\n\n", argv[0]);
+		printf("    pool_path: the pool file required for PMDK\n");
+		printf("    key_num: the number of keys to insert\n");
+		printf("    thread_num: the number of threads\n");
+		printf("    erase_percent: the percentage of keys erased afterwards (default 95)\n");
+		exit(1);
+	}
+
+	const char *path = argv[1];
+	size_t n = static_cast<size_t>(atol(argv[2]));
+	size_t thread_num = static_cast<size_t>(atol(argv[3]));
+	uint64_t erase_percent = argc == 5 ? static_cast<uint64_t>(atol(argv[4])) : 95;
+	assert(n > 0 && thread_num > 0 && erase_percent <= 100);
+
+	map_pool<persistent_map_type> pop =
+		create_map_pool<persistent_map_type>(path);
+	auto map = pop.root()->cons;
+	auto erased = [&](uint64_t k) { return k % 100 < erase_percent; };
+
+	run_threads(n, thread_num, [&](uint64_t k) {
+		map->insert(value_t(k, k));
+	});
+	printf("after insert: capacity %lu, items %zu\n", map->capacity(),
+		map->item_count());
+
+	run_threads(n, thread_num, [&](uint64_t k) {
+		if (erased(k))
+			map->erase(k);
+	});
+	uint64_t capacity = map->capacity();
+	printf("after erase: capacity %lu, items %zu\n", capacity,
+		map->item_count());
+
+	double secs = run_threads(n, thread_num, [&](uint64_t k) {
+		map->search(k);
+	});
+	printf("search before shrinking: %f Mops/s\n", n / secs / 1e6);
+
+	// The expand thread shrinks the table step by step once the load
+	// factor stays low. Wait until the capacity settles.
+	size_t stable_polls = 0;
+	while (stable_polls < 30)
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+		uint64_t c = map->capacity();
+		stable_polls = c == capacity ? stable_polls + 1 : 0;
+		capacity = c;
+	}
+	printf("after shrinking: capacity %lu, load factor %f\n", capacity,
+		static_cast<double>(map->item_count()) / capacity);
+
+	size_t missing = 0, stale = 0;
+	secs = run_threads(n, thread_num, [&](uint64_t k) {
+		bool found = map->search(k).found;
+		if (!erased(k) && !found)
+			__sync_fetch_and_add(&missing, 1);
+		else if (erased(k) && found)
+			__sync_fetch_and_add(&stale, 1);
+	});
+	printf("search after shrinking: %f Mops/s\n", n / secs / 1e6);
+	printf("missing keys: %zu, erased keys found: %zu\n", missing, stale);
+
+	map->stop_rehash_threads();
+	pop.close();
+	remove(path);
+
+	return missing == 0 && stale == 0 ? 0 : 1;
+}
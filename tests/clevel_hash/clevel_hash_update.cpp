@@ -0,0 +1,127 @@
+#define CLEVEL_STATS 1
+
+#include <libpmemobj++/make_persistent.hpp>
+#include <libpmemobj++/p.hpp>
+#include <libpmemobj++/persistent_ptr.hpp>
+#include <libpmemobj++/pool.hpp>
+
+#include <chrono>
+#include <random>
+#include <thread>
+#include <vector>
+#include <cstdio>
+#include <cassert>
+
+#include "../../examples/libpmemobj_cpp_examples_common.hpp"
+#include "../ycsb_generator.hpp"
+#include "clevel_hash_fixture.hpp"
+#include <libpmemobj++/experimental/clevel_hash.hpp>
+
+// YCSB workload A: 50% reads and 50% updates of Zipfian keys.
+#define READ_PERCENT 50
+#define ZIPF_THETA 0.99
+
+namespace nvobj = pmem::obj;
+
+namespace
+{
+
+typedef nvobj::experimental::clevel_hash<uint64_t, uint64_t, int_hasher,
+	std::equal_to<uint64_t>>
+	persistent_map_type;
+
+} /* Annoymous namespace */
+
+int
+main(int argc, char *argv[])
+{
+	if (argc != 5) {
+		printf("usage: %s <pool_path> <key_num> <op_num> <thread_num>\n\n",
+			argv[0]);
+		printf("    pool_path: the pool file required for PMDK\n");
+		printf("    key_num: the number of keys to load\n");
+		printf("    op_num: the number of reads and updates to run\n");
+		printf("    thread_num: the number of threads\n");
+		exit(1);
+	}
+
+	const char *path = argv[1];
+	size_t n = static_cast<size_t>(atol(argv[2]));
+	size_t op_num = static_cast<size_t>(atol(argv[3]));
+	size_t thread_num = static_cast<size_t>(atol(argv[4]));
+	assert(n > 1 && op_num > 0 && thread_num > 0);
+
+	map_pool<persistent_map_type> pop =
+		create_map_pool<persistent_map_type>(path);
+	auto map = pop.root()->cons;
+	map->reserve(n);
+	for (uint64_t k = 0; k < n; k++)
+		map->insert(value_t(k, 0));
+
+	// Scatter the hot keys over the table.
+	zipfian_generator gen(n, ZIPF_THETA);
+	auto scramble = [n](uint64_t rank) {
+		return (rank * 11400714819323198485ULL) % n;
+	};
+
+	std::vector<std::thread> workers;
+	workers.reserve(thread_num);
+	std::vector<size_t> updated(thread_num, 0);
+
+	uint64_t persists = map->persist_count();
+	auto start = std::chrono::steady_clock::now();
+	for (size_t t = 0; t < thread_num; t++)
+	{
+		workers.emplace_back([&, t]() {
+			std::mt19937_64 rng(t + 1);
+			std::uniform_int_distribution<int> op(0, 99);
+			zipfian_generator z = gen;
+			for (size_t i = t; i < op_num; i += thread_num)
+			{
+				uint64_t k = scramble(z.next(rng));
+				if (op(rng) < READ_PERCENT)
+				{
+					map->search(k);
+				}
+				else
+				{
+					map->update(value_t(k, i));
+					updated[t]++;
+				}
+			}
+		});
+	}
+	for (auto &w : workers)
+		w.join();
+	double secs = elapsed_s(start, std::chrono::steady_clock::now());
+	persists = map->persist_count() - persists;
+
+	size_t n_updates = 0;
+	for (size_t u : updated)
+		n_updates += u;
+
+	printf("%s update: %f persists per update, %f Mops/s\n",
+		persistent_map_type::in_place_update ? "in-place" : "out-of-place",
+		static_cast<double>(persists) / n_updates, op_num / secs / 1e6);
+
+	// Values written last by known updates must be read back, whichever
+	// way they are written.
+	run_threads(n, thread_num, [&](uint64_t k) {
+		map->update(value_t(k, k + 1));
+	});
+
+	size_t wrong = 0;
+	for (uint64_t k = 0; k < n; k++)
+	{
+		persistent_map_type::const_accessor acc;
+		if (!map->find(acc, k) || acc->second != k + 1)
+			wrong++;
+	}
+	printf("keys missing or with a wrong value: %zu\n", wrong);
+
+	map->stop_rehash_threads();
+	pop.close();
+	remove(path);
+
+	return wrong == 0 ? 0 : 1;
+}
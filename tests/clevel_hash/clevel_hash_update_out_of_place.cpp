@@ -0,0 +1,2 @@
+#define CLEVEL_UPDATE_OUT_OF_PLACE 1
+#include "clevel_hash_update.cpp"
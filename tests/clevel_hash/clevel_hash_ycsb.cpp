@@ -14,6 +14,7 @@
 #include "../../examples/libpmemobj_cpp_examples_common.hpp"
 #include "../polymorphic_string.h"
 #include "../profile.hpp"
+#include "../latency_histogram.hpp"
 #include <libpmemobj++/experimental/clevel_hash.hpp>
 
 #define LAYOUT "clevel_hash"
@@ -109,7 +110,7 @@ struct sub_thread {
 	uint64_t upd_existing;
 	uint64_t thread_num;
 	thread_queue *run_queue;
-	double *latency_queue;
+	latency_histogram *latency;
 };
 
 } /* Annoymous namespace */
@@ -128,12 +129,14 @@ main(int argc, char *argv[])
 #endif
 
 	// parse inputs
-	if (argc != 5) {
-		printf("usage: %s <pool_path> <load_file> <run_file> <thread_num>\n\n", argv[0]);
+	if (argc < 5 || argc > 7) {
+		printf("usage: %s <pool_path> <load_file> <run_file> <thread_num> [rehash_thread_num] [read_batches]\n\n", argv[0]);
 		printf("    pool_path: the pool file required for PMDK\n");
 		printf("    load_file: a workload file for the load phase\n");
 		printf("    run_file: a workload file for the run phase\n");
 		printf("    thread_num: the number of threads (>=2)\n");
+		printf("    rehash_thread_num: the number of background threads for rehashing (default 1)\n");
+		printf("    read_batches: comma-separated batch sizes of multi_search to replay the READ queries with (e.g. 1,16,64)\n");
 		exit(1);
 	}
 
@@ -143,10 +146,25 @@ main(int argc, char *argv[])
 	size_t thread_num;
 
 	std::stringstream s;
+	size_t rehash_thread_num = 1;
+
 	s << argv[4];
 	s >> thread_num;
 
-	assert(thread_num > 1);
+	if (argc >= 6)
+		rehash_thread_num = static_cast<size_t>(atoi(argv[5]));
+
+	std::vector<size_t> read_batches;
+	if (argc == 7)
+	{
+		std::stringstream b(argv[6]);
+		std::string item;
+		while (std::getline(b, item, ','))
+			read_batches.push_back(static_cast<size_t>(atoi(item.c_str())));
+	}
+
+	assert(rehash_thread_num > 0);
+	assert(thread_num > rehash_thread_num);
 
 	// initialize clevel hash
 	nvobj::pool<root> pop;
@@ -159,8 +177,8 @@ main(int argc, char *argv[])
 	{
 		nvobj::transaction::manual tx(pop);
 
-		proot->cons = nvobj::make_persistent<persistent_map_type>();
-		proot->cons->set_thread_num(2);
+		proot->cons = nvobj::make_persistent<persistent_map_type>(
+			rehash_thread_num);
 
 		nvobj::transaction::commit();
 	}
@@ -186,27 +204,36 @@ main(int argc, char *argv[])
 
 	printf("Load phase begins \n");
 
+	std::vector<persistent_map_type::value_type> load_items;
 	while (getline(&pbuf, &len, ycsb) != -1) {
 		if (strncmp(buf, "INSERT", 6) == 0) {
 			string_t key(buf + 7, KEY_LEN);
-			auto ret = map->insert(persistent_map_type::value_type(key, key), 1, loaded);
-			if (!ret.found) {
-				loaded++;
-			} else {
-				break;
-			}
+			load_items.emplace_back(key, key);
 		}
 	}
 	fclose(ycsb);
-	printf("Load phase finishes: %ld items are inserted \n", loaded);
-
-	{
-		nvobj::transaction::manual tx(pop);
-
-		map->set_thread_num(thread_num);
 
-		nvobj::transaction::commit();
+	struct timespec load_start, load_end;
+	clock_gettime(CLOCK_MONOTONIC, &load_start);
+#ifdef CLEVEL_BULK_LOAD
+	loaded = map->bulk_load(load_items.begin(), load_items.end(),
+		thread_num - rehash_thread_num);
+#else
+	for (auto &item : load_items) {
+		auto ret = map->insert(item);
+		if (!ret.found) {
+			loaded++;
+		} else {
+			break;
+		}
 	}
+#endif
+	clock_gettime(CLOCK_MONOTONIC, &load_end);
+	double load_elapsed = (load_end.tv_sec - load_start.tv_sec) +
+		(load_end.tv_nsec - load_start.tv_nsec) / 1000000000.0;
+	printf("Load phase finishes: %ld items are inserted \n", loaded);
+	printf("Load phase time (s): %f, throughput (Mops/s): %f\n",
+		load_elapsed, loaded / load_elapsed / 1000000.0);
 
 	// prepare data for the run phase
 	if ((ycsb_read = fopen(argv[3], "r")) == NULL) {
@@ -214,13 +241,14 @@ main(int argc, char *argv[])
 		exit(1);
 	}
 
-	thread_num--; // one thread reserved for background resizing
+	// threads reserved for background resizing
+	thread_num -= rehash_thread_num;
 	thread_queue* run_queue[thread_num];
-	double* latency_queue[thread_num];
+	latency_histogram* latency[thread_num];
     int move[thread_num];
     for(size_t t = 0; t < thread_num; t ++){
         run_queue[t] = (thread_queue *)calloc(READ_WRITE_NUM / thread_num + 1, sizeof(thread_queue));
-		latency_queue[t] = (double *)calloc(READ_WRITE_NUM / thread_num + 1, sizeof(double));
+		latency[t] = new latency_histogram[static_cast<size_t>(clevel_op::MAX_OP)];
         move[t] = 0;
     }
 
@@ -266,31 +294,31 @@ main(int argc, char *argv[])
 		THREADS[t].upd_existing = 0;
 		THREADS[t].thread_num = thread_num;
 		THREADS[t].run_queue = run_queue[t];
-		THREADS[t].latency_queue = latency_queue[t];
+		THREADS[t].latency = latency[t];
     }
 
     std::vector<std::thread> threads;
     threads.reserve(thread_num);
 
 	struct timespec start, end;
-#ifdef LATENCY_ENABLE
-	struct timespec stop;
-#endif
     clock_gettime(CLOCK_MONOTONIC, &start);
 
 	for (size_t i = 0; i < thread_num; i++)
 	{
 		threads.emplace_back([&](size_t thread_id) {
 			printf("Thread %ld is opened\n", thread_id);
-			size_t offset = loaded + READ_WRITE_NUM / thread_num * thread_id;
+#ifdef LATENCY_ENABLE
+			// Latencies run from the completion of the previous
+			// operation, so one clock read is taken per operation.
+			uint64_t last = latency_histogram::now_ns();
+#endif
 			for (size_t j = 0; j < READ_WRITE_NUM / thread_num; j++)
 			{
 				if (THREADS[thread_id].run_queue[j].operation == clevel_op::INSERT)
 				{
 					auto ret = map->insert(persistent_map_type::value_type(
 						THREADS[thread_id].run_queue[j].key,
-						THREADS[thread_id].run_queue[j].key),
-					thread_id + 1, offset + j);
+						THREADS[thread_id].run_queue[j].key));
 					if (!ret.found)
 					{
 						THREADS[thread_id].inserted++;
@@ -302,9 +330,8 @@ main(int argc, char *argv[])
 				}
 				else if (THREADS[thread_id].run_queue[j].operation == clevel_op::READ)
 				{
-					auto ret = map->search(persistent_map_type::key_type(
-						THREADS[thread_id].run_queue[j].key));
-					if (ret.found)
+					persistent_map_type::const_accessor acc;
+					if (map->find(acc, THREADS[thread_id].run_queue[j].key))
 					{
 						THREADS[thread_id].found++;
 					}
@@ -316,7 +343,7 @@ main(int argc, char *argv[])
 				else if (THREADS[thread_id].run_queue[j].operation == clevel_op::DELETE)
 				{
 					auto ret = map->erase(persistent_map_type::key_type(
-						THREADS[thread_id].run_queue[j].key), thread_id + 1);
+						THREADS[thread_id].run_queue[j].key));
 					THREADS[thread_id].deleted++;
 					if (ret.found)
 					{
@@ -328,8 +355,7 @@ main(int argc, char *argv[])
 					string_t new_val = THREADS[thread_id].run_queue[j].key;
 					new_val[0] = ~new_val[0];
 					auto ret = map->update(persistent_map_type::value_type(
-						THREADS[thread_id].run_queue[j].key, new_val),
-						thread_id + 1);
+						THREADS[thread_id].run_queue[j].key, new_val));
 					THREADS[thread_id].updated++;
 					if (ret.found)
 					{
@@ -342,9 +368,10 @@ main(int argc, char *argv[])
 					exit(1);
 				}
 #ifdef LATENCY_ENABLE
-				clock_gettime(CLOCK_MONOTONIC, &stop);
-				THREADS[thread_id].latency_queue[j] = stop.tv_sec * 1000000000.0 + stop.tv_nsec;
-				assert(THREADS[thread_id].latency_queue[j] > 0);
+				uint64_t now = latency_histogram::now_ns();
+				THREADS[thread_id].latency[static_cast<size_t>(
+					THREADS[thread_id].run_queue[j].operation)].record(now - last);
+				last = now;
 #endif
 			}
 		}, i);
@@ -386,42 +413,78 @@ main(int argc, char *argv[])
 	fprintf(fp, "%f", READ_WRITE_NUM / elapsed_sec);
 	fclose(fp);
 
-#ifdef LATENCY_ENABLE
-    double start_time = start.tv_sec * 1000000000.0 + start.tv_nsec;
-    double latency = 0;
-    double total_latency = 0;
-    FILE *fp_time = fopen("clevel_hash_processing_time.txt", "w");
-    for (size_t t = 0; t < thread_num; ++t)
-    {
-        for (size_t i = 0; i < READ_WRITE_NUM / thread_num; i++)
-        {
-            latency = THREADS[t].latency_queue[i] - start_time;
-            total_latency += latency;
-            fprintf(fp_time, "%f\n", latency);
-        }
-    }
-	printf("Average time: %f (ns)\n", total_latency * 1.0 / READ_WRITE_NUM);
+	// Replay the READ queries of each thread with multi_search. The batch
+	// size 1 uses search() as the baseline. The keys are gathered before
+	// the clock starts, so only the lookups are timed.
+	std::vector<std::vector<persistent_map_type::key_type>> read_keys(thread_num);
+	for (size_t i = 0; i < thread_num; i++)
+	{
+		for (size_t j = 0; j < READ_WRITE_NUM / thread_num; j++)
+		{
+			if (THREADS[i].run_queue[j].operation == clevel_op::READ)
+				read_keys[i].push_back(THREADS[i].run_queue[j].key);
+		}
+	}
 
-	total_latency = 0;
-	FILE *fp_latency = fopen("clevel_hash_latency.txt", "w");
-	for (size_t t = 0; t < thread_num; ++t)
+	for (size_t batch : read_batches)
 	{
-		latency = THREADS[t].latency_queue[0] - start_time;
-		total_latency += latency;
-		fprintf(fp_latency, "%f\n", latency);
-
-		for (size_t i = 1; i < READ_WRITE_NUM / thread_num; i++)
-        {
-            latency = THREADS[t].latency_queue[i] - THREADS[t].latency_queue[i-1];
-            total_latency += latency;
-            fprintf(fp_latency, "%f\n", latency);
-        }
+		if (batch == 0)
+			continue;
+
+		std::vector<std::thread> readers;
+		std::vector<size_t> read_num(thread_num, 0), read_found(thread_num, 0);
+
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for (size_t i = 0; i < thread_num; i++)
+		{
+			readers.emplace_back([&](size_t thread_id) {
+				const std::vector<persistent_map_type::key_type> &keys =
+					read_keys[thread_id];
+				std::vector<persistent_map_type::ret> rets(batch);
+				for (size_t j = 0; j < keys.size(); j += batch)
+				{
+					size_t n = std::min(batch, keys.size() - j);
+					if (batch == 1)
+						rets[0] = map->search(keys[j]);
+					else
+						map->multi_search(&keys[j], n, rets.data());
+
+					for (size_t k = 0; k < n; k++)
+					{
+						if (rets[k].found)
+							read_found[thread_id]++;
+					}
+				}
+				read_num[thread_id] = keys.size();
+			}, i);
+		}
+
+		for (auto &t : readers) {
+			t.join();
+		}
+		clock_gettime(CLOCK_MONOTONIC, &end);
+
+		size_t reads = 0, reads_found = 0;
+		for (size_t t = 0; t < thread_num; ++t) {
+			reads += read_num[t];
+			reads_found += read_found[t];
+		}
+		elapsed_sec = ((end.tv_sec - start.tv_sec) * 1000000000 +
+			(end.tv_nsec - start.tv_nsec)) / 1000000000.0;
+		printf("read batch %ld: %ld found, %ld not found, %f reqs per second (%ld threads)\n",
+			batch, reads_found, reads - reads_found, reads / elapsed_sec, thread_num);
 	}
-    printf("Average latency: %f (ns)\n", total_latency * 1.0 / READ_WRITE_NUM);
-	FILE *fp_reslut = fopen("latency.txt", "w");
-	fprintf(fp_reslut, "%f", total_latency * 1.0 / READ_WRITE_NUM);
-	fclose(fp_reslut);
+
+#ifdef LATENCY_ENABLE
+	const char *op_names[] = {"UNKNOWN", "INSERT", "READ", "DELETE", "UPDATE"};
+	double mean_latency = report_latency(latency, thread_num, op_names,
+		static_cast<size_t>(clevel_op::MAX_OP));
+	FILE *fp_result = fopen("latency.txt", "w");
+	fprintf(fp_result, "%f", mean_latency);
+	fclose(fp_result);
 #endif
+	for (size_t t = 0; t < thread_num; t++)
+		delete[] latency[t];
 
 	return 0;
 }
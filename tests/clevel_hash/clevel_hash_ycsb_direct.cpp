@@ -0,0 +1,2 @@
+#define CLEVEL_DIRECT_ADDR 1
+#include "clevel_hash_ycsb.cpp"
\ No newline at end of file
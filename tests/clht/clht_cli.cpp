@@ -143,6 +143,7 @@ main(int argc, char *argv[])
 	else
 	{
 		pop = nvobj::pool<root>::open(path, LAYOUT);
+		pop.root()->cons->runtime_initialize();
 	}
 
 	clht_op op = parse_clht_op(argv[2]);
@@ -12,6 +12,7 @@
 #include <vector>
 
 #include <libpmemobj++/experimental/concurrent_hash_map.hpp>
+#include "latency_histogram.hpp"
 #include "polymorphic_string.h"
 
 #define LAYOUT "concurrent_hash_map"
@@ -102,7 +103,7 @@ struct sub_thread {
 	uint64_t del_existing;
 	uint64_t thread_num;
 	thread_queue *run_queue;
-	double *latency_queue;
+	latency_histogram *latency;
 };
 
 } /* Annoymous namespace */
@@ -204,11 +205,11 @@ main(int argc, char *argv[])
 	}
 
 	thread_queue* run_queue[thread_num];
-	double* latency_queue[thread_num];
+	latency_histogram* latency[thread_num];
     int move[thread_num];
     for(size_t t = 0; t < thread_num; t ++){
         run_queue[t] = (thread_queue *)calloc(READ_WRITE_NUM / thread_num + 1, sizeof(thread_queue));
-		latency_queue[t] = (double *)calloc(READ_WRITE_NUM / thread_num + 1, sizeof(double));
+		latency[t] = new latency_histogram[static_cast<size_t>(cmap_op::MAX_OP)];
         move[t] = 0;
     }
 
@@ -246,22 +247,24 @@ main(int argc, char *argv[])
 		THREADS[t].del_existing = 0;
         THREADS[t].thread_num = thread_num;
         THREADS[t].run_queue = run_queue[t];
-		THREADS[t].latency_queue = latency_queue[t];
+		THREADS[t].latency = latency[t];
     }
 
     std::vector<std::thread> threads;
     threads.reserve(thread_num);
 
 	struct timespec start, end;
-#ifdef LATENCY_ENABLE
-	struct timespec stop;
-#endif
     clock_gettime(CLOCK_MONOTONIC, &start);
 
 	for (size_t i = 0; i < thread_num; i++)
 	{
 		threads.emplace_back([&](size_t thread_id) {
 			printf("Thread %ld is opened\n", thread_id);
+#ifdef LATENCY_ENABLE
+			// Latencies run from the completion of the previous
+			// operation, so one clock read is taken per operation.
+			uint64_t last = latency_histogram::now_ns();
+#endif
 			for (size_t j = 0; j < READ_WRITE_NUM / thread_num; j++)
 			{
 				if (THREADS[thread_id].run_queue[j].operation == cmap_op::INSERT)
@@ -302,9 +305,10 @@ main(int argc, char *argv[])
 					exit(1);
 				}
 #ifdef LATENCY_ENABLE
-				clock_gettime(CLOCK_MONOTONIC, &stop);
-				THREADS[thread_id].latency_queue[j] = stop.tv_sec * 1000000000.0 + stop.tv_nsec;
-				assert(THREADS[thread_id].latency_queue[j] > 0);
+				uint64_t now = latency_histogram::now_ns();
+				THREADS[thread_id].latency[static_cast<size_t>(
+					THREADS[thread_id].run_queue[j].operation)].record(now - last);
+				last = now;
 #endif
 			}
 		}, i);
@@ -341,50 +345,15 @@ main(int argc, char *argv[])
 	fclose(fp);
 
 #ifdef LATENCY_ENABLE
-    double start_time = start.tv_sec * 1000000000.0 + start.tv_nsec;
-    double latency = 0;
-    double total_latency = 0;
-#ifdef LIBPMEMOBJ_CPP_USE_TBB_RW_MUTEX
-    FILE *fp_time = fopen("cmap_tbb_processing_time.txt", "w");
-	FILE *fp_latency = fopen("cmap_tbb_latency.txt", "w");
-	FILE *fp_reslut = fopen("latency.txt", "w");
-#else
-    FILE *fp_time = fopen("cmap_processing_time.txt", "w");
-	FILE *fp_latency = fopen("cmap_latency.txt", "w");
-	FILE *fp_reslut = fopen("latency.txt", "w");
-#endif
-
-    for (size_t t = 0; t < thread_num; ++t)
-    {
-        for (size_t i = 0; i < READ_WRITE_NUM / thread_num; i++)
-        {
-            latency = THREADS[t].latency_queue[i] - start_time;
-            total_latency += latency;
-            fprintf(fp_time, "%f\n", latency);
-        }
-    }
-	printf("Average time: %f (ns)\n", total_latency * 1.0 / READ_WRITE_NUM);
-
-	total_latency = 0;
-
-	for (size_t t = 0; t < thread_num; ++t)
-	{
-		latency = THREADS[t].latency_queue[0] - start_time;
-		total_latency += latency;
-		fprintf(fp_latency, "%f\n", latency);
-
-		for (size_t i = 1; i < READ_WRITE_NUM / thread_num; i++)
-        {
-            latency = THREADS[t].latency_queue[i] - THREADS[t].latency_queue[i-1];
-            total_latency += latency;
-            fprintf(fp_latency, "%f\n", latency);
-        }
-	}
-    printf("Average latency: %f (ns)\n", total_latency * 1.0 / READ_WRITE_NUM);
-
-	fprintf(fp_reslut, "%f", total_latency * 1.0 / READ_WRITE_NUM);
-	fclose(fp_reslut);
+	const char *op_names[] = {"UNKNOWN", "INSERT", "READ", "DELETE", "UPDATE"};
+	double mean_latency = report_latency(latency, thread_num, op_names,
+		static_cast<size_t>(cmap_op::MAX_OP));
+	FILE *fp_result = fopen("latency.txt", "w");
+	fprintf(fp_result, "%f", mean_latency);
+	fclose(fp_result);
 #endif
+	for (size_t t = 0; t < thread_num; t++)
+		delete[] latency[t];
 
 	return 0;
 }
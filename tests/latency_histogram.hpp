@@ -0,0 +1,228 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <time.h>
+
+/*
+ * Log-linear histogram of latencies in nanoseconds, in the manner of
+ * HdrHistogram. Values below 2^sub_bits have a bucket each, and every
+ * power of two above is split into 2^sub_bits buckets, so a value is
+ * reported within 1 / 2^sub_bits of itself. Recording is a few shifts
+ * and an increment, so each thread keeps its own histograms and merges
+ * them after the run.
+ */
+class latency_histogram {
+public:
+	static const unsigned sub_bits = 5;
+	static const size_t sub_buckets = size_t(1) << sub_bits;
+	static const size_t bucket_num = (65 - sub_bits) * sub_buckets;
+
+	latency_histogram()
+	{
+		reset();
+	}
+
+	void
+	reset()
+	{
+		for (size_t i = 0; i < bucket_num; i++)
+			buckets[i] = 0;
+		n = 0;
+		sum = 0;
+		max_ns = 0;
+	}
+
+	/*
+	 * Get the current time of CLOCK_MONOTONIC in nanoseconds.
+	 */
+	static uint64_t
+	now_ns()
+	{
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL +
+			static_cast<uint64_t>(ts.tv_nsec);
+	}
+
+	void
+	record(uint64_t ns)
+	{
+		buckets[index(ns)]++;
+		n++;
+		sum += ns;
+		if (ns > max_ns)
+			max_ns = ns;
+	}
+
+	void
+	merge(const latency_histogram &other)
+	{
+		for (size_t i = 0; i < bucket_num; i++)
+			buckets[i] += other.buckets[i];
+		n += other.n;
+		sum += other.sum;
+		if (other.max_ns > max_ns)
+			max_ns = other.max_ns;
+	}
+
+	uint64_t
+	count() const
+	{
+		return n;
+	}
+
+	uint64_t
+	max() const
+	{
+		return max_ns;
+	}
+
+	double
+	mean() const
+	{
+		return n == 0 ? 0 : static_cast<double>(sum) / n;
+	}
+
+	/*
+	 * Get the latency that p percent of the values do not exceed, as
+	 * the upper bound of its bucket, and never above max().
+	 */
+	uint64_t
+	percentile(double p) const
+	{
+		if (n == 0)
+			return 0;
+
+		uint64_t rank = static_cast<uint64_t>(p / 100 * n + 0.5);
+		if (rank == 0)
+			rank = 1;
+
+		uint64_t seen = 0;
+		for (size_t i = 0; i < bucket_num; i++)
+		{
+			seen += buckets[i];
+			if (seen >= rank)
+				return upper_bound(i) < max_ns ? upper_bound(i) : max_ns;
+		}
+
+		return max_ns;
+	}
+
+	/*
+	 * Print count, mean, p50, p99, p99.9, p99.99 and max in one line.
+	 */
+	void
+	print(const char *name) const
+	{
+		printf("%s latency (ns): count %lu, mean %.1f, p50 %lu, p99 %lu, "
+			"p99.9 %lu, p99.99 %lu, max %lu\n", name,
+			static_cast<unsigned long>(n), mean(),
+			static_cast<unsigned long>(percentile(50)),
+			static_cast<unsigned long>(percentile(99)),
+			static_cast<unsigned long>(percentile(99.9)),
+			static_cast<unsigned long>(percentile(99.99)),
+			static_cast<unsigned long>(max_ns));
+	}
+
+	/*
+	 * Write the CDF as CSV rows of "name,latency_ns,fraction", one per
+	 * non-empty bucket.
+	 */
+	void
+	write_cdf(FILE *fp, const char *name) const
+	{
+		uint64_t seen = 0;
+		for (size_t i = 0; i < bucket_num; i++)
+		{
+			if (buckets[i] == 0)
+				continue;
+
+			seen += buckets[i];
+			uint64_t ns = upper_bound(i) < max_ns ? upper_bound(i) : max_ns;
+			fprintf(fp, "%s,%lu,%f\n", name,
+				static_cast<unsigned long>(ns),
+				static_cast<double>(seen) / n);
+		}
+	}
+
+private:
+	static size_t
+	index(uint64_t v)
+	{
+		if (v < sub_buckets)
+			return static_cast<size_t>(v);
+
+		int msb = 63 - __builtin_clzll(v);
+		unsigned shift = static_cast<unsigned>(msb - static_cast<int>(sub_bits));
+		return shift * sub_buckets + static_cast<size_t>(v >> shift);
+	}
+
+	static uint64_t
+	upper_bound(size_t i)
+	{
+		if (i < sub_buckets)
+			return i;
+
+		unsigned shift = static_cast<unsigned>(i / sub_buckets) - 1;
+		uint64_t top = i - shift * sub_buckets;
+		return ((top + 1) << shift) - 1;
+	}
+
+	uint64_t buckets[bucket_num];
+	uint64_t n;
+	uint64_t sum;
+	uint64_t max_ns;
+};
+
+/*
+ * Merge the histograms of op_num operation types kept by each of
+ * thread_num threads, print a line per type that occurred, and write
+ * their CDFs to the CSV file named by LATENCY_CDF_FILE if it is set.
+ * Return the mean latency of all operations.
+ */
+inline double
+report_latency(latency_histogram **per_thread, size_t thread_num,
+	const char *const *op_names, size_t op_num)
+{
+	FILE *fp = nullptr;
+	const char *path = getenv("LATENCY_CDF_FILE");
+	if (path != nullptr)
+	{
+		fp = fopen(path, "w");
+		if (fp == nullptr)
+			printf("failed to open %s\n", path);
+		else
+			fprintf(fp, "operation,latency_ns,fraction\n");
+	}
+
+	latency_histogram *all = new latency_histogram();
+	latency_histogram *merged = new latency_histogram();
+	for (size_t op = 0; op < op_num; op++)
+	{
+		merged->reset();
+		for (size_t t = 0; t < thread_num; t++)
+			merged->merge(per_thread[t][op]);
+
+		if (merged->count() == 0)
+			continue;
+
+		merged->print(op_names[op]);
+		if (fp != nullptr)
+			merged->write_cdf(fp, op_names[op]);
+		all->merge(*merged);
+	}
+	all->print("ALL");
+	if (fp != nullptr)
+	{
+		all->write_cdf(fp, "ALL");
+		fclose(fp);
+	}
+
+	double mean = all->mean();
+	delete merged;
+	delete all;
+
+	return mean;
+}
@@ -1,8 +1,12 @@
-rm -f czy && ./concurrent_hash_map_ycsb_resize czy /home/czy/benchmark/traces/pmdk-w-100-large.load /home/czy/benchmark/traces/pmdk-w-100-large.run 16
-python gen_cdf.py latency_records.txt latency_cmap.csv
-rm -f czy && ./concurrent_level_hash_ycsb_resize czy /home/czy/benchmark/traces/pmdk-w-100-large.load /home/czy/benchmark/traces/pmdk-w-100-large.run 16
-python gen_cdf.py latency_records.txt latency_level.csv
-rm -f czy && ./cceh_ycsb_resize czy /home/czy/benchmark/traces/pmdk-w-100-large.load /home/czy/benchmark/traces/pmdk-w-100-large.run 16
-python gen_cdf.py latency_records.txt latency_cceh.csv
-rm -f czy && ./clevel_hash_ycsb_resize czy /home/czy/benchmark/traces/pmdk-w-100-large.load /home/czy/benchmark/traces/pmdk-w-100-large.run 16
-python gen_cdf.py latency_records.txt latency_clevel.csv
+# Latency CDFs of insert-only runs (100% writes) with 16 worker threads,
+# with the keys drawn by the built-in generator of the benchmark drivers.
+# Each run writes its CDF as CSV to LATENCY_CDF_FILE.
+run() {
+	rm -f pool && LATENCY_CDF_FILE=$2 ./$1 pool --threads 16 --records 0 \
+		--ops 64000000 --mix 0,0,100,0 --large --latency --json ${2%.csv}.json
+}
+
+run concurrent_hash_map_bench latency_cmap.csv
+run level_hash_bench latency_level.csv
+run cceh_bench latency_cceh.csv
+run clevel_hash_bench latency_clevel.csv
@@ -0,0 +1,156 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <random>
+
+/*
+ * Key distributions of YCSB. Each thread keeps its own generators and a
+ * random engine seeded by the thread, so the keys are drawn on the fly
+ * and the stream of a thread is the same in every run.
+ */
+
+/*
+ * FNV-1a hash of the bytes of v, which YCSB uses to scatter popular
+ * items over the key space.
+ */
+inline uint64_t
+fnv1a_64(uint64_t v)
+{
+	uint64_t h = 14695981039346656037ULL;
+	for (int i = 0; i < 8; i++)
+	{
+		h ^= v & 0xff;
+		h *= 1099511628211ULL;
+		v >>= 8;
+	}
+
+	return h;
+}
+
+/*
+ * Zipfian distribution over [0, n) with 0 < theta < 1, where 0 is the most
+ * popular item, by the method of Gray et al. that YCSB uses. The number
+ * of items may grow between calls, as for the latest distribution, and
+ * zeta(n) is then extended rather than recomputed. It is summed exactly
+ * for the first exact_items items and by the Euler-Maclaurin formula
+ * beyond, so that billions of items take no longer to set up than a
+ * million.
+ */
+class zipfian_generator {
+public:
+	static const uint64_t exact_items = uint64_t(1) << 20;
+
+	zipfian_generator(uint64_t n, double theta)
+	    : theta(theta), alpha(1 / (1 - theta)),
+	      zeta2(1 + std::pow(0.5, theta)), n(0), counted(0),
+	      zeta_exact(0), zetan(0), eta(0)
+	{
+		grow(n > 0 ? n : 1);
+	}
+
+	template <typename Rng>
+	uint64_t
+	next(Rng &rng)
+	{
+		double u = std::uniform_real_distribution<double>(0, 1)(rng);
+		double uz = u * zetan;
+		uint64_t k;
+		if (uz < 1)
+			k = 0;
+		else if (uz < zeta2)
+			k = 1;
+		else
+			k = static_cast<uint64_t>(
+				n * std::pow(eta * u - eta + 1, alpha));
+
+		return k < n ? k : n - 1;
+	}
+
+	/*
+	 * Draw from [0, items), growing the distribution if items exceeds
+	 * its size.
+	 */
+	template <typename Rng>
+	uint64_t
+	next(Rng &rng, uint64_t items)
+	{
+		if (items > n)
+			grow(items);
+
+		uint64_t k = next(rng);
+		return k < items ? k : items - 1;
+	}
+
+	uint64_t
+	size() const
+	{
+		return n;
+	}
+
+private:
+	void
+	grow(uint64_t items)
+	{
+		uint64_t exact = std::min(items, exact_items);
+		for (uint64_t i = counted + 1; i <= exact; i++)
+			zeta_exact += std::pow(static_cast<double>(i), -theta);
+		counted = std::max(counted, exact);
+
+		zetan = zeta_exact;
+		if (items > exact)
+		{
+			// sum of i^-theta over (exact, items]
+			double a = static_cast<double>(exact);
+			double b = static_cast<double>(items);
+			zetan += (std::pow(b, 1 - theta) - std::pow(a, 1 - theta)) /
+					(1 - theta) +
+				(std::pow(b, -theta) - std::pow(a, -theta)) / 2 -
+				theta * (std::pow(b, -theta - 1) -
+					std::pow(a, -theta - 1)) / 12;
+		}
+
+		n = items;
+		eta = (1 - std::pow(2.0 / n, 1 - theta)) / (1 - zeta2 / zetan);
+	}
+
+	double theta, alpha, zeta2;
+	uint64_t n, counted;
+	double zeta_exact, zetan, eta;
+};
+
+/*
+ * Hotspot distribution over [0, n) of YCSB: hot_ops of the draws pick
+ * uniformly among the first hot_set of the items, and the rest among the
+ * others.
+ */
+class hotspot_generator {
+public:
+	hotspot_generator(uint64_t n, double hot_set, double hot_ops)
+	    : n(n > 0 ? n : 1), hot_ops(hot_ops)
+	{
+		hot_n = static_cast<uint64_t>(this->n * hot_set);
+		if (hot_n == 0)
+			hot_n = 1;
+		if (hot_n > this->n)
+			hot_n = this->n;
+	}
+
+	template <typename Rng>
+	uint64_t
+	next(Rng &rng)
+	{
+		bool hot = hot_n == n ||
+			std::uniform_real_distribution<double>(0, 1)(rng) < hot_ops;
+		if (hot)
+			return std::uniform_int_distribution<uint64_t>(0,
+				hot_n - 1)(rng);
+
+		return std::uniform_int_distribution<uint64_t>(hot_n, n - 1)(rng);
+	}
+
+private:
+	uint64_t n, hot_n;
+	double hot_ops;
+};